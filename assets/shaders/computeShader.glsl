@@ -1,48 +1,140 @@
 #version 450 core
 
 layout (local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+// First pixel of the tiles RayTracer::dispatchTiles sends in one dispatch, 0 for previews
+layout(location = 0) uniform ivec2 tileOffset;
 layout (binding = 0, rgba32f) uniform image2D img_output;
 
+// Per pixel x = sample count, y = luminance sum, z = squared luminance sum, kept while accumulating for adaptive sampling
+layout (binding = 1, rgba32f) uniform image2D img_statistics;
+
 struct Material {
     vec4 materialColour; // xyz = color, w = reflectivity
     vec4 emmissiveColor; // xyz = emission, w = intensity
 };
 
+// Matches Sphere and Triangle in scene.h, both index into the shared material table
 struct Sphere {
     vec4 centre; // xyz = position, w = radius
-    Material material;
+    uint materialIndex;
 };
 
 layout(std430, binding = 1) buffer Spheres {
     Sphere spheres[];
 };
 
+// Matches Triangle in scene.h, n0 is NO_NORMAL for a flat shaded triangle
 struct Triangle {
-    vec3 v0;
-    vec3 v1;
-    vec3 v2;
-    vec3 normal;
-    Material material;
+    uint v0; // indices into vertices
+    uint v1;
+    uint v2;
+    uint materialIndex;
+    uint n0; // indices into normals
+    uint n1;
+    uint n2;
+    uint padding; // the C++ struct is aligned to 16 bytes
 };
 
+#define NO_NORMAL 0xffffffffu
+
 layout(std430, binding = 3) buffer Triangles {
     Triangle triangles[];
 };
 
+// Tightly packed xyz positions, a vec3 array would be padded to 16 bytes per element
+layout(std430, binding = 6) buffer Vertices {
+    float vertices[];
+};
+
+// Unit shading normals packed like the vertices
+layout(std430, binding = 11) buffer Normals {
+    float normals[];
+};
+
+layout(std430, binding = 7) buffer Materials {
+    Material materials[];
+};
+
+// Primitive ids of every emissive sphere and triangle, see Scene::getLights
+layout(std430, binding = 8) buffer Lights {
+    uint lights[];
+};
+
+// Matches BVHNode in bvh.h, interior nodes store their left child (right = left + 1), leaves their first primitive
+struct BVHNode {
+    vec3 boundsMin;
+    int leftOrFirst;
+    vec3 boundsMax;
+    int primitiveCount; // 0 for interior nodes
+};
+
+// Pixels that were still sampled this frame, read back and reset by RayTracer::run
+layout(std430, binding = 9) buffer AdaptiveCounters {
+    uint activePixelCount;
+};
+
+// Sampler::getBlueNoiseMask followed by Sampler::getSequenceSteps, uploaded once by RayTracer::init
+layout(std430, binding = 10) buffer SamplerTables {
+    uint blueNoiseRanks[4096];
+    uint sequenceSteps[];
+};
+
+layout(std430, binding = 4) buffer BVHNodes {
+    BVHNode nodes[];
+};
+
+// Primitive ids below spheres.length() are spheres, the rest index into triangles
+layout(std430, binding = 5) buffer BVHPrimitives {
+    uint primitiveIndices[];
+};
+
+#define BVH_MAX_DEPTH 64
+const float BVH_MISS = 1e30;
+
 layout(std140, binding = 2) uniform Params { 
     vec4 info; // x = sphere count, y = frame count, z = accumulation count, w = isAccumulating
     vec4 backgroundColourAndNumBounces; // xyz = background colour, w = number of bounces
-    float currentTime;
+    int samplingMode; // SamplingMode in pathTracer.h
+    float adaptiveThreshold; // 0 samples every pixel every frame
+    int samplesPerPixel; // PathTracer::getAdaptiveSampleCount of the last frame's active pixels
+    int samplerType; // SamplerType in sampler.h
+    int previewLevel; // RayTracer::m_previewLevel, each invocation traces one 2^previewLevel block and nothing accumulates
 };
 
-struct Camera {
-    vec3 position;
-    vec3 forward;
-    vec3 up;
-    vec3 right;
-    float fov;
+// Scene::m_camera, uploaded every frame by RayTracer::run
+layout(std140, binding = 3) uniform CameraParams {
+    vec4 cameraLocation; // w = tan of half the vertical fov
+    vec4 cameraForward;
+    vec4 cameraRight;
+    vec4 cameraUp;
 };
 
+#define SAMPLING_UNIFORM 0
+#define SAMPLING_IMPORTANCE 1
+#define SAMPLING_NEXT_EVENT 2
+
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+
+// Match SampleDimension and the Sampler constants in sampler.h
+#define DIMENSION_BOUNCE 0u
+#define DIMENSION_ROULETTE 2u
+#define DIMENSION_LIGHT_CHOICE 3u
+#define DIMENSION_LIGHT 4u
+#define DIMENSION_LOBE 6u
+#define DIMENSION_COUNT 7u
+#define BLUE_NOISE_SIZE 64u
+#define SEQUENCE_DIMENSION_COUNT 256u
+
+// Matches PathTracer::rouletteStartBounce
+#define ROULETTE_START_BOUNCE 3
+
+// Match PathTracer::minimumAdaptiveSamples and PixelStatistics::luminanceFloor
+#define MINIMUM_ADAPTIVE_SAMPLES 16.0
+#define LUMINANCE_FLOOR 0.1
+
 struct Ray {
     vec3 origin;
     vec3 direction;
@@ -56,13 +148,14 @@ struct RayHit {
     vec3 colourAccumulation;
 };
 
-vec3 rayDirection(Camera camera, vec2 uv) {
-    vec3 dir = normalize(
-        camera.forward +
-        (uv.x - 0.5) * camera.right * tan(radians(camera.fov) * 0.5) * 2.0 +
-        (uv.y - 0.5) * camera.up * tan(radians(camera.fov) * 0.5) * 2.0
-    );
-    return dir;
+// Same as Camera::getRayDirection, point is in pixels from the top left corner of the image
+vec3 getRayDirection(vec2 point, vec2 size) {
+    float rayFactor = cameraLocation.w;
+    float rayFactorAR = rayFactor * (size.x / size.y);
+
+    return normalize(cameraForward.xyz
+        + (2.0 * point.x / size.x - 1.0) * rayFactorAR * cameraRight.xyz
+        + (1.0 - 2.0 * point.y / size.y) * rayFactor * cameraUp.xyz);
 }
 
 // Thanks to https://amindforeverprogramming.blogspot.com/2013/07/random-floats-in-glsl-330.html
@@ -75,30 +168,134 @@ uint hash( uint x ) {
     return x;
 }
 
-float random( float f ) {
-    uint x = floatBitsToUint(f);
+// A xorshift step before the hash, same as mix in sampler.cpp
+uint mixBits( uint x ) {
     x ^= x << 13u;
     x ^= x >> 17u;
     x ^= x << 5u;
-    x = hash(x);
-    return x * (1.0 / 4294967295.0);
+    return hash(x);
+}
+
+// The path sample being traced, the same (pixel, sample index, bounce, dimension) as the CPU Sampler
+uvec2 samplePixel;
+uint samplePixelSeed;
+uint sampleIndex;
+uint sampleDimensionOffset;
+
+void setBounce(int bounce) {
+    sampleDimensionOffset = uint(bounce) * DIMENSION_COUNT;
+}
+
+// Burley "Practical Hash-based Owen Scrambling", same as getOwenScrambled in sampler.cpp
+uint getOwenScrambled(uint x, uint seed) {
+    x = bitfieldReverse(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return bitfieldReverse(x);
+}
+
+// Second Sobol dimension, the first is bitfieldReverse(index)
+uint getSobol1(uint index) {
+    uint result = 0u;
+    for (uint direction = 0x80000000u; index != 0u; index >>= 1u, direction ^= direction >> 1u) {
+        if ((index & 1u) != 0u) result ^= direction;
+    }
+    return result;
 }
 
-// Uniform random point on unit sphere
-vec3 getRandomOnUnitSphere(float seed) {
-    float z = random(seed) * 2.0 - 1.0;
-    float t = random(seed + 1.0) * 6.28318530718;
-    float r = sqrt(1.0 - z*z);
+// Top 24 bits, so the result is always below 1
+float toUnitFloat(uint x) {
+    return float(x >> 8u) * (1.0 / 16777216.0);
+}
+
+uint getDimensionSeed(uint dimension) {
+    return hash(samplePixelSeed ^ hash(dimension + 1u));
+}
+
+uint getRandom(uint dimension) {
+    return mixBits(getDimensionSeed(dimension) ^ hash(sampleIndex + 0x632be5abu));
+}
+
+uint getBlueNoise(uint dimension) {
+    uint offset = hash(dimension + 1u);
+    uint x = (samplePixel.x + offset) & (BLUE_NOISE_SIZE - 1u);
+    uint y = (samplePixel.y + (offset >> 16u)) & (BLUE_NOISE_SIZE - 1u);
+
+    uint rank = blueNoiseRanks[y * BLUE_NOISE_SIZE + x];
+    return (rank << 20u) + (1u << 19u) + sampleIndex * sequenceSteps[dimension % SEQUENCE_DIMENSION_COUNT];
+}
+
+float getSample1D(uint dimension) {
+    uint dimensionIndex = sampleDimensionOffset + dimension;
+
+    if (samplerType == SAMPLER_SOBOL) {
+        uint seed = getDimensionSeed(dimensionIndex);
+        uint index = getOwenScrambled(sampleIndex, seed);
+        return toUnitFloat(getOwenScrambled(bitfieldReverse(index), hash(seed ^ 0xa511e9b3u)));
+    }
+
+    if (samplerType == SAMPLER_BLUE_NOISE) return toUnitFloat(getBlueNoise(dimensionIndex));
+
+    return toUnitFloat(getRandom(dimensionIndex));
+}
+
+// Uses dimension and dimension + 1, which are stratified together
+vec2 getSample2D(uint dimension) {
+    uint dimensionIndex = sampleDimensionOffset + dimension;
+
+    if (samplerType == SAMPLER_SOBOL) {
+        uint seed = getDimensionSeed(dimensionIndex);
+        uint index = getOwenScrambled(sampleIndex, seed);
+        return vec2(
+            toUnitFloat(getOwenScrambled(bitfieldReverse(index), hash(seed ^ 0xa511e9b3u))),
+            toUnitFloat(getOwenScrambled(getSobol1(index), hash(seed ^ 0x63d83595u))));
+    }
+
+    if (samplerType == SAMPLER_BLUE_NOISE) return vec2(toUnitFloat(getBlueNoise(dimensionIndex)), toUnitFloat(getBlueNoise(dimensionIndex + 1u)));
+
+    return vec2(toUnitFloat(getRandom(dimensionIndex)), toUnitFloat(getRandom(dimensionIndex + 1u)));
+}
+
+// Uniform random point on unit sphere, Archimedes' hat box so each dimension of the sample stays stratified
+vec3 getRandomOnUnitSphere(vec2 unitSample) {
+    float z = unitSample.x * 2.0 - 1.0;
+    float t = unitSample.y * 6.28318530718;
+    float r = sqrt(max(0.0, 1.0 - z*z));
     return vec3(r * cos(t), r * sin(t), z);
 }
 
 // Hemisphere biased along normal
-vec3 getRandomOnUnitHemisphere(vec3 normal, float seed) {
-    vec3 dir = getRandomOnUnitSphere(seed);
+vec3 getRandomOnUnitHemisphere(vec3 normal, vec2 unitSample) {
+    vec3 dir = getRandomOnUnitSphere(unitSample);
     if (dot(dir, normal) < 0.0) dir = -dir;
     return dir;
 }
 
+// Branchless orthonormal basis (Duff et al. 2017)
+void getOrthonormalBasis(vec3 normal, out vec3 tangent, out vec3 bitangent) {
+    float s = normal.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (s + normal.z);
+    float b = normal.x * normal.y * a;
+    tangent = vec3(1.0 + s * normal.x * normal.x * a, s * b, -s * normal.x);
+    bitangent = vec3(b, s + normal.y * normal.y * a, -normal.y);
+}
+
+// Cosine distributed direction around normal, a uniform disk sample projected up onto the hemisphere
+vec3 getCosineWeightedOnHemisphere(vec3 normal, vec2 unitSample) {
+    float radiusSquared = unitSample.x;
+    float angle = unitSample.y * 6.28318530718;
+    float radius = sqrt(radiusSquared);
+
+    vec3 tangent;
+    vec3 bitangent;
+    getOrthonormalBasis(normal, tangent, bitangent);
+
+    return radius * cos(angle) * tangent + radius * sin(angle) * bitangent + sqrt(max(0.0, 1.0 - radiusSquared)) * normal;
+}
+
 bool isIntersectSphere(Ray ray, Sphere sphere, inout RayHit rayHit) {
     vec3 oc = ray.origin - sphere.centre.xyz;
     float bTerm = dot(oc, ray.direction);
@@ -117,62 +314,279 @@ bool isIntersectSphere(Ray ray, Sphere sphere, inout RayHit rayHit) {
     return true;
 }
 
-bool isIntersectTriangle(Ray ray, Triangle triangle, inout RayHit rayHit) {
-    float denom = dot(ray.direction, triangle.normal);
-    if (abs(denom) < 1e-6) return false; // parallel
+vec3 getVertex(uint index) {
+    return vec3(vertices[3u * index], vertices[3u * index + 1u], vertices[3u * index + 2u]);
+}
 
-    float t = dot(triangle.v0 - ray.origin, triangle.normal) / denom;
-    if (t < 0.001) return false; // behind ray
+vec3 getNormal(uint index) {
+    return vec3(normals[3u * index], normals[3u * index + 1u], normals[3u * index + 2u]);
+}
+
+// Same as Scene::getShadingNormal, the corner normals interpolated at point or the face normal for a flat triangle
+vec3 getShadingNormal(Triangle triangle, vec3 point) {
+    vec3 v0 = getVertex(triangle.v0);
+    vec3 edge0 = getVertex(triangle.v1) - v0;
+    vec3 edge1 = getVertex(triangle.v2) - v0;
+    vec3 faceNormal = normalize(cross(edge0, edge1));
+
+    if (triangle.n0 == NO_NORMAL) return faceNormal;
+
+    vec3 offset = point - v0;
+    float d00 = dot(edge0, edge0);
+    float d01 = dot(edge0, edge1);
+    float d11 = dot(edge1, edge1);
+    float d20 = dot(offset, edge0);
+    float d21 = dot(offset, edge1);
+    float inverseDenominator = 1.0 / (d00 * d11 - d01 * d01);
+    float v = (d11 * d20 - d01 * d21) * inverseDenominator;
+    float w = (d00 * d21 - d01 * d20) * inverseDenominator;
+
+    vec3 normal = (1.0 - v - w) * getNormal(triangle.n0) + v * getNormal(triangle.n1) + w * getNormal(triangle.n2);
+    float normalLength = length(normal);
+    return normalLength > 0.0 ? normal / normalLength : faceNormal;
+}
 
-    vec3 hitPoint = ray.origin + ray.direction * t;
+// Moller-Trumbore like PathTracer::isRayIntersectTriangle, only the vertices are used
+bool isIntersectTriangle(Ray ray, Triangle triangle, inout RayHit rayHit) {
+    vec3 v0 = getVertex(triangle.v0);
+    vec3 edge0 = getVertex(triangle.v1) - v0;
+    vec3 edge1 = getVertex(triangle.v2) - v0;
+
+    vec3 pVector = cross(ray.direction, edge1);
+    float determinant = dot(edge0, pVector);
+    if (abs(determinant) < 1e-8) return false; // parallel
 
-    vec3 e0 = triangle.v1 - triangle.v0;
-    vec3 e1 = triangle.v2 - triangle.v0;
-    vec3 p  = hitPoint - triangle.v0;
+    float inverseDeterminant = 1.0 / determinant;
 
-    float dot00 = dot(e0, e0);
-    float dot01 = dot(e0, e1);
-    float dot02 = dot(e0, p);
-    float dot11 = dot(e1, e1);
-    float dot12 = dot(e1, p);
+    vec3 tVector = ray.origin - v0;
+    float u = dot(tVector, pVector) * inverseDeterminant;
+    if (u < 0.0 || u > 1.0) return false;
 
-    float invDenom = 1.0 / (dot00 * dot11 - dot01 * dot01);
-    float u = (dot11 * dot02 - dot01 * dot12) * invDenom;
-    float v = (dot00 * dot12 - dot01 * dot02) * invDenom;
+    vec3 qVector = cross(tVector, edge0);
+    float v = dot(ray.direction, qVector) * inverseDeterminant;
+    if (v < 0.0 || u + v > 1.0) return false;
 
-    if (u < 0.0 || v < 0.0 || u + v > 1.0) return false;
+    float t = dot(edge1, qVector) * inverseDeterminant;
+    if (t < 0.001) return false; // behind ray
 
     rayHit.t = t;
     return true;
 }
 
-void main() {
-    Camera camera;
-    camera.position = vec3(0.0, 0.0, 10.0);
-    camera.fov = 45.0;
+// Slab test, returns the entry distance or BVH_MISS
+float intersectAABB(Ray ray, vec3 inverseDirection, BVHNode node, float closestT) {
+    vec3 t0 = (node.boundsMin - ray.origin) * inverseDirection;
+    vec3 t1 = (node.boundsMax - ray.origin) * inverseDirection;
 
-    float yaw   = -90* 3.14/180;   // rotate around Y
-    float pitch = 0.0* 3.14/180;   // look up/down
+    vec3 tSmall = min(t0, t1);
+    vec3 tBig = max(t0, t1);
 
-    camera.forward = normalize(vec3(
-        cos(pitch) * cos(yaw),
-        sin(pitch),
-        cos(pitch) * sin(yaw)
-    ));
+    float tNear = max(max(tSmall.x, tSmall.y), tSmall.z);
+    float tFar = min(min(tBig.x, tBig.y), tBig.z);
 
-    vec3 worldUp = vec3(0.0, 1.0, 0.0);
-    camera.right   = normalize(cross(camera.forward, worldUp));
-    camera.up      = normalize(cross(camera.right, camera.forward));
+    if (tFar >= tNear && tFar > 0.0 && tNear < closestT) return tNear;
+    return BVH_MISS;
+}
 
-    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
-    ivec2 size = imageSize(img_output);
-    if (pixel.x >= size.x || pixel.y >= size.y) return;
+void intersectPrimitive(Ray ray, uint primitive, uint sphereCount, inout RayHit rayHit) {
+    RayHit tempHit = rayHit;
 
-    vec2 uv = vec2(pixel) / vec2(size);
-    Ray ray;
-    ray.origin = camera.position;
-    ray.direction = rayDirection(camera, uv);
+    if (primitive < sphereCount) {
+        if (isIntersectSphere(ray, spheres[primitive], tempHit) && tempHit.t < rayHit.t) {
+            rayHit.t = tempHit.t;
+            rayHit.sphereIndex = int(primitive);
+            rayHit.triangleIndex = -1;
+        }
+        return;
+    }
+
+    uint triangle = primitive - sphereCount;
+    if (isIntersectTriangle(ray, triangles[triangle], tempHit) && tempHit.t < rayHit.t) {
+        rayHit.t = tempHit.t;
+        rayHit.sphereIndex = -1;
+        rayHit.triangleIndex = int(triangle);
+    }
+}
+
+// Stack based closest hit traversal, the nearer child is visited first so the far one can be culled
+void findClosestHit(Ray ray, inout RayHit rayHit) {
+    rayHit.t = 1e20;
+    rayHit.sphereIndex = -1;
+    rayHit.triangleIndex = -1;
+
+    if (nodes.length() == 0) return;
+
+    vec3 inverseDirection = 1.0 / ray.direction;
+    if (intersectAABB(ray, inverseDirection, nodes[0], rayHit.t) == BVH_MISS) return;
+
+    uint stack[BVH_MAX_DEPTH];
+    float stackDistances[BVH_MAX_DEPTH];
+    int stackSize = 0;
+
+    uint sphereCount = uint(spheres.length());
+    uint nodeIndex = 0u;
+
+    while (true) {
+        BVHNode node = nodes[nodeIndex];
+
+        if (node.primitiveCount > 0) {
+            for (int i = 0; i < node.primitiveCount; i++) {
+                intersectPrimitive(ray, primitiveIndices[node.leftOrFirst + i], sphereCount, rayHit);
+            }
+        }
+
+        else {
+            uint nearIndex = uint(node.leftOrFirst);
+            uint farIndex = nearIndex + 1u;
+            float nearDistance = intersectAABB(ray, inverseDirection, nodes[nearIndex], rayHit.t);
+            float farDistance = intersectAABB(ray, inverseDirection, nodes[farIndex], rayHit.t);
+
+            if (farDistance < nearDistance) {
+                uint tempIndex = nearIndex;
+                nearIndex = farIndex;
+                farIndex = tempIndex;
+
+                float tempDistance = nearDistance;
+                nearDistance = farDistance;
+                farDistance = tempDistance;
+            }
 
+            if (nearDistance != BVH_MISS) {
+                if (farDistance != BVH_MISS) {
+                    stack[stackSize] = farIndex;
+                    stackDistances[stackSize] = farDistance;
+                    stackSize++;
+                }
+
+                nodeIndex = nearIndex;
+                continue;
+            }
+        }
+
+        // Pop the next far child that is still in front of the closest hit
+        while (stackSize > 0 && stackDistances[stackSize - 1] >= rayHit.t) stackSize--;
+        if (stackSize == 0) break;
+
+        stackSize--;
+        nodeIndex = stack[stackSize];
+    }
+}
+
+float getPowerHeuristic(float pdf, float otherPdf) {
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+uint getPrimitiveId(RayHit rayHit) {
+    if (rayHit.sphereIndex >= 0) return uint(rayHit.sphereIndex);
+    if (rayHit.triangleIndex >= 0) return uint(spheres.length()) + uint(rayHit.triangleIndex);
+    return 0xffffffffu;
+}
+
+Material getPrimitiveMaterial(uint primitive) {
+    uint sphereCount = uint(spheres.length());
+    return primitive < sphereCount ? materials[spheres[primitive].materialIndex] : materials[triangles[primitive - sphereCount].materialIndex];
+}
+
+// Solid angle pdf of light sampling picking light and then direction, matches PathTracer::getLightPdf
+float getLightPdf(uint light, vec3 origin, vec3 direction, float dist) {
+    uint sphereCount = uint(spheres.length());
+    float lightCount = float(lights.length());
+
+    if (light < sphereCount) {
+        vec4 sphere = spheres[light].centre;
+        vec3 toCentre = sphere.xyz - origin;
+        float distanceSquared = dot(toCentre, toCentre);
+        float radiusSquared = sphere.w * sphere.w;
+        if (distanceSquared <= radiusSquared) return 0.0;
+
+        float sinSquared = radiusSquared / distanceSquared;
+        float oneMinusCosMax = sinSquared / (1.0 + sqrt(1.0 - sinSquared));
+        return 1.0 / (6.28318530718 * oneMinusCosMax * lightCount);
+    }
+
+    Triangle triangle = triangles[light - sphereCount];
+    vec3 v0 = getVertex(triangle.v0);
+    vec3 areaNormal = cross(getVertex(triangle.v1) - v0, getVertex(triangle.v2) - v0);
+    float projectedArea = 0.5 * abs(dot(areaNormal, direction));
+    if (projectedArea <= 0.0) return 0.0;
+
+    return dist * dist / (projectedArea * lightCount);
+}
+
+// Spheres are sampled over the cone they cover, triangles uniformly over their area
+bool sampleLightDirection(uint light, vec3 origin, vec2 unitSample, out vec3 direction, out float pdf) {
+    uint sphereCount = uint(spheres.length());
+
+    if (light < sphereCount) {
+        vec4 sphere = spheres[light].centre;
+        vec3 toCentre = sphere.xyz - origin;
+        float distanceSquared = dot(toCentre, toCentre);
+        float radiusSquared = sphere.w * sphere.w;
+        if (distanceSquared <= radiusSquared) return false;
+
+        float sinSquared = radiusSquared / distanceSquared;
+        float oneMinusCosMax = sinSquared / (1.0 + sqrt(1.0 - sinSquared));
+        float cosTheta = 1.0 - unitSample.x * oneMinusCosMax;
+        float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+        float angle = unitSample.y * 6.28318530718;
+
+        vec3 axis = toCentre / sqrt(distanceSquared);
+        vec3 tangent;
+        vec3 bitangent;
+        getOrthonormalBasis(axis, tangent, bitangent);
+
+        direction = normalize(sinTheta * cos(angle) * tangent + sinTheta * sin(angle) * bitangent + cosTheta * axis);
+        pdf = 1.0 / (6.28318530718 * oneMinusCosMax * float(lights.length()));
+        return true;
+    }
+
+    Triangle triangle = triangles[light - sphereCount];
+    vec3 v0 = getVertex(triangle.v0);
+    float squareRoot = sqrt(unitSample.x);
+    float u = 1.0 - squareRoot;
+    float v = unitSample.y * squareRoot;
+    vec3 point = v0 + u * (getVertex(triangle.v1) - v0) + v * (getVertex(triangle.v2) - v0);
+
+    vec3 offset = point - origin;
+    float dist = length(offset);
+    if (dist <= 0.0) return false;
+
+    direction = offset / dist;
+    pdf = getLightPdf(light, origin, direction, dist);
+    return pdf > 0.0;
+}
+
+// Shadow ray to one random light, weighted against the diffuse lobe with the power heuristic
+vec3 sampleLight(vec3 origin, vec3 normal, vec3 diffuseColour, float diffuseWeight) {
+    uint lightCount = uint(lights.length());
+    if (lightCount == 0u) return vec3(0.0);
+
+    uint light = lights[min(uint(getSample1D(DIMENSION_LIGHT_CHOICE) * float(lightCount)), lightCount - 1u)];
+
+    vec3 direction;
+    float lightPdf;
+    if (!sampleLightDirection(light, origin, getSample2D(DIMENSION_LIGHT), direction, lightPdf)) return vec3(0.0);
+
+    float cosine = dot(direction, normal);
+    if (cosine <= 0.0) return vec3(0.0);
+
+    Ray shadowRay;
+    shadowRay.origin = origin;
+    shadowRay.direction = direction;
+
+    RayHit shadowHit;
+    findClosestHit(shadowRay, shadowHit);
+    if (getPrimitiveId(shadowHit) != light) return vec3(0.0);
+
+    Material lightMaterial = getPrimitiveMaterial(light);
+    float bsdfPdf = diffuseWeight * cosine / 3.14159265359;
+    vec3 bsdf = diffuseWeight * diffuseColour / 3.14159265359;
+
+    return lightMaterial.emmissiveColor.xyz * lightMaterial.emmissiveColor.w * bsdf * cosine / lightPdf * getPowerHeuristic(lightPdf, bsdfPdf);
+}
+
+// One path from the camera for the sample set up by main
+vec3 tracePath(Ray ray) {
     vec3 accumulatedColor = vec3(0.0);
     float accumulatedWeight = 1.0f;
 
@@ -180,45 +594,18 @@ void main() {
     rayHit.lightAccumulation = vec3(0.0);
     rayHit.colourAccumulation = vec3(1.0);
 
+    // Pdf and origin of the last diffuse bounce for next event estimation, 0 after camera rays and mirror bounces
+    float bouncePdf = 0.0;
+    vec3 bounceOrigin = vec3(0.0);
+
     for (int bounce = 0; bounce < backgroundColourAndNumBounces.w; bounce++) {
-        float closestT = 1e20;
-        rayHit.t = 1e20;
-        rayHit.sphereIndex = -1;
-        rayHit.triangleIndex = -1;
-        
         // Find closest intersection
-        
-        for (int i = 0; i < triangles.length(); i++) {
-            RayHit tempHit = rayHit;
-            if (isIntersectTriangle(ray, triangles[i], tempHit)) {
-                if (tempHit.t < closestT) {
-                    closestT = tempHit.t;
-                    rayHit.t = tempHit.t;
-                    rayHit.sphereIndex = -1;
-                    rayHit.triangleIndex = i;
-                }
-            }
-        }
-        
-        for (int i = 0; i < spheres.length(); i++) {
-            RayHit tempHit = rayHit;
-            if (isIntersectSphere(ray, spheres[i], tempHit)) {
-                if (tempHit.t < closestT) {
-                    closestT = tempHit.t;
-                    rayHit.t = tempHit.t;
-                    rayHit.sphereIndex = i;
-                    rayHit.triangleIndex = -1;
-                }
-            }
-        }
-
-        // Debug: visualize t and sphere index
-        // imageStore(img_output, pixel, vec4(rayHit.t/20, rayHit.t/20, rayHit.t/20, 1.0));
-        // imageStore(img_output, pixel, vec4(float(rayHit.sphereIndex)/20.0, float(rayHit.sphereIndex)/20.0, float(rayHit.sphereIndex)/20.0, 1.0));
-        // return;
+        findClosestHit(ray, rayHit);
 
         if (rayHit.sphereIndex < 0 && rayHit.triangleIndex < 0) {
-            accumulatedColor += vec3(backgroundColourAndNumBounces.xyz) * rayHit.colourAccumulation * accumulatedWeight;
+            // The importance sampled paths carry their whole weight in colourAccumulation
+            float missWeight = samplingMode == SAMPLING_UNIFORM ? accumulatedWeight : 1.0;
+            accumulatedColor += vec3(backgroundColourAndNumBounces.xyz) * rayHit.colourAccumulation * missWeight;
             break;
         }
 
@@ -230,28 +617,94 @@ void main() {
         
         if (rayHit.triangleIndex < 0 && rayHit.sphereIndex >=0) {
             Sphere hitSphere = spheres[rayHit.sphereIndex];
+            Material material = materials[hitSphere.materialIndex];
             normal = normalize(hitPoint - hitSphere.centre.xyz);
-            reflectivity = hitSphere.material.materialColour.w;
-            materialColor = hitSphere.material.materialColour.xyz;
-            emmisiveColor = hitSphere.material.emmissiveColor.xyz * hitSphere.material.emmissiveColor.w;
+            reflectivity = material.materialColour.w;
+            materialColor = material.materialColour.xyz;
+            emmisiveColor = material.emmissiveColor.xyz * material.emmissiveColor.w;
         }
         
         if (rayHit.sphereIndex < 0 && rayHit.triangleIndex >=0) {
            Triangle hitTriangle = triangles[rayHit.triangleIndex];
-           normal = hitTriangle.normal;
-           reflectivity = hitTriangle.material.materialColour.w;
-           materialColor = hitTriangle.material.materialColour.xyz;
-           emmisiveColor = hitTriangle.material.emmissiveColor.xyz * hitTriangle.material.emmissiveColor.w;
+           Material material = materials[hitTriangle.materialIndex];
+           normal = getShadingNormal(hitTriangle, hitPoint);
+           reflectivity = material.materialColour.w;
+           materialColor = material.materialColour.xyz;
+           emmisiveColor = material.emmissiveColor.xyz * material.emmissiveColor.w;
         }
         
+        setBounce(bounce);
+
+        if (samplingMode == SAMPLING_NEXT_EVENT) {
+            // The previous bounce already sampled this light directly, so both estimates are weighted by the power heuristic
+            if (emmisiveColor != vec3(0.0)) {
+                float misWeight = bouncePdf > 0.0 ? getPowerHeuristic(bouncePdf, getLightPdf(getPrimitiveId(rayHit), bounceOrigin, ray.direction, rayHit.t)) : 1.0;
+                accumulatedColor += rayHit.colourAccumulation * emmisiveColor * misWeight;
+            }
+
+            // Shaded from whichever side was hit
+            if (dot(normal, ray.direction) > 0.0) normal = -normal;
+            vec3 incoming = ray.direction;
+            ray.origin = hitPoint + normal * 1e-4;
+
+            float diffuseWeight = 1.0 - reflectivity;
+            if (diffuseWeight > 0.0) {
+                accumulatedColor += rayHit.colourAccumulation * sampleLight(ray.origin, normal, materialColor, diffuseWeight);
+            }
+
+            // Mirror or diffuse lobe, each picked with its own weight so the colour is the whole path weight
+            if (getSample1D(DIMENSION_LOBE) < reflectivity) {
+                ray.direction = reflect(incoming, normal);
+                bouncePdf = 0.0;
+            }
+            else {
+                ray.direction = getCosineWeightedOnHemisphere(normal, getSample2D(DIMENSION_BOUNCE));
+                bouncePdf = diffuseWeight * dot(ray.direction, normal) / 3.14159265359;
+                bounceOrigin = ray.origin;
+            }
+
+            rayHit.colourAccumulation *= materialColor;
+
+            if (bounce + 1 >= ROULETTE_START_BOUNCE) {
+                vec3 throughput = rayHit.colourAccumulation;
+                float survivalProbability = min(1.0, max(max(throughput.x, throughput.y), throughput.z));
+                if (getSample1D(DIMENSION_ROULETTE) >= survivalProbability) break;
+                rayHit.colourAccumulation /= survivalProbability;
+            }
+            continue;
+        }
+
+        if (samplingMode == SAMPLING_IMPORTANCE) {
+            // Cosine weighted bounces cancel the Lambertian cos / pi, so the path weight is just the product of the albedos
+            accumulatedColor += rayHit.colourAccumulation * emmisiveColor;
+            rayHit.colourAccumulation *= materialColor;
+
+            // One lobe picked with its own weight, as in the next event estimation branch
+            ray.origin = hitPoint + normal * 1e-4;
+            if (getSample1D(DIMENSION_LOBE) < reflectivity) {
+                ray.direction = reflect(ray.direction, normal);
+            }
+            else {
+                ray.direction = getCosineWeightedOnHemisphere(normal, getSample2D(DIMENSION_BOUNCE));
+            }
+
+            // Russian roulette, survivors are scaled by the survival probability so the estimate stays unbiased
+            if (bounce + 1 >= ROULETTE_START_BOUNCE) {
+                vec3 throughput = rayHit.colourAccumulation;
+                float survivalProbability = min(1.0, max(max(throughput.x, throughput.y), throughput.z));
+                if (getSample1D(DIMENSION_ROULETTE) >= survivalProbability) break;
+                rayHit.colourAccumulation /= survivalProbability;
+            }
+            continue;
+        }
+
         // Accumulate emission + material color
         rayHit.lightAccumulation += emmisiveColor * accumulatedWeight;
         accumulatedColor += (rayHit.colourAccumulation) * rayHit.lightAccumulation;
         rayHit.colourAccumulation *= materialColor;
         
         // Compute new ray direction (diffuse + specular)
-        float seed = float(bounce) * 12.9898 + float(pixel.x + pixel.y * size.x) * 78.233 + currentTime*info.y;
-        vec3 randomDir = getRandomOnUnitHemisphere(normal, seed);
+        vec3 randomDir = getRandomOnUnitHemisphere(normal, getSample2D(DIMENSION_BOUNCE));
 
         ray.origin = hitPoint + normal * 1e-4;
         ray.direction = normalize((1.0 - reflectivity) * normalize(normal + randomDir) + reflectivity * reflect(ray.direction, normal));
@@ -260,15 +713,91 @@ void main() {
         accumulatedWeight *= 0.75;
     }
 
+    return accumulatedColor;
+}
+
+// Same test as PixelStatistics::isConverged, the standard error of the mean luminance relative to the mean
+bool isConverged(vec4 statistics) {
+    float count = statistics.x;
+    if (count < MINIMUM_ADAPTIVE_SAMPLES) return false;
+
+    float mean = statistics.y / count;
+    float variance = max(0.0, statistics.z / count - mean * mean) * count / (count - 1.0);
+    return sqrt(variance / count) <= adaptiveThreshold * max(mean, LUMINANCE_FLOOR);
+}
+
+// One sample through the centre of a 2^previewLevel block of pixels, written to every pixel of the block
+void tracePreviewBlock(ivec2 block, ivec2 size) {
+    int blockSize = 1 << previewLevel;
+    ivec2 first = block * blockSize;
+    if (first.x >= size.x || first.y >= size.y) return;
+
+    vec2 centre = vec2(first) + 0.5 * float(blockSize);
+    Ray ray;
+    ray.origin = cameraLocation.xyz;
+    ray.direction = getRayDirection(vec2(centre.x, float(size.y) - centre.y), vec2(size));
+
+    samplePixel = uvec2(block);
+    samplePixelSeed = hash(samplePixel.x ^ hash(samplePixel.y + 0x9e3779b9u));
+    sampleIndex = uint(info.y);
+    vec4 colour = vec4(tracePath(ray), 1.0);
+
+    ivec2 last = min(first + ivec2(blockSize), size);
+    for (int y = first.y; y < last.y; y++) {
+        for (int x = first.x; x < last.x; x++) {
+            imageStore(img_output, ivec2(x, y), colour);
+        }
+    }
+}
+
+void main() {
+    ivec2 size = imageSize(img_output);
+    if (previewLevel > 0) {
+        tracePreviewBlock(ivec2(gl_GlobalInvocationID.xy), size);
+        return;
+    }
+
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy) + tileOffset;
+    if (pixel.x >= size.x || pixel.y >= size.y) return;
+
+    // Texture rows run bottom up, so the top row of the image is the last one
+    Ray ray;
+    ray.origin = cameraLocation.xyz;
+    ray.direction = getRayDirection(vec2(float(pixel.x) + 0.5, float(size.y - pixel.y) - 0.5), vec2(size));
+
+    // Converged pixels keep their accumulated colour and hand their samples to the rest of the image
+    vec4 statistics = info.w > 0.5 ? imageLoad(img_statistics, pixel) : vec4(0.0);
+    if (info.w > 0.5 && adaptiveThreshold > 0.0 && isConverged(statistics)) return;
+
+    if (adaptiveThreshold > 0.0) atomicAdd(activePixelCount, 1u);
+
+    float previousCount = statistics.x;
+    vec3 sampleSum = vec3(0.0);
+
+    samplePixel = uvec2(pixel);
+    samplePixelSeed = hash(samplePixel.x ^ hash(samplePixel.y + 0x9e3779b9u));
+
+    for (int s = 0; s < samplesPerPixel; s++) {
+        // Accumulating pixels continue their own sequence, otherwise the frame count steps through it
+        sampleIndex = info.w > 0.5 ? uint(previousCount) + uint(s) : uint(info.y);
+        vec3 sampleColor = tracePath(ray);
+        float luminance = dot(sampleColor, vec3(0.2126, 0.7152, 0.0722));
+
+        sampleSum += sampleColor;
+        statistics += vec4(1.0, luminance, luminance * luminance, 0.0);
+    }
+
+    imageStore(img_statistics, pixel, statistics);
+
     if (info.w > 0.5) {
         vec4 prev = imageLoad(img_output, pixel);
-        // Accumulate with previous frame
-        accumulatedColor = (prev.xyz * info.z + accumulatedColor) / (info.z + 1.0);
+        // Accumulate with the earlier samples of this pixel, which converged pixels stop adding to
+        vec3 accumulatedColor = (prev.xyz * previousCount + sampleSum) / statistics.x;
         imageStore(img_output, pixel, vec4(accumulatedColor, 1.0));
     }
 
     else {
         // No accumulation
-        imageStore(img_output, pixel, vec4(accumulatedColor, 1.0));
+        imageStore(img_output, pixel, vec4(sampleSum / float(samplesPerPixel), 1.0));
     }
 }
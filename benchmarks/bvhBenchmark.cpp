@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "Renderer/bvh.h"
+#include "Renderer/scene.h"
+#include "Renderer/sphereSoA.h"
+
+// Times closest hit queries through the BVH against testing every primitive, for a sweep of random sphere scenes
+// Both use the renderer's scalar sphere kernel, so the difference is only the traversal
+// Usage: bvhBenchmark [largest primitive count], 262144 spheres by default
+namespace {
+	constexpr size_t defaultMaximumCount = 262'144;
+	constexpr size_t firstCount = 16;
+
+	// Rays per count through the BVH, the linear scan traces fewer so it stays around linearTestBudget sphere tests
+	constexpr size_t bvhRayCount = 1 << 16;
+	constexpr size_t linearTestBudget = 1 << 27;
+	constexpr size_t minimumLinearRayCount = 256;
+
+	// Spheres at a fixed density, so larger scenes are bigger rather than more crowded
+	std::vector<RayTracer::Sphere> createSpheres(size_t count, std::mt19937& random, float& halfExtent) {
+		halfExtent = std::cbrt(static_cast<float>(count));
+		std::uniform_real_distribution<float> position(-halfExtent, halfExtent);
+		std::uniform_real_distribution<float> radius(0.1f, 0.4f);
+
+		std::vector<RayTracer::Sphere> spheres(count);
+		for (RayTracer::Sphere& sphere : spheres) {
+			sphere.centre = glm::vec3(position(random), position(random), position(random));
+			sphere.radius = radius(random);
+			sphere.materialIndex = 0;
+		}
+
+		return spheres;
+	}
+
+	// From random points on a sphere around the scene towards random points inside it, so most rays cross the whole scene
+	std::vector<RayTracer::Ray> createRays(size_t count, float halfExtent, std::mt19937& random) {
+		std::uniform_real_distribution<float> position(-halfExtent, halfExtent);
+		std::normal_distribution<float> direction(0.0f, 1.0f);
+
+		std::vector<RayTracer::Ray> rays(count);
+		for (RayTracer::Ray& ray : rays) {
+			glm::vec3 outside = glm::normalize(glm::vec3(direction(random), direction(random), direction(random)));
+			ray.origin = outside * halfExtent * 2.0f;
+			ray.direction = glm::normalize(glm::vec3(position(random), position(random), position(random)) - ray.origin);
+		}
+
+		return rays;
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t maximumCount = defaultMaximumCount;
+	if (argc > 1) {
+		maximumCount = std::strtoull(argv[1], nullptr, 10);
+	}
+
+	if (maximumCount < firstCount) {
+		std::cerr << "Usage: bvhBenchmark [largest primitive count], at least " << firstCount << std::endl;
+		return 1;
+	}
+
+	RayTracer::SphereBlockFunction intersectSpheres = RayTracer::getSphereBlockFunction(RayTracer::SIMD_SCALAR);
+	std::mt19937 random(1);
+
+	std::cout << "Spheres, BVH M rays/s, linear scan M rays/s, speedup" << std::endl;
+
+	for (size_t count = firstCount; count <= maximumCount; count *= 4) {
+		float halfExtent;
+		std::vector<RayTracer::Sphere> spheres = createSpheres(count, random, halfExtent);
+
+		std::vector<RayTracer::AABB> bounds(count);
+		for (size_t i = 0; i < count; i++) {
+			bounds[i].grow(spheres[i].centre - glm::vec3(spheres[i].radius));
+			bounds[i].grow(spheres[i].centre + glm::vec3(spheres[i].radius));
+		}
+
+		RayTracer::BVH bvh;
+		bvh.build(bounds);
+
+		// One copy in leaf order for the BVH, one in the original order for the linear scan
+		RayTracer::SphereSoA leafSpheres;
+		leafSpheres.build(spheres, bvh.getPrimitiveIndices());
+
+		std::vector<std::uint32_t> identity(count);
+		std::iota(identity.begin(), identity.end(), 0u);
+		RayTracer::SphereSoA allSpheres;
+		allSpheres.build(spheres, identity);
+
+		std::vector<RayTracer::Ray> rays = createRays(bvhRayCount, halfExtent, random);
+		size_t linearRayCount = std::clamp(linearTestBudget / count, minimumLinearRayCount, bvhRayCount);
+
+		std::vector<std::uint32_t> bvhHits(rays.size());
+		auto bvhStart = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rays.size(); i++) {
+			const RayTracer::Ray& ray = rays[i];
+			float closest = std::numeric_limits<float>::max();
+			std::uint32_t closestSphere = RayTracer::noPrimitive;
+
+			bvh.traverseLeaves(ray.origin, ray.direction, closest, [&](const RayTracer::BVHNode& leaf, float& leafClosest) {
+				std::uint32_t begin, end;
+				leafSpheres.getLeafRange(leaf.leftOrFirst, leaf.primitiveCount, begin, end);
+
+				std::uint32_t sphere = intersectSpheres(leafSpheres, begin, end, ray, leafClosest);
+				if (sphere == RayTracer::noPrimitive) {
+					return false;
+				}
+
+				closestSphere = sphere;
+				return true;
+			});
+
+			bvhHits[i] = closestSphere;
+		}
+		std::chrono::duration<double> bvhTime = std::chrono::steady_clock::now() - bvhStart;
+
+		std::vector<std::uint32_t> linearHits(linearRayCount);
+		auto linearStart = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < linearRayCount; i++) {
+			float closest = std::numeric_limits<float>::max();
+			linearHits[i] = intersectSpheres(allSpheres, 0, static_cast<std::uint32_t>(count), rays[i], closest);
+		}
+		std::chrono::duration<double> linearTime = std::chrono::steady_clock::now() - linearStart;
+
+		// Both run the same kernel on the same spheres, so any difference is a traversal bug
+		size_t mismatchCount = 0;
+		for (size_t i = 0; i < linearRayCount; i++) {
+			if (bvhHits[i] != linearHits[i]) {
+				mismatchCount++;
+			}
+		}
+
+		if (mismatchCount > 0) {
+			std::cerr << mismatchCount << " of " << linearRayCount << " rays hit a different sphere through the BVH with " << count << " spheres" << std::endl;
+			return 1;
+		}
+
+		double bvhRate = static_cast<double>(rays.size()) / bvhTime.count();
+		double linearRate = static_cast<double>(linearRayCount) / linearTime.count();
+		std::cout << count << ", " << bvhRate / 1e6 << ", " << linearRate / 1e6 << ", " << bvhRate / linearRate << std::endl;
+	}
+
+	return 0;
+}
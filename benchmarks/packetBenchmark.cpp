@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Renderer/rayPacket.h"
+#include "Renderer/sphereSoA.h"
+#include "Renderer/simd.h"
+
+// Runs the same rays through every packet kernel level and through the single ray sphere kernel the path tracer falls back to
+// Prints millions of ray-primitive tests per second, and fails if any level finds a different closest primitive than the scalar kernels
+namespace {
+	constexpr int rayCount = 4096;
+	constexpr int primitiveCount = 256;
+	constexpr int passCount = 16;
+
+	struct Triangle {
+		glm::vec3 v0, v1, v2;
+	};
+
+	// Camera like rays from one origin through a grid, so each packet of 8 neighbouring rays is coherent like a primary ray packet
+	std::vector<RayTracer::Ray> createRays() {
+		std::vector<RayTracer::Ray> rays(rayCount);
+		int side = static_cast<int>(std::sqrt(static_cast<float>(rayCount)));
+
+		for (int i = 0; i < rayCount; i++) {
+			float x = (static_cast<float>(i % side) + 0.5f) / static_cast<float>(side) * 2.0f - 1.0f;
+			float y = (static_cast<float>(i / side) + 0.5f) / static_cast<float>(side) * 2.0f - 1.0f;
+			rays[i].origin = glm::vec3(0.0f, 0.0f, -10.0f);
+			rays[i].direction = glm::normalize(glm::vec3(x * 0.5f, y * 0.5f, 1.0f));
+		}
+
+		return rays;
+	}
+
+	template<typename Function>
+	double timePasses(Function&& function) {
+		double bestTime = 0.0;
+		for (int pass = 0; pass < passCount; pass++) {
+			auto start = std::chrono::steady_clock::now();
+			function();
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			bestTime = pass == 0 ? elapsed.count() : std::min(bestTime, elapsed.count());
+		}
+		return bestTime;
+	}
+
+	void printRate(const char* name, double seconds) {
+		std::cout << name << ": " << static_cast<double>(rayCount) * primitiveCount / seconds / 1e6 << " M tests/s" << std::endl;
+	}
+}
+
+int main() {
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-3.0f, 3.0f);
+	std::uniform_real_distribution<float> radius(0.05f, 0.3f);
+	std::uniform_real_distribution<float> offset(-0.4f, 0.4f);
+
+	std::vector<RayTracer::Sphere> spheres(primitiveCount);
+	std::vector<Triangle> triangles(primitiveCount);
+	std::vector<RayTracer::BVHNode> nodes(primitiveCount);
+
+	for (int i = 0; i < primitiveCount; i++) {
+		glm::vec3 centre = glm::vec3(position(random), position(random), position(random));
+		spheres[i] = RayTracer::Sphere({ centre, radius(random), 0 });
+		triangles[i] = Triangle({ centre + glm::vec3(offset(random), offset(random), offset(random)), centre + glm::vec3(offset(random), offset(random), offset(random)),
+			centre + glm::vec3(offset(random), offset(random), offset(random)) });
+
+		glm::vec3 halfSize = glm::vec3(radius(random), radius(random), radius(random));
+		nodes[i] = RayTracer::BVHNode({ centre - halfSize, 0, centre + halfSize, 1 });
+	}
+
+	std::vector<RayTracer::Ray> rays = createRays();
+	std::vector<RayTracer::RayPacket> packets(rayCount / RayTracer::RayPacket::packetSize);
+	auto resetPackets = [&]() {
+		for (size_t i = 0; i < packets.size(); i++) {
+			packets[i].setRays(&rays[i * RayTracer::RayPacket::packetSize], RayTracer::RayPacket::packetSize);
+		}
+	};
+
+	// The single ray path, one ray at a time against every sphere with the scalar SoA kernel
+	std::vector<std::uint32_t> identity(primitiveCount);
+	std::iota(identity.begin(), identity.end(), 0u);
+	RayTracer::SphereSoA sphereSoA;
+	sphereSoA.build(spheres, identity);
+
+	std::vector<std::uint32_t> singleRayHits(rayCount);
+	auto traceSingleRays = [&](RayTracer::SphereBlockFunction intersectSpheres) {
+		for (int i = 0; i < rayCount; i++) {
+			float closest = std::numeric_limits<float>::max();
+			singleRayHits[i] = intersectSpheres(sphereSoA, 0, primitiveCount, rays[i], closest);
+		}
+	};
+
+	printRate("Single ray spheres, scalar", timePasses([&]() { traceSingleRays(RayTracer::getSphereBlockFunction(RayTracer::SIMD_SCALAR)); }));
+	std::vector<std::uint32_t> referenceHits = singleRayHits;
+
+	size_t hitCount = std::count_if(referenceHits.begin(), referenceHits.end(), [](std::uint32_t hit) { return hit != RayTracer::noPrimitive; });
+	std::cout << hitCount << " of " << rayCount << " rays hit a sphere" << std::endl;
+
+	RayTracer::SIMDLevel supportedLevel = RayTracer::detectSIMDLevel();
+	bool isMatching = true;
+
+	auto checkHits = [&](const char* name, const std::vector<std::uint32_t>& hits, const std::vector<std::uint32_t>& expectedHits) {
+		size_t mismatchCount = 0;
+		for (size_t i = 0; i < hits.size(); i++) {
+			mismatchCount += hits[i] != expectedHits[i];
+		}
+
+		if (mismatchCount > 0) {
+			std::cerr << name << ": " << mismatchCount << " of " << hits.size() << " rays found a different closest primitive" << std::endl;
+			isMatching = false;
+		}
+	};
+
+	if (supportedLevel == RayTracer::SIMD_AVX2) {
+		printRate("Single ray spheres, AVX2", timePasses([&]() { traceSingleRays(RayTracer::getSphereBlockFunction(RayTracer::SIMD_AVX2)); }));
+		checkHits("Single ray spheres, AVX2", singleRayHits, referenceHits);
+	}
+
+	std::vector<std::uint32_t> sphereHits(rayCount);
+	std::vector<std::uint32_t> triangleHits(rayCount);
+	std::vector<std::uint32_t> scalarTriangleHits;
+	std::vector<std::uint32_t> nodeEnteredCounts(packets.size());
+	std::vector<std::uint32_t> scalarNodeEnteredCounts;
+
+	for (RayTracer::SIMDLevel level : { RayTracer::SIMD_SCALAR, RayTracer::SIMD_SSE42, RayTracer::SIMD_AVX2 }) {
+		const char* levelName = RayTracer::getSIMDLevelName(level);
+		if (level > supportedLevel) {
+			std::cout << levelName << " packets: not supported by this CPU" << std::endl;
+			continue;
+		}
+
+		const RayTracer::PacketKernels& kernels = RayTracer::getPacketKernels(level);
+
+		double sphereTime = timePasses([&]() {
+			resetPackets();
+			for (RayTracer::RayPacket& packet : packets) {
+				for (std::uint32_t i = 0; i < primitiveCount; i++) {
+					kernels.intersectSphere(packet, spheres[i], i);
+				}
+			}
+		});
+
+		for (int i = 0; i < rayCount; i++) {
+			sphereHits[i] = packets[i / RayTracer::RayPacket::packetSize].primitiveId[i % RayTracer::RayPacket::packetSize];
+		}
+
+		double triangleTime = timePasses([&]() {
+			resetPackets();
+			for (RayTracer::RayPacket& packet : packets) {
+				for (std::uint32_t i = 0; i < primitiveCount; i++) {
+					kernels.intersectTriangle(packet, triangles[i].v0, triangles[i].v1, triangles[i].v2, i);
+				}
+			}
+		});
+
+		for (int i = 0; i < rayCount; i++) {
+			triangleHits[i] = packets[i / RayTracer::RayPacket::packetSize].primitiveId[i % RayTracer::RayPacket::packetSize];
+		}
+
+		// Lanes whose closest hit is still unset, so every node is tested against the whole ray
+		resetPackets();
+		double nodeTime = timePasses([&]() {
+			for (size_t packet = 0; packet < packets.size(); packet++) {
+				std::uint32_t enteredCount = 0;
+				for (const RayTracer::BVHNode& node : nodes) {
+					float entry;
+					enteredCount += std::popcount(kernels.intersectAABB(packets[packet], node, entry));
+				}
+				nodeEnteredCounts[packet] = enteredCount;
+			}
+		});
+
+		std::string name = std::string(levelName) + " packets";
+		printRate((name + " spheres").c_str(), sphereTime);
+		printRate((name + " triangles").c_str(), triangleTime);
+		printRate((name + " boxes").c_str(), nodeTime);
+
+		checkHits((name + " spheres").c_str(), sphereHits, referenceHits);
+		if (level == RayTracer::SIMD_SCALAR) {
+			scalarTriangleHits = triangleHits;
+			scalarNodeEnteredCounts = nodeEnteredCounts;
+		}
+
+		else {
+			checkHits((name + " triangles").c_str(), triangleHits, scalarTriangleHits);
+			checkHits((name + " boxes").c_str(), nodeEnteredCounts, scalarNodeEnteredCounts);
+		}
+	}
+
+	return isMatching ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Renderer/scene.h"
+#include "Renderer/pathTracer.h"
+
+// Renders the same frames with every thread count from 1 up to the hardware threads and prints the speedup over one thread
+// The default scene gets a block of small packed spheres in its top right corner, whose pixels cost about five times as much as the background around it
+// Each worker starts on its own contiguous run of tiles, so the block lands on a few workers and the rest only keep up by stealing
+// Usage: scalingBenchmark [largest thread count]
+namespace {
+	constexpr int width = 640;
+	constexpr int height = 360;
+	constexpr int frameCount = 4;
+	constexpr int runCount = 3;
+	constexpr int bounceLimit = 12;
+
+	constexpr int blockColumns = 10;
+	constexpr int blockRows = 5;
+	constexpr int blockLayers = 6;
+	constexpr float blockRadius = 0.1f;
+
+	// Packed so tightly that paths entering the block bounce between its spheres, and every shadow ray crosses several of them
+	void addSphereBlock(RayTracer::Scene& scene) {
+		std::uint32_t material = static_cast<std::uint32_t>(scene.m_materials.size());
+		scene.m_materials.push_back(RayTracer::Material({ 0.9f, 0.9f, 0.9f }));
+
+		glm::vec3 corner = glm::vec3(2.3f, 1.5f, -4.0f);
+		for (int y = 0; y < blockRows; y++) {
+			for (int x = 0; x < blockColumns; x++) {
+				for (int z = 0; z < blockLayers; z++) {
+					glm::vec3 centre = corner + glm::vec3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) * (2.05f * blockRadius);
+					scene.m_spheres.push_back(RayTracer::Sphere({ centre, blockRadius, material }));
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	int largestThreadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	if (argc > 1) {
+		largestThreadCount = std::atoi(argv[1]);
+	}
+
+	if (largestThreadCount < 1) {
+		std::cerr << "Usage: scalingBenchmark [largest thread count]" << std::endl;
+		return 1;
+	}
+
+	RayTracer::Scene scene;
+	if (!scene.loadDefault()) {
+		return 1;
+	}
+
+	addSphereBlock(scene);
+	scene.updateAccelerationStructure();
+
+	RayTracer::PathTracer pathTracer;
+	pathTracer.init();
+
+	std::vector<glm::vec4> frameBuffer(static_cast<size_t>(width) * height);
+
+	std::cout << "Threads, seconds per frame, speedup, efficiency" << std::endl;
+
+	double singleThreadTime = 0.0;
+	for (int threadCount = 1; threadCount <= largestThreadCount; threadCount++) {
+		pathTracer.m_threadCount = threadCount;
+
+		// Starts the workers and touches every buffer before timing
+		pathTracer.render(scene, frameBuffer, width, height, bounceLimit, RayTracer::SAMPLING_NEXT_EVENT, false, 0.0f);
+
+		// Keeps the fastest of a few runs, so other work on the machine does not read as poor scaling
+		double frameTime = 0.0;
+		for (int run = 0; run < runCount; run++) {
+			auto renderStart = std::chrono::steady_clock::now();
+			for (int frame = 0; frame < frameCount; frame++) {
+				pathTracer.render(scene, frameBuffer, width, height, bounceLimit, RayTracer::SAMPLING_NEXT_EVENT, false, 0.0f);
+			}
+			std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - renderStart;
+
+			double runFrameTime = renderTime.count() / frameCount;
+			frameTime = run == 0 ? runFrameTime : std::min(frameTime, runFrameTime);
+		}
+
+		if (threadCount == 1) {
+			singleThreadTime = frameTime;
+		}
+
+		double speedup = singleThreadTime / frameTime;
+		std::cout << threadCount << ", " << frameTime << ", " << speedup << ", " << speedup / threadCount << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "Renderer/objLoader.h"
+#include "Renderer/scene.h"
+#include "Renderer/sceneCache.h"
+#include "Renderer/mappedFile.h"
+
+// Writes a synthetic OBJ of the requested size and times how long loadOBJ takes to parse it
+// Then times Scene::loadOBJ building and writing the scene cache, reading it back, and how much of that read is copying the arrays
+// Usage: sceneLoadBenchmark [triangle count] [directory], 10 million triangles in the temporary directory by default
+namespace {
+	constexpr size_t defaultTriangleCount = 10'000'000;
+
+	// A gently rolling height field with one normal per vertex, split into two triangles per grid cell
+	// Every face line is f v//vn v//vn v//vn, the form exporters write for smooth meshes
+	bool writeGrid(const std::filesystem::path& path, size_t side) {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+
+		std::vector<char> buffer;
+		buffer.reserve(1 << 20);
+
+		auto flush = [&]() {
+			file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			buffer.clear();
+		};
+
+		auto append = [&](const char* text) {
+			buffer.insert(buffer.end(), text, text + std::char_traits<char>::length(text));
+		};
+
+		auto appendNumber = [&](auto value) {
+			char digits[32];
+			std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+			buffer.insert(buffer.end(), digits, result.ptr);
+		};
+
+		auto getHeight = [](float x, float z) {
+			return 0.1f * std::sin(x * 0.37f) * std::cos(z * 0.23f);
+		};
+
+		float scale = 10.0f / static_cast<float>(side);
+		for (size_t z = 0; z < side; z++) {
+			for (size_t x = 0; x < side; x++) {
+				float worldX = static_cast<float>(x) * scale;
+				float worldZ = static_cast<float>(z) * scale;
+
+				append("v ");
+				appendNumber(worldX);
+				append(" ");
+				appendNumber(getHeight(static_cast<float>(x), static_cast<float>(z)));
+				append(" ");
+				appendNumber(worldZ);
+				append("\n");
+			}
+
+			if (buffer.size() > (1 << 20) - 4096) {
+				flush();
+			}
+		}
+
+		for (size_t z = 0; z < side; z++) {
+			for (size_t x = 0; x < side; x++) {
+				float slopeX = 0.037f * std::cos(static_cast<float>(x) * 0.37f) * std::cos(static_cast<float>(z) * 0.23f);
+				float slopeZ = -0.023f * std::sin(static_cast<float>(x) * 0.37f) * std::sin(static_cast<float>(z) * 0.23f);
+
+				append("vn ");
+				appendNumber(-slopeX);
+				append(" 1 ");
+				appendNumber(-slopeZ);
+				append("\n");
+
+				if (buffer.size() > (1 << 20) - 4096) {
+					flush();
+				}
+			}
+		}
+
+		auto appendCorner = [&](size_t index) {
+			append(" ");
+			appendNumber(index + 1);
+			append("//");
+			appendNumber(index + 1);
+		};
+
+		for (size_t z = 0; z + 1 < side; z++) {
+			for (size_t x = 0; x + 1 < side; x++) {
+				size_t corner = z * side + x;
+
+				append("f");
+				appendCorner(corner);
+				appendCorner(corner + side);
+				appendCorner(corner + 1);
+				append("\nf");
+				appendCorner(corner + 1);
+				appendCorner(corner + side);
+				appendCorner(corner + side + 1);
+				append("\n");
+
+				if (buffer.size() > (1 << 20) - 4096) {
+					flush();
+				}
+			}
+		}
+
+		flush();
+		return static_cast<bool>(file);
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t triangleCount = defaultTriangleCount;
+	std::filesystem::path directory = std::filesystem::temp_directory_path();
+
+	if (argc > 1) {
+		triangleCount = std::strtoull(argv[1], nullptr, 10);
+	}
+
+	if (argc > 2) {
+		directory = argv[2];
+	}
+
+	if (triangleCount < 2) {
+		std::cerr << "Usage: sceneLoadBenchmark [triangle count] [directory]" << std::endl;
+		return 1;
+	}
+
+	// Two triangles per grid cell, rounded up to a whole square grid
+	size_t cellsPerSide = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(triangleCount) / 2.0)));
+	size_t side = cellsPerSide + 1;
+	std::filesystem::path path = directory / "sceneLoadBenchmark.obj";
+
+	std::cout << "Writing " << 2 * cellsPerSide * cellsPerSide << " triangles to " << path.string() << std::endl;
+	if (!writeGrid(path, side)) {
+		std::cerr << "Failed to write " << path.string() << std::endl;
+		return 1;
+	}
+
+	double fileMiB = static_cast<double>(std::filesystem::file_size(path)) / (1024.0 * 1024.0);
+
+	// The file was just written, so it is already in the page cache and each count keeps its fastest of a few runs
+	constexpr int runCount = 3;
+	unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> threadCounts = { hardwareThreads };
+	if (hardwareThreads > 1) {
+		threadCounts.push_back(1);
+	}
+
+	for (unsigned threadCount : threadCounts) {
+		double bestTime = 0.0;
+		size_t loadedTriangleCount = 0;
+
+		for (int run = 0; run < runCount; run++) {
+			std::vector<glm::vec3> vertices;
+			std::vector<glm::vec3> normals;
+			std::vector<RayTracer::Triangle> triangles;
+			std::vector<RayTracer::Material> materials;
+
+			auto loadStart = std::chrono::steady_clock::now();
+			if (!RayTracer::loadOBJ(path, vertices, normals, triangles, materials, threadCount)) {
+				std::filesystem::remove(path);
+				return 1;
+			}
+			std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - loadStart;
+
+			bestTime = run == 0 ? loadTime.count() : std::min(bestTime, loadTime.count());
+			loadedTriangleCount = triangles.size();
+		}
+
+		std::cout << "Parse with " << threadCount << (threadCount == 1 ? " thread: " : " threads: ") << bestTime << " s, "
+			<< loadedTriangleCount / bestTime / 1e6 << " M triangles/s, " << fileMiB / bestTime << " MiB/s of " << fileMiB << " MiB" << std::endl;
+	}
+
+	// Every load goes into an empty scene, so they all share one cache
+	std::filesystem::path cacheDirectory = directory / "sceneLoadBenchmarkCache";
+	auto loadScene = [&](RayTracer::Scene& scene) {
+		scene.m_cacheDirectory = cacheDirectory;
+		auto loadStart = std::chrono::steady_clock::now();
+		bool isLoaded = scene.loadOBJ(path);
+		std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - loadStart;
+		return isLoaded ? loadTime.count() : -1.0;
+	};
+
+	double buildTime;
+	{
+		RayTracer::Scene scene;
+		buildTime = loadScene(scene);
+		if (buildTime < 0.0 || scene.isBVHFromCache()) {
+			std::cerr << "Failed to build the scene cache" << std::endl;
+			return 1;
+		}
+	}
+
+	double cacheTime = 0.0;
+	for (int run = 0; run < runCount; run++) {
+		RayTracer::Scene scene;
+		double loadTime = loadScene(scene);
+		if (loadTime < 0.0 || !scene.isBVHFromCache()) {
+			std::cerr << "Failed to read the scene cache" << std::endl;
+			return 1;
+		}
+		cacheTime = run == 0 ? loadTime : std::min(cacheTime, loadTime);
+	}
+
+	// readSceneCache copies each array out of the mapping into the scene's vectors
+	// Copying the whole file the same way bounds what serving the arrays from the mapping would save
+	std::filesystem::path cachePath = RayTracer::getSceneCachePath(cacheDirectory, path);
+	double cacheMiB = static_cast<double>(std::filesystem::file_size(cachePath)) / (1024.0 * 1024.0);
+	double copyTime = 0.0;
+	for (int run = 0; run < runCount; run++) {
+		RayTracer::MappedFile file;
+		if (!file.open(cachePath)) {
+			std::cerr << "Failed to map " << cachePath.string() << std::endl;
+			return 1;
+		}
+
+		auto copyStart = std::chrono::steady_clock::now();
+		std::vector<char> copy(file.getData(), file.getData() + file.getSize());
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - copyStart;
+		copyTime = run == 0 ? elapsed.count() : std::min(copyTime, elapsed.count());
+	}
+
+	std::cout << "Parse, build the BVH and write the cache: " << buildTime << " s" << std::endl;
+	std::cout << "Load from the cache: " << cacheTime << " s, of which copying the " << cacheMiB << " MiB cache out of the mapping takes at most " << copyTime << " s" << std::endl;
+
+	std::error_code error;
+	std::filesystem::remove(path, error);
+	std::filesystem::remove_all(cacheDirectory, error);
+	return 0;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <span>
+#include <vector>
+
+#include "Renderer/renderer.h"
+#include "Renderer/gpuTimer.h"
+
+// Streams CPU frames into a texture at 1080p and 4K, once with a synchronous glTexSubImage2D from client memory and once through the Renderer's pixel buffer ring
+// Prints the CPU time spent in the upload calls, the GPU time of the copy from timer queries, and the time per frame including writing the pixels
+namespace {
+	constexpr int frameCount = 60;
+	constexpr int warmUpFrameCount = 5;
+	constexpr int timerQueryCount = 8;
+
+	struct Resolution {
+		const char* name;
+		int width, height;
+	};
+
+	struct UploadTimes {
+		double uploadCpuSeconds = 0.0;
+		double uploadGpuSeconds = 0.0;
+		int gpuSampleCount = 0;
+		double frameSeconds = 0.0;
+	};
+
+	// Stands in for the path tracer, every pixel changes every frame
+	void writePixels(std::span<glm::vec4> pixels, int frame) {
+		float value = static_cast<float>(frame % 256) / 255.0f;
+		for (size_t i = 0; i < pixels.size(); i++) {
+			pixels[i] = glm::vec4(value, static_cast<float>(i & 0xff) / 255.0f, 0.5f, 1.0f);
+		}
+	}
+
+	double getSeconds(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// upload(frame) writes and uploads one frame, returning the CPU seconds spent in GL calls
+	template<typename UploadFunction>
+	UploadTimes timeUploads(UploadFunction&& upload) {
+		RayTracer::GpuTimer gpuTimer;
+		gpuTimer.init(timerQueryCount);
+
+		UploadTimes times;
+		auto framesStart = std::chrono::steady_clock::now();
+
+		for (int frame = 0; frame < warmUpFrameCount + frameCount; frame++) {
+			if (frame == warmUpFrameCount) {
+				glFinish();
+				framesStart = std::chrono::steady_clock::now();
+			}
+
+			bool isTimed = frame >= warmUpFrameCount && gpuTimer.begin();
+			double uploadSeconds = upload(frame);
+			if (isTimed) {
+				gpuTimer.end(1.0);
+			}
+
+			// Stands in for the buffer swap, which hands the frame's commands to the driver
+			glFlush();
+
+			if (frame >= warmUpFrameCount) {
+				times.uploadCpuSeconds += uploadSeconds;
+			}
+
+			double seconds, work;
+			if (gpuTimer.getLatest(seconds, work)) {
+				times.uploadGpuSeconds += seconds;
+				times.gpuSampleCount++;
+			}
+		}
+
+		glFinish();
+		times.frameSeconds = getSeconds(framesStart) / frameCount;
+		times.uploadCpuSeconds /= frameCount;
+
+		double seconds, work;
+		if (gpuTimer.getLatest(seconds, work)) {
+			times.uploadGpuSeconds += seconds;
+			times.gpuSampleCount++;
+		}
+		times.uploadGpuSeconds /= std::max(times.gpuSampleCount, 1);
+
+		return times;
+	}
+
+	void printTimes(const char* name, const UploadTimes& times) {
+		std::cout << "  " << name << ": upload " << times.uploadCpuSeconds * 1000.0 << " ms CPU, " << times.uploadGpuSeconds * 1000.0 << " ms GPU, "
+			<< times.frameSeconds * 1000.0 << " ms per frame" << std::endl;
+	}
+}
+
+int main() {
+	if (!glfwInit()) {
+		std::cerr << "Could not initialise GLFW" << std::endl;
+		return 1;
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(64, 64, "Upload Benchmark", NULL, NULL);
+	if (window == nullptr) {
+		std::cerr << "Could not create an OpenGL 4.5 context" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGL(glfwGetProcAddress)) {
+		std::cerr << "Failed to initialize GLAD" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+
+	std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+	const Resolution resolutions[] = {
+		{ "1920x1080", 1920, 1080 },
+		{ "3840x2160", 3840, 2160 }
+	};
+
+	for (const Resolution& resolution : resolutions) {
+		std::cout << resolution.name << ":" << std::endl;
+
+		{
+			// What Renderer::render did before the pixel buffers, the driver copies the client memory before glTexSubImage2D returns
+			GLuint texture;
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, resolution.width, resolution.height);
+
+			std::vector<glm::vec4> frameBuffer(static_cast<size_t>(resolution.width) * resolution.height);
+			UploadTimes times = timeUploads([&](int frame) {
+				writePixels(frameBuffer, frame);
+
+				auto uploadStart = std::chrono::steady_clock::now();
+				glBindTexture(GL_TEXTURE_2D, texture);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, resolution.width, resolution.height, GL_RGBA, GL_FLOAT, frameBuffer.data());
+				return getSeconds(uploadStart);
+			});
+			printTimes("glTexSubImage2D", times);
+
+			glDeleteTextures(1, &texture);
+		}
+
+		{
+			RayTracer::Renderer renderer;
+			renderer.init(window);
+			renderer.setWidthAndHeight(resolution.width, resolution.height);
+
+			// getFrameBuffer waits on the fence of the buffer's last upload, so it counts as upload time
+			UploadTimes times = timeUploads([&](int frame) {
+				auto waitStart = std::chrono::steady_clock::now();
+				std::span<glm::vec4> frameBuffer = renderer.getFrameBuffer();
+				double waitSeconds = getSeconds(waitStart);
+
+				writePixels(frameBuffer, frame);
+
+				auto uploadStart = std::chrono::steady_clock::now();
+				renderer.render();
+				return waitSeconds + getSeconds(uploadStart);
+			});
+			printTimes("Pixel buffer ring", times);
+
+			// Frees the ring and texture before the next resolution
+			renderer.setWidthAndHeight(1, 1);
+		}
+	}
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
@@ -4,7 +4,10 @@
 #include <iostream>
 
 #include "application.h"
+#include "../Renderer/profiler.h"
 #include <cstdlib>
+#include <algorithm>
+#include <cfloat>
 
 namespace RayTracer {
 	Application::Application() {
@@ -25,36 +28,151 @@ namespace RayTracer {
 
 	void Application::run() {
 		while (!glfwWindowShouldClose(m_window)) {
+			ProfileZone frameZone("Frame");
 			glfwPollEvents();
 
-			UI::createImGuiFrame();
-			UI::createImGuiWindows(&m_renderer);
-			UI::createImGuiPropertiesPanel(m_rayTracer);
+			{
+				ProfileZone zone("UI Build");
+				UI::createImGuiFrame();
+				UI::createImGuiWindows(&m_renderer);
+				UI::createImGuiPropertiesPanel(m_rayTracer);
+			}
 
-			float timeStart = glfwGetTime();
-#if 1
-			m_rayTracer.run(m_bounces, &m_renderer);
-#else
-			m_renderer.render(m_rayTracer.run(m_bounces, &m_renderer));
-#endif
+			// A dragged or edited widget stays active across frames, including the Stats window built after this
+			m_rayTracer.m_isInteracting = ImGui::IsAnyItemActive();
+
+			FrameProfiler& profiler = m_rayTracer.m_profiler;
+			profiler.beginFrame();
 
-			float timeEnd = glfwGetTime();
+			m_rayTracer.run(m_bounces, &m_renderer);
 
-			float elapsedTime = timeEnd - timeStart;
+			// The compute shader writes straight into the texture, the CPU path fills the renderer's framebuffer
+			if (!m_rayTracer.m_useComputeShader) {
+				ProfileZone zone("Texture Upload");
+				profiler.beginStage(STAGE_TEXTURE_UPLOAD);
+				m_renderer.render();
+				profiler.endStage(STAGE_TEXTURE_UPLOAD);
+			}
 
+			// The CPU frame runs from one frame's start to the next, the GPU frame adds up the stages' timer queries from a few frames ago
 			ImGui::Begin("Stats");
-			ImGui::Text("Frame Time: %.3f ms", elapsedTime * 1000);
-			ImGui::Text("FPS: %.f", 1 / elapsedTime);
+			float cpuFrameTime = profiler.getCpuFrameTime();
+			ImGui::Text("Frame Time: %.3f ms (CPU) %.3f ms (GPU)", cpuFrameTime, profiler.getGpuFrameTime());
+			ImGui::Text("FPS: %.f", cpuFrameTime > 0.0f ? 1000.0f / cpuFrameTime : 0.0f);
+			ImGui::PlotLines("CPU Frame (ms)", profiler.getCpuFrameHistory(), FrameProfiler::historySize, profiler.getHistoryOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+			ImGui::PlotLines("GPU Frame (ms)", profiler.getGpuFrameHistory(), FrameProfiler::historySize, profiler.getHistoryOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+
+			if (ImGui::TreeNode("Stages")) {
+				for (int stage = 0; stage < STAGE_COUNT; stage++) {
+					FrameStage frameStage = static_cast<FrameStage>(stage);
+					ImGui::PushID(stage);
+					ImGui::Text("%s: %.3f ms (CPU) %.3f ms (GPU)", FrameProfiler::getStageName(frameStage), profiler.getCpuTime(frameStage), profiler.getGpuTime(frameStage));
+					ImGui::PlotHistogram("CPU (ms)", profiler.getCpuHistory(frameStage), FrameProfiler::historySize, profiler.getHistoryOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 30.0f));
+					ImGui::PlotHistogram("GPU (ms)", profiler.getGpuHistory(frameStage), FrameProfiler::historySize, profiler.getHistoryOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 30.0f));
+					ImGui::PopID();
+				}
+				ImGui::TreePop();
+			}
+
+			// Records CPU zones on every thread until stopped, then writes them for chrome://tracing or Perfetto
+			Profiler& cpuProfiler = Profiler::get();
+			if (!cpuProfiler.isRecording()) {
+				if (ImGui::Button("Record Trace")) {
+					cpuProfiler.start();
+				}
+			}
+
+			else if (ImGui::Button("Save Trace")) {
+				if (!cpuProfiler.writeChromeTrace("trace.json")) {
+					std::cerr << "Failed to write trace.json" << std::endl;
+				}
+			}
+			ImGui::SameLine();
+			ImGui::Text("Dropped Zones: %zu", cpuProfiler.getDroppedZoneCount());
 
 			ImGui::Separator();
 
 			ImGui::Checkbox("Accumulate", &m_rayTracer.m_accumilate);
+			ImGui::Checkbox("Compute Shader", &m_rayTracer.m_useComputeShader);
 			ImGui::Text("Frames: %.i", m_rayTracer.m_frames);
 			ImGui::InputInt("Bounces", &m_bounces);
 
+			const char* samplingModes[] = { "Uniform", "Cosine + Roulette", "Light Sampling + MIS" };
+			int samplingMode = m_rayTracer.m_samplingMode;
+			if (ImGui::Combo("Sampling", &samplingMode, samplingModes, 3)) {
+				m_rayTracer.m_samplingMode = static_cast<SamplingMode>(samplingMode);
+			}
+
+			// Shared by the CPU path tracer and the compute shader
+			const char* samplerTypes[] = { "Random", "Sobol", "Blue Noise" };
+			int samplerType = m_rayTracer.m_pathTracer.m_samplerType;
+			if (ImGui::Combo("Sampler", &samplerType, samplerTypes, 3)) {
+				m_rayTracer.m_pathTracer.m_samplerType = static_cast<SamplerType>(samplerType);
+			}
+
+			// Only takes effect while accumulating, 0 samples every pixel every frame
+			if (ImGui::InputFloat("Adaptive Threshold", &m_rayTracer.m_adaptiveThreshold, 0.005f, 0.05f, "%.3f")) {
+				m_rayTracer.m_adaptiveThreshold = std::max(0.0f, m_rayTracer.m_adaptiveThreshold);
+			}
+			ImGui::Text("Active Pixels: %.1f%%", m_rayTracer.m_activePixelFraction * 100.0f);
+
+			// The denoiser runs on the CPU path tracer's output only
+			ImGui::Checkbox("Denoise", &m_rayTracer.m_denoise);
+			ImGui::SliderInt("Denoise Passes", &m_rayTracer.m_pathTracer.m_denoiser.m_iterations, 1, Denoiser::maxIterations);
+
+			ImGui::Separator();
+
+			// Moving the camera while accumulating reprojects the CPU path tracer's samples, the compute shader starts again
+			Camera& camera = m_rayTracer.m_scene.m_camera;
+			ImGui::DragFloat3("Camera Location", &camera.location.x, 0.05f);
+			ImGui::DragFloat("Yaw", &camera.yaw, 0.25f);
+			ImGui::DragFloat("Pitch", &camera.pitch, 0.25f, -89.0f, 89.0f);
+			ImGui::SliderFloat("FOV", &camera.fov, 10.0f, 120.0f);
+			ImGui::Checkbox("Reproject", &m_rayTracer.m_pathTracer.m_useReprojection);
+			ImGui::Text("Reprojected Pixels: %.1f%%", m_rayTracer.m_pathTracer.getReprojectedPixelFraction() * 100.0f);
+
+			// While a value is dragged the resolution drops until a frame fits the budget, then refines once input stops
+			ImGui::Checkbox("Progressive Preview", &m_rayTracer.m_useProgressivePreview);
+			if (ImGui::InputFloat("Preview Budget (ms)", &m_rayTracer.m_previewBudget, 1.0f, 5.0f, "%.1f")) {
+				m_rayTracer.m_previewBudget = std::max(1.0f, m_rayTracer.m_previewBudget);
+			}
+			ImGui::Text("Resolution: 1/%d", 1 << m_rayTracer.m_previewLevel);
+
+			// The compute shader only issues the tiles that fit the budget, the rest follow in later frames
+			if (ImGui::InputFloat("Dispatch Budget (ms)", &m_rayTracer.m_dispatchBudget, 1.0f, 5.0f, "%.1f")) {
+				m_rayTracer.m_dispatchBudget = std::max(1.0f, m_rayTracer.m_dispatchBudget);
+			}
+			if (ImGui::InputInt("Dispatch Tile Size", &m_rayTracer.m_dispatchTileSize, 16, 64)) {
+				m_rayTracer.m_dispatchTileSize = std::max(16, m_rayTracer.m_dispatchTileSize);
+			}
+			ImGui::Text("Tiles: %d / %d", m_rayTracer.m_dispatchedTileCount, m_rayTracer.m_tileCount);
+
+			ImGui::Separator();
+
+			if (ImGui::InputInt("Threads", &m_rayTracer.m_pathTracer.m_threadCount)) {
+				m_rayTracer.m_pathTracer.m_threadCount = std::max(1, m_rayTracer.m_pathTracer.m_threadCount);
+			}
+			if (ImGui::InputInt("Tile Size", &m_rayTracer.m_pathTracer.m_tileSize)) {
+				m_rayTracer.m_pathTracer.m_tileSize = std::max(1, m_rayTracer.m_pathTracer.m_tileSize);
+			}
+
+			ImGui::Checkbox("Packet Tracing", &m_rayTracer.m_pathTracer.m_usePacketTracing);
+
+			// Only offer the instruction sets this CPU supports
+			const char* simdLevels[] = { getSIMDLevelName(SIMD_SCALAR), getSIMDLevelName(SIMD_SSE42), getSIMDLevelName(SIMD_AVX2) };
+			int simdLevel = m_rayTracer.m_pathTracer.m_simdLevel;
+			if (ImGui::Combo("SIMD", &simdLevel, simdLevels, detectSIMDLevel() + 1)) {
+				m_rayTracer.m_pathTracer.m_simdLevel = static_cast<SIMDLevel>(simdLevel);
+			}
+
 			ImGui::End();
 
-			UI::renderImGui();
+			{
+				ProfileZone zone("UI Draw");
+				profiler.beginStage(STAGE_UI);
+				UI::renderImGui();
+				profiler.endStage(STAGE_UI);
+			}
 			glfwSwapBuffers(m_window);
 		}
 	}
@@ -48,39 +48,91 @@ namespace RayTracer::UI {
     void createImGuiPropertiesPanel(RayTracer& rayTracer)
     {
         if (ImGui::Begin("Properties")) {
-            for (Sphere& sphere : rayTracer.m_spheres) {
+            Scene& scene = rayTracer.m_scene;
+            int lastMaterial = static_cast<int>(scene.m_materials.size()) - 1;
+
+            for (size_t i = 0; i < scene.m_spheres.size(); i++) {
+                Sphere& sphere = scene.m_spheres[i];
                 ImGui::PushID(&sphere);
 
-                ImGui::DragFloat3("Centre", glm::value_ptr(sphere.centre), 0.1f);
-                ImGui::DragFloat("Radius", &sphere.radius, 0.1f);
-                ImGui::ColorEdit3("Sphere Colour", glm::value_ptr(sphere.material.materialColour));
+                bool isChanged = false;
+                isChanged |= ImGui::DragFloat3("Centre", glm::value_ptr(sphere.centre), 0.1f);
+                isChanged |= ImGui::DragFloat("Radius", &sphere.radius, 0.1f);
+
+                int materialIndex = static_cast<int>(sphere.materialIndex);
+                if (ImGui::SliderInt("Material", &materialIndex, 0, lastMaterial)) {
+                    sphere.materialIndex = static_cast<std::uint32_t>(materialIndex);
+                    isChanged = true;
+                }
 
-                ImGui::DragFloat("Reflectivness", &sphere.material.reflectivness, 0.01f, 0.0f, 1.0f);
-                ImGui::DragFloat("Emission Strength", &sphere.material.emissiveStrength, 0.1f, 0.0f);
-                ImGui::ColorEdit3("Emission Colour", glm::value_ptr(sphere.material.emissionColour));
+                if (isChanged) {
+                    scene.markSphereDirty(i);
+                }
 
                 ImGui::PopID();
                 ImGui::Separator();
             }
 
-            for (Triangle& triangle : rayTracer.m_triangles) {
+            for (size_t i = 0; i < scene.m_triangles.size(); i++) {
+				Triangle& triangle = scene.m_triangles[i];
 				ImGui::PushID(&triangle);
 
-				ImGui::DragFloat3("Point 1", glm::value_ptr(triangle.v0), 0.1f);
-				ImGui::DragFloat3("Point 2", glm::value_ptr(triangle.v1), 0.1f);
-				ImGui::DragFloat3("Point 3", glm::value_ptr(triangle.v2), 0.1f);
-				ImGui::DragFloat3("Normal", glm::value_ptr(triangle.normal), 0.1f);
-				ImGui::ColorEdit3("Colour", glm::value_ptr(triangle.material.materialColour));
-
-				ImGui::DragFloat("Reflectivness", &triangle.material.reflectivness, 0.01f, 0.0f, 1.0f);
-				ImGui::DragFloat("Emission Strength", &triangle.material.emissiveStrength, 0.1f, 0.0f);
-				ImGui::ColorEdit3("Emission Colour", glm::value_ptr(triangle.material.emissionColour));
+				// Corners are shared with neighbouring triangles, so moving one moves them all
+				const char* pointLabels[] = { "Point 1", "Point 2", "Point 3" };
+				for (int corner = 0; corner < 3; corner++) {
+					std::uint32_t vertex = triangle.vertexIndices[corner];
+					if (ImGui::DragFloat3(pointLabels[corner], glm::value_ptr(scene.m_vertices[vertex]), 0.1f)) {
+						scene.markVertexDirty(vertex);
+					}
+				}
+
+				// Normals are shared the same way, a flat shaded triangle has none to edit
+				if (triangle.normalIndices[0] != noNormal) {
+					const char* normalLabels[] = { "Normal 1", "Normal 2", "Normal 3" };
+					for (int corner = 0; corner < 3; corner++) {
+						std::uint32_t normal = triangle.normalIndices[corner];
+						if (ImGui::DragFloat3(normalLabels[corner], glm::value_ptr(scene.m_normals[normal]), 0.1f)) {
+							scene.markNormalDirty(normal);
+						}
+					}
+				}
+
+				bool isChanged = false;
+
+				int materialIndex = static_cast<int>(triangle.materialIndex);
+				if (ImGui::SliderInt("Material", &materialIndex, 0, lastMaterial)) {
+					triangle.materialIndex = static_cast<std::uint32_t>(materialIndex);
+					isChanged = true;
+				}
+
+				if (isChanged) {
+					scene.markTriangleDirty(i);
+				}
 
 				ImGui::PopID();
 				ImGui::Separator();
 			}
 
-            ImGui::ColorEdit3("Background Colour", glm::value_ptr(rayTracer.m_background));
+            for (size_t i = 0; i < scene.m_materials.size(); i++) {
+                Material& material = scene.m_materials[i];
+                ImGui::PushID(&material);
+                ImGui::Text("Material %zu", i);
+
+                bool isChanged = false;
+                isChanged |= ImGui::ColorEdit3("Colour", glm::value_ptr(material.materialColour));
+                isChanged |= ImGui::DragFloat("Reflectivness", &material.reflectivness, 0.01f, 0.0f, 1.0f);
+                isChanged |= ImGui::DragFloat("Emission Strength", &material.emissiveStrength, 0.1f, 0.0f);
+                isChanged |= ImGui::ColorEdit3("Emission Colour", glm::value_ptr(material.emissionColour));
+
+                if (isChanged) {
+                    scene.markMaterialDirty(i);
+                }
+
+                ImGui::PopID();
+                ImGui::Separator();
+            }
+
+            ImGui::ColorEdit3("Background Colour", glm::value_ptr(scene.m_background));
             ImGui::End();
         }
     }
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <numeric>
+#include <algorithm>
+
+#include "bvh.h"
+
+namespace RayTracer {
+	namespace {
+		constexpr int binCount = 16;
+
+		struct Bin {
+			AABB bounds;
+			int primitiveCount = 0;
+		};
+	}
+
+	void AABB::grow(const glm::vec3& point) {
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void AABB::grow(const AABB& box) {
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	float AABB::surfaceArea() const {
+		glm::vec3 extent = max - min;
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+
+	glm::vec3 AABB::centroid() const {
+		return 0.5f * (min + max);
+	}
+
+	BVH::BVH() {
+	}
+
+	void BVH::build(const std::vector<AABB>& primitiveBounds) {
+		m_nodes.clear();
+		m_primitiveIndices.resize(primitiveBounds.size());
+		std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
+
+		if (primitiveBounds.empty()) {
+			return;
+		}
+
+		// Kept as a member so rebuilding a scene of the same size does not allocate
+		m_centroids.resize(primitiveBounds.size());
+		for (size_t i = 0; i < primitiveBounds.size(); i++) {
+			m_centroids[i] = primitiveBounds[i].centroid();
+		}
+
+		m_nodes.reserve(2 * primitiveBounds.size() - 1);
+
+		BVHNode root;
+		root.leftOrFirst = 0;
+		root.primitiveCount = static_cast<std::int32_t>(primitiveBounds.size());
+		updateNodeBounds(root, primitiveBounds);
+		m_nodes.push_back(root);
+
+		subdivide(0, 1, primitiveBounds, m_centroids);
+	}
+
+	void BVH::refit(const std::vector<AABB>& primitiveBounds) {
+		// Children are always stored after their parent, so walking backwards visits them first
+		for (size_t i = m_nodes.size(); i-- > 0;) {
+			BVHNode& node = m_nodes[i];
+
+			if (node.isLeaf()) {
+				updateNodeBounds(node, primitiveBounds);
+				continue;
+			}
+
+			const BVHNode& leftChild = m_nodes[node.leftOrFirst];
+			const BVHNode& rightChild = m_nodes[node.leftOrFirst + 1];
+			node.boundsMin = glm::min(leftChild.boundsMin, rightChild.boundsMin);
+			node.boundsMax = glm::max(leftChild.boundsMax, rightChild.boundsMax);
+		}
+	}
+
+	bool BVH::assign(const BVHNode* nodes, size_t nodeCount, const std::uint32_t* primitiveIndices, size_t primitiveCount) {
+		m_nodes.assign(nodes, nodes + nodeCount);
+		m_primitiveIndices.assign(primitiveIndices, primitiveIndices + primitiveCount);
+
+		// Children always come after their parent, which also rules out cycles, and the depth has to fit the traversal stack
+		std::vector<int> depths(nodeCount, 1);
+		for (size_t i = 0; i < nodeCount; i++) {
+			const BVHNode& node = m_nodes[i];
+			bool isValid = depths[i] <= maxDepth;
+
+			if (node.isLeaf()) {
+				isValid &= node.leftOrFirst >= 0 && static_cast<size_t>(node.leftOrFirst) + node.primitiveCount <= primitiveCount;
+			}
+
+			else {
+				isValid &= node.primitiveCount == 0 && static_cast<size_t>(node.leftOrFirst) > i && static_cast<size_t>(node.leftOrFirst) + 1 < nodeCount;
+				if (isValid) {
+					depths[node.leftOrFirst] = depths[i] + 1;
+					depths[node.leftOrFirst + 1] = depths[i] + 1;
+				}
+			}
+
+			if (!isValid) {
+				m_nodes.clear();
+				m_primitiveIndices.clear();
+				return false;
+			}
+		}
+
+		for (std::uint32_t primitive : m_primitiveIndices) {
+			if (primitive >= primitiveCount) {
+				m_nodes.clear();
+				m_primitiveIndices.clear();
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void BVH::subdivide(std::uint32_t nodeIndex, int depth, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids) {
+		BVHNode node = m_nodes[nodeIndex];
+
+		if (node.primitiveCount <= 1 || depth >= maxDepth) {
+			return;
+		}
+
+		int axis;
+		float splitPosition;
+		float splitCost = findBestSplit(node, primitiveBounds, centroids, axis, splitPosition);
+
+		AABB nodeBounds{ node.boundsMin, node.boundsMax };
+		float leafCost = node.primitiveCount * nodeBounds.surfaceArea();
+
+		if (splitCost >= leafCost && node.primitiveCount <= maxLeafSize) {
+			return;
+		}
+
+		// Partition the primitive indices in place around the split plane
+		int first = node.leftOrFirst;
+		int i = first;
+		int j = first + node.primitiveCount - 1;
+
+		if (splitCost != std::numeric_limits<float>::max()) {
+			while (i <= j) {
+				if (centroids[m_primitiveIndices[i]][axis] < splitPosition) {
+					i++;
+				}
+				else {
+					std::swap(m_primitiveIndices[i], m_primitiveIndices[j--]);
+				}
+			}
+		}
+
+		int leftCount = i - first;
+
+		// Every centroid landed on one side (e.g. coincident centroids), fall back to splitting the list in half
+		if (leftCount == 0 || leftCount == node.primitiveCount) {
+			leftCount = node.primitiveCount / 2;
+		}
+
+		std::uint32_t leftIndex = static_cast<std::uint32_t>(m_nodes.size());
+
+		BVHNode leftChild;
+		leftChild.leftOrFirst = first;
+		leftChild.primitiveCount = leftCount;
+		updateNodeBounds(leftChild, primitiveBounds);
+
+		BVHNode rightChild;
+		rightChild.leftOrFirst = first + leftCount;
+		rightChild.primitiveCount = node.primitiveCount - leftCount;
+		updateNodeBounds(rightChild, primitiveBounds);
+
+		m_nodes.push_back(leftChild);
+		m_nodes.push_back(rightChild);
+
+		m_nodes[nodeIndex].leftOrFirst = static_cast<std::int32_t>(leftIndex);
+		m_nodes[nodeIndex].primitiveCount = 0;
+
+		subdivide(leftIndex, depth + 1, primitiveBounds, centroids);
+		subdivide(leftIndex + 1, depth + 1, primitiveBounds, centroids);
+	}
+
+	float BVH::findBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids, int& axis, float& splitPosition) const {
+		// Binned surface area heuristic, cost of a split is the sum of (primitive count * surface area) of both sides
+		float bestCost = std::numeric_limits<float>::max();
+
+		AABB centroidBounds;
+		for (std::int32_t i = 0; i < node.primitiveCount; i++) {
+			centroidBounds.grow(centroids[m_primitiveIndices[node.leftOrFirst + i]]);
+		}
+
+		for (int a = 0; a < 3; a++) {
+			float boundsMin = centroidBounds.min[a];
+			float boundsMax = centroidBounds.max[a];
+
+			if (boundsMin == boundsMax) {
+				continue;
+			}
+
+			Bin bins[binCount];
+			float scale = binCount / (boundsMax - boundsMin);
+
+			for (std::int32_t i = 0; i < node.primitiveCount; i++) {
+				std::uint32_t primitive = m_primitiveIndices[node.leftOrFirst + i];
+				int binIndex = std::min(binCount - 1, static_cast<int>((centroids[primitive][a] - boundsMin) * scale));
+				bins[binIndex].primitiveCount++;
+				bins[binIndex].bounds.grow(primitiveBounds[primitive]);
+			}
+
+			float leftArea[binCount - 1];
+			float rightArea[binCount - 1];
+			int leftCount[binCount - 1];
+			int rightCount[binCount - 1];
+
+			AABB leftBox;
+			AABB rightBox;
+			int leftSum = 0;
+			int rightSum = 0;
+
+			for (int i = 0; i < binCount - 1; i++) {
+				leftSum += bins[i].primitiveCount;
+				leftCount[i] = leftSum;
+				leftBox.grow(bins[i].bounds);
+				leftArea[i] = leftBox.surfaceArea();
+
+				rightSum += bins[binCount - 1 - i].primitiveCount;
+				rightCount[binCount - 2 - i] = rightSum;
+				rightBox.grow(bins[binCount - 1 - i].bounds);
+				rightArea[binCount - 2 - i] = rightBox.surfaceArea();
+			}
+
+			for (int i = 0; i < binCount - 1; i++) {
+				if (leftCount[i] == 0 || rightCount[i] == 0) {
+					continue;
+				}
+
+				float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+				if (cost < bestCost) {
+					bestCost = cost;
+					axis = a;
+					splitPosition = boundsMin + (i + 1) / scale;
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	void BVH::updateNodeBounds(BVHNode& node, const std::vector<AABB>& primitiveBounds) const {
+		AABB bounds;
+		for (std::int32_t i = 0; i < node.primitiveCount; i++) {
+			bounds.grow(primitiveBounds[m_primitiveIndices[node.leftOrFirst + i]]);
+		}
+
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+	}
+
+	float BVH::intersectAABB(const glm::vec3& origin, const glm::vec3& inverseDirection, const BVHNode& node, float closestIntersection) {
+		// Slab test, returns the entry distance or float max on a miss
+		glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+		glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+
+		glm::vec3 tSmall = glm::min(t0, t1);
+		glm::vec3 tBig = glm::max(t0, t1);
+
+		float tNear = glm::max(glm::max(tSmall.x, tSmall.y), tSmall.z);
+		float tFar = glm::min(glm::min(tBig.x, tBig.y), tBig.z);
+
+		if (tFar >= tNear && tFar > 0.0f && tNear < closestIntersection) {
+			return tNear;
+		}
+
+		return std::numeric_limits<float>::max();
+	}
+}
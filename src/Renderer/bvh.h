@@ -0,0 +1,155 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+namespace RayTracer {
+	struct AABB {
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+		void grow(const glm::vec3& point);
+		void grow(const AABB& box);
+		float surfaceArea() const;
+		glm::vec3 centroid() const;
+	};
+
+	// Flattened node, interior nodes store the index of their left child (the right child is always left + 1),
+	// leaves store the first index into the primitive index list
+	struct BVHNode {
+		glm::vec3 boundsMin;
+		std::int32_t leftOrFirst;
+		glm::vec3 boundsMax;
+		std::int32_t primitiveCount;
+
+		bool isLeaf() const { return primitiveCount > 0; }
+	};
+
+	class BVH {
+	public:
+		static constexpr int maxDepth = 64;
+		static constexpr int maxLeafSize = 8;
+
+		BVH();
+
+		// Builds over one bounding box per primitive, the primitive ids handed to traverse are indices into this list
+		void build(const std::vector<AABB>& primitiveBounds);
+
+		// Recomputes node bounds bottom up while keeping the tree topology, the primitive count must not have changed
+		// Much cheaper than a rebuild for small edits, but the tree quality degrades as primitives move further
+		void refit(const std::vector<AABB>& primitiveBounds);
+
+		// Calls intersect(primitiveId, closestIntersection) for every primitive in a leaf the ray reaches before closestIntersection
+		// intersect should shrink closestIntersection and return true when it finds a closer hit
+		template<typename IntersectFunction>
+		bool traverse(const glm::vec3& origin, const glm::vec3& direction, float& closestIntersection, IntersectFunction&& intersect) const;
+
+		// Same walk as traverse, but calls intersectLeaf(leafNode, closestIntersection) once per reached leaf so a whole leaf can be tested at once
+		template<typename LeafFunction>
+		bool traverseLeaves(const glm::vec3& origin, const glm::vec3& direction, float& closestIntersection, LeafFunction&& intersectLeaf) const;
+
+		// Replaces the tree with one built earlier, returns false and leaves the tree empty if any node points outside the arrays
+		bool assign(const BVHNode* nodes, size_t nodeCount, const std::uint32_t* primitiveIndices, size_t primitiveCount);
+
+		const std::vector<BVHNode>& getNodes() const { return m_nodes; }
+		const std::vector<std::uint32_t>& getPrimitiveIndices() const { return m_primitiveIndices; }
+		bool isEmpty() const { return m_nodes.empty(); }
+
+	private:
+		void subdivide(std::uint32_t nodeIndex, int depth, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids);
+		float findBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, const std::vector<glm::vec3>& centroids, int& axis, float& splitPosition) const;
+		void updateNodeBounds(BVHNode& node, const std::vector<AABB>& primitiveBounds) const;
+
+		static float intersectAABB(const glm::vec3& origin, const glm::vec3& inverseDirection, const BVHNode& node, float closestIntersection);
+
+	private:
+		std::vector<BVHNode> m_nodes;
+		std::vector<std::uint32_t> m_primitiveIndices;
+		std::vector<glm::vec3> m_centroids;
+	};
+
+	template<typename IntersectFunction>
+	bool BVH::traverse(const glm::vec3& origin, const glm::vec3& direction, float& closestIntersection, IntersectFunction&& intersect) const {
+		return traverseLeaves(origin, direction, closestIntersection, [&](const BVHNode& leaf, float& closest) {
+			bool isHit = false;
+			for (std::int32_t i = 0; i < leaf.primitiveCount; i++) {
+				if (intersect(m_primitiveIndices[leaf.leftOrFirst + i], closest)) {
+					isHit = true;
+				}
+			}
+			return isHit;
+		});
+	}
+
+	template<typename LeafFunction>
+	bool BVH::traverseLeaves(const glm::vec3& origin, const glm::vec3& direction, float& closestIntersection, LeafFunction&& intersectLeaf) const {
+		constexpr float miss = std::numeric_limits<float>::max();
+
+		if (m_nodes.empty()) {
+			return false;
+		}
+
+		glm::vec3 inverseDirection = 1.0f / direction;
+		if (intersectAABB(origin, inverseDirection, m_nodes[0], closestIntersection) == miss) {
+			return false;
+		}
+
+		// The build caps the tree depth, so the stack can never hold more than one far child per level
+		std::uint32_t stack[maxDepth];
+		float stackDistances[maxDepth];
+		int stackSize = 0;
+
+		bool isHit = false;
+		std::uint32_t nodeIndex = 0;
+
+		while (true) {
+			const BVHNode& node = m_nodes[nodeIndex];
+
+			if (node.isLeaf()) {
+				if (intersectLeaf(node, closestIntersection)) {
+					isHit = true;
+				}
+			}
+
+			else {
+				// Visit the nearer child first, so the far child can be culled by the shrunk closestIntersection
+				std::uint32_t nearIndex = node.leftOrFirst;
+				std::uint32_t farIndex = node.leftOrFirst + 1;
+				float nearDistance = intersectAABB(origin, inverseDirection, m_nodes[nearIndex], closestIntersection);
+				float farDistance = intersectAABB(origin, inverseDirection, m_nodes[farIndex], closestIntersection);
+
+				if (farDistance < nearDistance) {
+					std::swap(nearIndex, farIndex);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance != miss) {
+					if (farDistance != miss) {
+						stack[stackSize] = farIndex;
+						stackDistances[stackSize] = farDistance;
+						stackSize++;
+					}
+
+					nodeIndex = nearIndex;
+					continue;
+				}
+			}
+
+			// Pop the next far child that is still in front of the closest hit
+			while (stackSize > 0 && stackDistances[stackSize - 1] >= closestIntersection) {
+				stackSize--;
+			}
+
+			if (stackSize == 0) {
+				break;
+			}
+
+			nodeIndex = stack[--stackSize];
+		}
+
+		return isHit;
+	}
+}
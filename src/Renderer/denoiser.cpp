@@ -0,0 +1,394 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "denoiser.h"
+#include "profiler.h"
+
+namespace RayTracer {
+	namespace {
+		// Two sets of filtered lighting (rgb + variance) the passes ping-pong between, then the guides
+		enum DenoiserPlane {
+			PLANE_RED,
+			PLANE_GREEN,
+			PLANE_BLUE,
+			PLANE_VARIANCE,
+			PLANE_NORMAL_X = 8,
+			PLANE_NORMAL_Y,
+			PLANE_NORMAL_Z,
+			PLANE_DEPTH,
+			PLANE_DEPTH_SLOPE,
+			PLANE_COUNT
+		};
+
+		constexpr int lightingPlaneCount = 4;
+
+		// B3 spline, the same 1D kernel on both axes
+		constexpr float kernelWeights[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+		// Albedo components are clamped to this before dividing, so black materials do not blow the lighting up
+		constexpr float minimumAlbedo = 0.01f;
+
+		constexpr float luminanceEpsilon = 1e-4f;
+		constexpr float depthEpsilon = 1e-2f;
+
+		struct FilterPass {
+			const float* input[lightingPlaneCount];
+			float* output[lightingPlaneCount];
+			const float* normal[3];
+			const float* depth;
+			const float* depthSlope;
+
+			int height, stride, padding, step;
+			float colourSigma, depthSigma;
+		};
+
+		float getLuminance(float red, float green, float blue) {
+			return 0.2126f * red + 0.7152f * green + 0.0722f * blue;
+		}
+
+		float getNormalWeight(float cosine) {
+			float weight = std::max(0.0f, cosine);
+			for (int exponent = 1; exponent < Denoiser::normalExponent; exponent *= 2) {
+				weight *= weight;
+			}
+			return weight;
+		}
+
+		void filterRowScalar(const FilterPass& pass, int y, int xStart, int xEnd) {
+			for (int x = xStart; x < xEnd; x++) {
+				size_t p = static_cast<size_t>(y) * pass.stride + pass.padding + x;
+
+				float luminance = getLuminance(pass.input[PLANE_RED][p], pass.input[PLANE_GREEN][p], pass.input[PLANE_BLUE][p]);
+				float luminanceScale = 1.0f / (pass.colourSigma * std::sqrt(std::max(0.0f, pass.input[PLANE_VARIANCE][p])) + luminanceEpsilon);
+				float depthScale = 1.0f / (pass.depthSigma * pass.depthSlope[p] * pass.step + depthEpsilon);
+
+				// The centre tap always counts fully, which also keeps pixels with no neighbours on their surface unchanged
+				float centreWeight = kernelWeights[2] * kernelWeights[2];
+				float weightSum = centreWeight;
+				float red = centreWeight * pass.input[PLANE_RED][p];
+				float green = centreWeight * pass.input[PLANE_GREEN][p];
+				float blue = centreWeight * pass.input[PLANE_BLUE][p];
+				float variance = centreWeight * centreWeight * pass.input[PLANE_VARIANCE][p];
+
+				for (int dy = -2; dy <= 2; dy++) {
+					int qy = y + dy * pass.step;
+					if (qy < 0 || qy >= pass.height) {
+						continue;
+					}
+
+					for (int dx = -2; dx <= 2; dx++) {
+						if (dx == 0 && dy == 0) {
+							continue;
+						}
+
+						size_t q = static_cast<size_t>(qy) * pass.stride + pass.padding + x + dx * pass.step;
+
+						float cosine = pass.normal[0][p] * pass.normal[0][q] + pass.normal[1][p] * pass.normal[1][q] + pass.normal[2][p] * pass.normal[2][q];
+						float luminanceDistance = std::abs(luminance - getLuminance(pass.input[PLANE_RED][q], pass.input[PLANE_GREEN][q], pass.input[PLANE_BLUE][q])) * luminanceScale;
+						float depthDistance = std::abs(pass.depth[p] - pass.depth[q]) * depthScale / std::sqrt(static_cast<float>(dx * dx + dy * dy));
+
+						float weight = kernelWeights[dx + 2] * kernelWeights[dy + 2] * getNormalWeight(cosine) * std::exp(-luminanceDistance - depthDistance);
+
+						weightSum += weight;
+						red += weight * pass.input[PLANE_RED][q];
+						green += weight * pass.input[PLANE_GREEN][q];
+						blue += weight * pass.input[PLANE_BLUE][q];
+						variance += weight * weight * pass.input[PLANE_VARIANCE][q];
+					}
+				}
+
+				pass.output[PLANE_RED][p] = red / weightSum;
+				pass.output[PLANE_GREEN][p] = green / weightSum;
+				pass.output[PLANE_BLUE][p] = blue / weightSum;
+				pass.output[PLANE_VARIANCE][p] = variance / (weightSum * weightSum);
+			}
+		}
+
+#if defined(RAYTRACER_X86)
+		// FMA is a separate CPU feature from AVX2, so multiply adds stay two instructions
+		RAYTRACER_TARGET_AVX2 __m256 multiplyAddAVX2(__m256 a, __m256 b, __m256 c) {
+			return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+		}
+
+		// Cephes style exp for x <= 0, split into 2^n times a degree 5 polynomial of the remainder
+		RAYTRACER_TARGET_AVX2 __m256 expAVX2(__m256 x) {
+			x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+
+			__m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			__m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(0.693359375f)));
+			r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(-2.12194440e-4f)));
+
+			__m256 polynomial = _mm256_set1_ps(1.9875691500e-4f);
+			polynomial = multiplyAddAVX2(polynomial, r, _mm256_set1_ps(1.3981999507e-3f));
+			polynomial = multiplyAddAVX2(polynomial, r, _mm256_set1_ps(8.3334519073e-3f));
+			polynomial = multiplyAddAVX2(polynomial, r, _mm256_set1_ps(4.1665795894e-2f));
+			polynomial = multiplyAddAVX2(polynomial, r, _mm256_set1_ps(1.6666665459e-1f));
+			polynomial = multiplyAddAVX2(polynomial, r, _mm256_set1_ps(5.0000001201e-1f));
+			polynomial = multiplyAddAVX2(polynomial, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+			__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+			return _mm256_mul_ps(polynomial, _mm256_castsi256_ps(exponent));
+		}
+
+		RAYTRACER_TARGET_AVX2 __m256 getLuminanceAVX2(__m256 red, __m256 green, __m256 blue) {
+			return multiplyAddAVX2(_mm256_set1_ps(0.2126f), red, multiplyAddAVX2(_mm256_set1_ps(0.7152f), green, _mm256_mul_ps(_mm256_set1_ps(0.0722f), blue)));
+		}
+
+		// Eight neighbouring pixels of a row per iteration, every tap is an unaligned load thanks to the padded planes
+		RAYTRACER_TARGET_AVX2 void filterRowAVX2(const FilterPass& pass, int y, int xStart, int xEnd) {
+			const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+			const __m256 zero = _mm256_setzero_ps();
+
+			int x = xStart;
+			for (; x + 8 <= xEnd; x += 8) {
+				size_t p = static_cast<size_t>(y) * pass.stride + pass.padding + x;
+
+				__m256 centreRed = _mm256_loadu_ps(pass.input[PLANE_RED] + p);
+				__m256 centreGreen = _mm256_loadu_ps(pass.input[PLANE_GREEN] + p);
+				__m256 centreBlue = _mm256_loadu_ps(pass.input[PLANE_BLUE] + p);
+				__m256 centreVariance = _mm256_loadu_ps(pass.input[PLANE_VARIANCE] + p);
+				__m256 normalX = _mm256_loadu_ps(pass.normal[0] + p);
+				__m256 normalY = _mm256_loadu_ps(pass.normal[1] + p);
+				__m256 normalZ = _mm256_loadu_ps(pass.normal[2] + p);
+				__m256 depth = _mm256_loadu_ps(pass.depth + p);
+
+				__m256 luminance = getLuminanceAVX2(centreRed, centreGreen, centreBlue);
+				__m256 luminanceScale = _mm256_div_ps(_mm256_set1_ps(1.0f), multiplyAddAVX2(_mm256_set1_ps(pass.colourSigma),
+					_mm256_sqrt_ps(_mm256_max_ps(zero, centreVariance)), _mm256_set1_ps(luminanceEpsilon)));
+				__m256 depthScale = _mm256_div_ps(_mm256_set1_ps(1.0f), multiplyAddAVX2(_mm256_set1_ps(pass.depthSigma * pass.step),
+					_mm256_loadu_ps(pass.depthSlope + p), _mm256_set1_ps(depthEpsilon)));
+
+				__m256 centreWeight = _mm256_set1_ps(kernelWeights[2] * kernelWeights[2]);
+				__m256 weightSum = centreWeight;
+				__m256 red = _mm256_mul_ps(centreWeight, centreRed);
+				__m256 green = _mm256_mul_ps(centreWeight, centreGreen);
+				__m256 blue = _mm256_mul_ps(centreWeight, centreBlue);
+				__m256 variance = _mm256_mul_ps(_mm256_mul_ps(centreWeight, centreWeight), centreVariance);
+
+				for (int dy = -2; dy <= 2; dy++) {
+					int qy = y + dy * pass.step;
+					if (qy < 0 || qy >= pass.height) {
+						continue;
+					}
+
+					for (int dx = -2; dx <= 2; dx++) {
+						if (dx == 0 && dy == 0) {
+							continue;
+						}
+
+						size_t q = static_cast<size_t>(qy) * pass.stride + pass.padding + x + dx * pass.step;
+
+						__m256 tapRed = _mm256_loadu_ps(pass.input[PLANE_RED] + q);
+						__m256 tapGreen = _mm256_loadu_ps(pass.input[PLANE_GREEN] + q);
+						__m256 tapBlue = _mm256_loadu_ps(pass.input[PLANE_BLUE] + q);
+
+						__m256 cosine = _mm256_mul_ps(normalX, _mm256_loadu_ps(pass.normal[0] + q));
+						cosine = multiplyAddAVX2(normalY, _mm256_loadu_ps(pass.normal[1] + q), cosine);
+						cosine = multiplyAddAVX2(normalZ, _mm256_loadu_ps(pass.normal[2] + q), cosine);
+
+						__m256 normalWeight = _mm256_max_ps(zero, cosine);
+						for (int exponent = 1; exponent < Denoiser::normalExponent; exponent *= 2) {
+							normalWeight = _mm256_mul_ps(normalWeight, normalWeight);
+						}
+
+						__m256 luminanceDistance = _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(luminance, getLuminanceAVX2(tapRed, tapGreen, tapBlue)), absMask), luminanceScale);
+						__m256 depthDistance = _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(depth, _mm256_loadu_ps(pass.depth + q)), absMask),
+							_mm256_mul_ps(depthScale, _mm256_set1_ps(1.0f / std::sqrt(static_cast<float>(dx * dx + dy * dy)))));
+
+						__m256 weight = _mm256_mul_ps(_mm256_set1_ps(kernelWeights[dx + 2] * kernelWeights[dy + 2]), normalWeight);
+						weight = _mm256_mul_ps(weight, expAVX2(_mm256_sub_ps(zero, _mm256_add_ps(luminanceDistance, depthDistance))));
+
+						weightSum = _mm256_add_ps(weightSum, weight);
+						red = multiplyAddAVX2(weight, tapRed, red);
+						green = multiplyAddAVX2(weight, tapGreen, green);
+						blue = multiplyAddAVX2(weight, tapBlue, blue);
+						variance = multiplyAddAVX2(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(pass.input[PLANE_VARIANCE] + q), variance);
+					}
+				}
+
+				__m256 inverseWeightSum = _mm256_div_ps(_mm256_set1_ps(1.0f), weightSum);
+				_mm256_storeu_ps(pass.output[PLANE_RED] + p, _mm256_mul_ps(red, inverseWeightSum));
+				_mm256_storeu_ps(pass.output[PLANE_GREEN] + p, _mm256_mul_ps(green, inverseWeightSum));
+				_mm256_storeu_ps(pass.output[PLANE_BLUE] + p, _mm256_mul_ps(blue, inverseWeightSum));
+				_mm256_storeu_ps(pass.output[PLANE_VARIANCE] + p, _mm256_mul_ps(variance, _mm256_mul_ps(inverseWeightSum, inverseWeightSum)));
+			}
+
+			// Stores past xEnd would race with the neighbouring tile, so the last few pixels go through the scalar path
+			filterRowScalar(pass, y, x, xEnd);
+		}
+#endif
+	}
+
+	Denoiser::Denoiser() {
+		m_iterations = maxIterations;
+		m_colourSigma = 4.0f;
+		m_depthSigma = 1.0f;
+		m_simdLevel = detectSIMDLevel();
+
+		m_width = 0;
+		m_height = 0;
+		m_padding = 2 << (maxIterations - 1);
+		m_stride = 0;
+	}
+
+	void Denoiser::denoise(std::span<const glm::vec4> colour, std::span<glm::vec4> output, const FeatureBuffers& features, int width, int height, TileScheduler& tileScheduler, int tileSize) {
+		int iterations = std::clamp(m_iterations, 0, maxIterations);
+		if (iterations == 0 || width <= 0 || height <= 0) {
+			return;
+		}
+
+		resizePlanes(width, height);
+
+		auto getIndex = [&](int x, int y) {
+			return static_cast<size_t>(y) * m_stride + m_padding + x;
+		};
+
+		auto getAlbedo = [&](size_t pixelIndex) {
+			return glm::max(features.albedo[pixelIndex], glm::vec3(minimumAlbedo));
+		};
+
+		float* lighting[lightingPlaneCount];
+		for (int i = 0; i < lightingPlaneCount; i++) {
+			lighting[i] = getPlane(PLANE_RED + i);
+		}
+
+		float* normal[3] = { getPlane(PLANE_NORMAL_X), getPlane(PLANE_NORMAL_Y), getPlane(PLANE_NORMAL_Z) };
+		float* depth = getPlane(PLANE_DEPTH);
+		float* depthSlope = getPlane(PLANE_DEPTH_SLOPE);
+
+		// Splits the lighting from the albedo and copies the guides into the padded planes
+		tileScheduler.dispatchTiles(width, height, tileSize, [&](const Tile& tile) {
+			for (int y = tile.yStart; y < tile.yEnd; y++) {
+				for (int x = tile.xStart; x < tile.xEnd; x++) {
+					size_t pixelIndex = static_cast<size_t>(y) * width + x;
+					size_t p = getIndex(x, y);
+
+					glm::vec3 irradiance = glm::vec3(colour[pixelIndex]) / getAlbedo(pixelIndex);
+					lighting[PLANE_RED][p] = irradiance.x;
+					lighting[PLANE_GREEN][p] = irradiance.y;
+					lighting[PLANE_BLUE][p] = irradiance.z;
+
+					normal[0][p] = features.normal[pixelIndex].x;
+					normal[1][p] = features.normal[pixelIndex].y;
+					normal[2][p] = features.normal[pixelIndex].z;
+					depth[p] = features.depth[pixelIndex];
+				}
+			}
+		});
+
+		// The noise of each pixel is estimated from its 3x3 neighbourhood, the depth slope from the flatter side of each axis so silhouettes stay sharp
+		tileScheduler.dispatchTiles(width, height, tileSize, [&](const Tile& tile) {
+			for (int y = tile.yStart; y < tile.yEnd; y++) {
+				for (int x = tile.xStart; x < tile.xEnd; x++) {
+					size_t p = getIndex(x, y);
+
+					float luminanceSum = 0.0f;
+					float luminanceSquaredSum = 0.0f;
+					int count = 0;
+
+					for (int qy = std::max(0, y - 1); qy <= std::min(height - 1, y + 1); qy++) {
+						for (int qx = std::max(0, x - 1); qx <= std::min(width - 1, x + 1); qx++) {
+							size_t q = getIndex(qx, qy);
+							float luminance = getLuminance(lighting[PLANE_RED][q], lighting[PLANE_GREEN][q], lighting[PLANE_BLUE][q]);
+							luminanceSum += luminance;
+							luminanceSquaredSum += luminance * luminance;
+							count++;
+						}
+					}
+
+					float mean = luminanceSum / count;
+					lighting[PLANE_VARIANCE][p] = std::max(0.0f, luminanceSquaredSum / count - mean * mean);
+
+					auto getSlope = [&](size_t previous, size_t next, bool hasPrevious, bool hasNext) {
+						float slope = std::numeric_limits<float>::max();
+						if (hasPrevious && depth[previous] > 0.0f) {
+							slope = std::abs(depth[p] - depth[previous]);
+						}
+						if (hasNext && depth[next] > 0.0f) {
+							slope = std::min(slope, std::abs(depth[next] - depth[p]));
+						}
+						return slope == std::numeric_limits<float>::max() ? 0.0f : slope;
+					};
+
+					float slopeX = getSlope(p - 1, p + 1, x > 0, x + 1 < width);
+					float slopeY = getSlope(p - m_stride, p + m_stride, y > 0, y + 1 < height);
+					depthSlope[p] = std::max(slopeX, slopeY);
+				}
+			}
+		});
+
+		auto filterRow = filterRowScalar;
+#if defined(RAYTRACER_X86)
+		if (std::min(m_simdLevel, detectSIMDLevel()) == SIMD_AVX2) {
+			filterRow = filterRowAVX2;
+		}
+#endif
+
+		int source = PLANE_RED;
+		int destination = PLANE_RED + lightingPlaneCount;
+
+		for (int i = 0; i < iterations; i++) {
+			FilterPass pass;
+			for (int plane = 0; plane < lightingPlaneCount; plane++) {
+				pass.input[plane] = getPlane(source + plane);
+				pass.output[plane] = getPlane(destination + plane);
+			}
+
+			pass.normal[0] = normal[0];
+			pass.normal[1] = normal[1];
+			pass.normal[2] = normal[2];
+			pass.depth = depth;
+			pass.depthSlope = depthSlope;
+			pass.height = height;
+			pass.stride = m_stride;
+			pass.padding = m_padding;
+			pass.step = 1 << i;
+			pass.colourSigma = m_colourSigma;
+			pass.depthSigma = m_depthSigma;
+
+			// Every pass reads the whole output of the last one, so each is its own dispatch
+			ProfileZone zone("Denoise Pass");
+			tileScheduler.dispatchTiles(width, height, tileSize, [&](const Tile& tile) {
+				for (int y = tile.yStart; y < tile.yEnd; y++) {
+					filterRow(pass, y, tile.xStart, tile.xEnd);
+				}
+			});
+
+			std::swap(source, destination);
+		}
+
+		const float* filtered[3] = { getPlane(source + PLANE_RED), getPlane(source + PLANE_GREEN), getPlane(source + PLANE_BLUE) };
+
+		tileScheduler.dispatchTiles(width, height, tileSize, [&](const Tile& tile) {
+			for (int y = tile.yStart; y < tile.yEnd; y++) {
+				for (int x = tile.xStart; x < tile.xEnd; x++) {
+					size_t pixelIndex = static_cast<size_t>(y) * width + x;
+					size_t p = getIndex(x, y);
+
+					glm::vec3 irradiance(filtered[0][p], filtered[1][p], filtered[2][p]);
+					output[pixelIndex] = glm::vec4(irradiance * getAlbedo(pixelIndex), 1.0f);
+				}
+			}
+		});
+	}
+
+	void Denoiser::resizePlanes(int width, int height) {
+		if (width == m_width && height == m_height) {
+			return;
+		}
+
+		m_width = width;
+		m_height = height;
+		m_stride = m_padding + width + m_padding;
+
+		// The padding is never written, its zero normals give every tap outside the image a weight of 0
+		m_planes.assign(static_cast<size_t>(PLANE_COUNT) * m_stride * height, 0.0f);
+	}
+
+	float* Denoiser::getPlane(int plane) {
+		return m_planes.data() + static_cast<size_t>(plane) * m_stride * m_height;
+	}
+}
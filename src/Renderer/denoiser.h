@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <span>
+
+#include "simd.h"
+#include "tileScheduler.h"
+
+namespace RayTracer {
+	// Guides written by the integrator at each pixel's first hit, misses have a zero normal and depth
+	struct FeatureBuffers {
+		std::vector<glm::vec3> albedo;
+		std::vector<glm::vec3> normal;
+		std::vector<float> depth;
+	};
+
+	// Edge avoiding a-trous wavelet filter in the style of SVGF, without the temporal part
+	// Lighting is divided by the albedo before filtering and multiplied back after, so texture and material edges stay sharp
+	// Each pass blurs with a 5x5 B3 spline kernel whose taps are twice as far apart as the last pass, weighted down across normal, depth and luminance edges
+	class Denoiser {
+	public:
+		Denoiser();
+
+		// Filters colour into output, which is only written so it can be a write only mapping, features has to cover the same width * height pixels
+		void denoise(std::span<const glm::vec4> colour, std::span<glm::vec4> output, const FeatureBuffers& features, int width, int height, TileScheduler& tileScheduler, int tileSize);
+
+		// Weight of a neighbour is dot(normal, neighbourNormal) to this power
+		static constexpr int normalExponent = 128;
+		static constexpr int maxIterations = 5;
+
+	private:
+		void resizePlanes(int width, int height);
+		float* getPlane(int plane);
+
+	public:
+		// Number of passes, the last one reaches 2^(m_iterations + 1) pixels away
+		int m_iterations;
+
+		// Luminance differences are measured in standard deviations of the pixel's noise, depth differences against the local depth slope
+		float m_colourSigma;
+		float m_depthSigma;
+
+		SIMDLevel m_simdLevel;
+
+	private:
+		// One float plane per channel, each row padded on both sides so taps past the image edge land on zero normals instead of needing bounds checks
+		std::vector<float> m_planes;
+		int m_width, m_height;
+		int m_padding, m_stride;
+	};
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "frameProfiler.h"
+
+namespace RayTracer {
+	FrameProfiler::FrameProfiler() {
+		m_historyOffset = 0;
+		m_isFrameStarted = false;
+	}
+
+	void FrameProfiler::init() {
+		// Enough queries in flight for a GPU running a few frames behind
+		for (StageTimes& stage : m_stages) {
+			stage.gpuTimer.init(4);
+		}
+	}
+
+	void FrameProfiler::beginFrame() {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (StageTimes& stage : m_stages) {
+			double seconds = 0.0;
+			stage.isGpuTimeNew = stage.gpuTimer.getLatest(seconds, stage.gpuWork);
+			if (stage.isGpuTimeNew) {
+				stage.gpuTime = static_cast<float>(seconds * 1000.0);
+			}
+		}
+
+		if (!m_isFrameStarted) {
+			m_isFrameStarted = true;
+			m_frameStart = now;
+			return;
+		}
+
+		// The CPU frame runs start to start, so it includes waiting on the swap
+		std::chrono::duration<float, std::milli> frameTime = now - m_frameStart;
+		m_frameStart = now;
+
+		float gpuFrameTime = 0.0f;
+		for (StageTimes& stage : m_stages) {
+			// A stage that stopped running keeps no stale GPU time
+			if (!stage.isRun) {
+				stage.gpuTime = 0.0f;
+			}
+
+			stage.cpuHistory[m_historyOffset] = stage.cpuTime;
+			stage.gpuHistory[m_historyOffset] = stage.gpuTime;
+			gpuFrameTime += stage.gpuTime;
+
+			stage.cpuTime = 0.0f;
+			stage.isRun = false;
+		}
+
+		m_cpuFrameHistory[m_historyOffset] = frameTime.count();
+		m_gpuFrameHistory[m_historyOffset] = gpuFrameTime;
+		m_historyOffset = (m_historyOffset + 1) % historySize;
+	}
+
+	void FrameProfiler::beginStage(FrameStage stage) {
+		StageTimes& times = m_stages[stage];
+		times.isTimingGpu = times.gpuTimer.begin();
+		times.cpuStart = std::chrono::steady_clock::now();
+	}
+
+	void FrameProfiler::endStage(FrameStage stage, double work) {
+		StageTimes& times = m_stages[stage];
+		std::chrono::duration<float, std::milli> cpuTime = std::chrono::steady_clock::now() - times.cpuStart;
+		times.cpuTime += cpuTime.count();
+		times.isRun = true;
+
+		if (times.isTimingGpu) {
+			times.gpuTimer.end(work);
+			times.isTimingGpu = false;
+		}
+	}
+
+	bool FrameProfiler::getNewGpuTime(FrameStage stage, double& seconds, double& work) const {
+		const StageTimes& times = m_stages[stage];
+		seconds = times.gpuTime / 1000.0;
+		work = times.gpuWork;
+		return times.isGpuTimeNew;
+	}
+
+	const float* FrameProfiler::getCpuHistory(FrameStage stage) const {
+		return m_stages[stage].cpuHistory.data();
+	}
+
+	const float* FrameProfiler::getGpuHistory(FrameStage stage) const {
+		return m_stages[stage].gpuHistory.data();
+	}
+
+	const float* FrameProfiler::getCpuFrameHistory() const {
+		return m_cpuFrameHistory.data();
+	}
+
+	const float* FrameProfiler::getGpuFrameHistory() const {
+		return m_gpuFrameHistory.data();
+	}
+
+	int FrameProfiler::getHistoryOffset() const {
+		return m_historyOffset;
+	}
+
+	float FrameProfiler::getCpuTime(FrameStage stage) const {
+		return m_stages[stage].cpuHistory[(m_historyOffset + historySize - 1) % historySize];
+	}
+
+	float FrameProfiler::getGpuTime(FrameStage stage) const {
+		return m_stages[stage].gpuHistory[(m_historyOffset + historySize - 1) % historySize];
+	}
+
+	float FrameProfiler::getCpuFrameTime() const {
+		return m_cpuFrameHistory[(m_historyOffset + historySize - 1) % historySize];
+	}
+
+	float FrameProfiler::getGpuFrameTime() const {
+		return m_gpuFrameHistory[(m_historyOffset + historySize - 1) % historySize];
+	}
+
+	const char* FrameProfiler::getStageName(FrameStage stage) {
+		switch (stage) {
+		case STAGE_SCENE_UPLOAD:
+			return "Scene Upload";
+		case STAGE_TRACE:
+			return "Trace";
+		case STAGE_TEXTURE_UPLOAD:
+			return "Texture Upload";
+		case STAGE_UI:
+			return "UI";
+		default:
+			return "Unknown";
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+
+#include "gpuTimer.h"
+
+namespace RayTracer {
+	// Parts of one frame of the GUI, each timed on the CPU and through timer queries on the GPU
+	enum FrameStage {
+		// Scene buffers and uniforms sent to the compute shader
+		STAGE_SCENE_UPLOAD,
+
+		// The compute dispatch, or the CPU path tracer's render
+		STAGE_TRACE,
+
+		// The CPU path tracer's frame buffer copied into the display texture
+		STAGE_TEXTURE_UPLOAD,
+
+		// ImGui's draw calls
+		STAGE_UI,
+		STAGE_COUNT
+	};
+
+	// Rolling per stage CPU and GPU times, the GPU times arrive a few frames late and reading them never waits on the GPU
+	class FrameProfiler {
+	public:
+		FrameProfiler();
+		void init();
+
+		// Closes the last frame's history entries and collects every GPU time that has finished since
+		void beginFrame();
+
+		// Stages must not overlap, GL_TIME_ELAPSED queries cannot be nested
+		void beginStage(FrameStage stage);
+
+		// work is handed back with the GPU time, e.g. the pixels the stage traced
+		void endStage(FrameStage stage, double work = 0.0);
+
+		// Newest GPU time of the stage that finished since the last beginFrame
+		bool getNewGpuTime(FrameStage stage, double& seconds, double& work) const;
+
+		// Milliseconds, historySize entries with the oldest at getHistoryOffset
+		const float* getCpuHistory(FrameStage stage) const;
+		const float* getGpuHistory(FrameStage stage) const;
+		const float* getCpuFrameHistory() const;
+		const float* getGpuFrameHistory() const;
+		int getHistoryOffset() const;
+
+		// Newest history entries
+		float getCpuTime(FrameStage stage) const;
+		float getGpuTime(FrameStage stage) const;
+		float getCpuFrameTime() const;
+		float getGpuFrameTime() const;
+
+		static const char* getStageName(FrameStage stage);
+		static constexpr int historySize = 120;
+
+	private:
+		struct StageTimes {
+			GpuTimer gpuTimer;
+			bool isTimingGpu = false;
+			std::chrono::steady_clock::time_point cpuStart;
+
+			// This frame's CPU time so far, and whether the stage ran
+			float cpuTime = 0.0f;
+			bool isRun = false;
+
+			// Newest finished GPU time, and whether it arrived in the last beginFrame
+			float gpuTime = 0.0f;
+			double gpuWork = 0.0;
+			bool isGpuTimeNew = false;
+
+			std::array<float, historySize> cpuHistory{};
+			std::array<float, historySize> gpuHistory{};
+		};
+
+	private:
+		std::array<StageTimes, STAGE_COUNT> m_stages;
+		std::array<float, historySize> m_cpuFrameHistory{};
+		std::array<float, historySize> m_gpuFrameHistory{};
+
+		// Next history entry to write, which is also the oldest
+		int m_historyOffset;
+		std::chrono::steady_clock::time_point m_frameStart;
+		bool m_isFrameStarted;
+	};
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "gpuTimer.h"
+
+namespace RayTracer {
+	GpuTimer::GpuTimer() {
+		m_first = 0;
+		m_pendingCount = 0;
+	}
+
+	void GpuTimer::init(int queryCount) {
+		m_queries.resize(queryCount);
+		m_work.assign(queryCount, 0.0);
+		glGenQueries(queryCount, m_queries.data());
+		m_first = 0;
+		m_pendingCount = 0;
+	}
+
+	bool GpuTimer::begin() {
+		if (m_queries.empty() || m_pendingCount == static_cast<int>(m_queries.size())) {
+			return false;
+		}
+
+		glBeginQuery(GL_TIME_ELAPSED, m_queries[(m_first + m_pendingCount) % m_queries.size()]);
+		return true;
+	}
+
+	void GpuTimer::end(double work) {
+		glEndQuery(GL_TIME_ELAPSED);
+		m_work[(m_first + m_pendingCount) % m_queries.size()] = work;
+		m_pendingCount++;
+	}
+
+	bool GpuTimer::getLatest(double& seconds, double& work) {
+		bool isFound = false;
+
+		// Queries finish in the order they were issued
+		while (m_pendingCount > 0) {
+			GLint isAvailable = GL_FALSE;
+			glGetQueryObjectiv(m_queries[m_first], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+			if (!isAvailable) {
+				break;
+			}
+
+			GLuint64 elapsedTime = 0;
+			glGetQueryObjectui64v(m_queries[m_first], GL_QUERY_RESULT, &elapsedTime);
+			seconds = static_cast<double>(elapsedTime) * 1e-9;
+			work = m_work[m_first];
+			isFound = true;
+
+			m_first = (m_first + 1) % static_cast<int>(m_queries.size());
+			m_pendingCount--;
+		}
+
+		return isFound;
+	}
+}
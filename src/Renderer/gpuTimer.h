@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glad/gl.h>
+#include <vector>
+
+namespace RayTracer {
+	// GL_TIME_ELAPSED queries in a ring, each read back only once the GPU has finished it, so timing never waits on the GPU
+	// Only one GL_TIME_ELAPSED query can be active at a time, so timed ranges must not overlap, even across timers
+	class GpuTimer {
+	public:
+		GpuTimer();
+		void init(int queryCount);
+
+		// Returns false and times nothing when every query is still in flight, end must then be skipped
+		bool begin();
+
+		// work is handed back with the time, e.g. the number of pixels the timed commands traced
+		void end(double work);
+
+		// Newest query the GPU has finished since the last call, older finished ones are dropped
+		bool getLatest(double& seconds, double& work);
+
+	private:
+		std::vector<GLuint> m_queries;
+		std::vector<double> m_work;
+
+		// Oldest query still in flight, and how many follow it
+		int m_first;
+		int m_pendingCount;
+	};
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "imageWriter.h"
+
+namespace RayTracer {
+	bool writePPM(const char* path, std::span<const glm::vec4> pixels, int width, int height) {
+		size_t pixelCount = static_cast<size_t>(width) * height;
+		if (width <= 0 || height <= 0 || pixels.size() < pixelCount) {
+			return false;
+		}
+
+		std::ofstream file(path, std::ios::binary);
+		if (!file) {
+			return false;
+		}
+
+		file << "P6\n" << width << " " << height << "\n255\n";
+
+		std::vector<std::uint8_t> bytes(pixelCount * 3);
+		for (size_t i = 0; i < pixelCount; i++) {
+			glm::vec3 colour = glm::clamp(glm::vec3(pixels[i]), 0.0f, 1.0f);
+			bytes[i * 3 + 0] = static_cast<std::uint8_t>(colour.x * 255.0f + 0.5f);
+			bytes[i * 3 + 1] = static_cast<std::uint8_t>(colour.y * 255.0f + 0.5f);
+			bytes[i * 3 + 2] = static_cast<std::uint8_t>(colour.z * 255.0f + 0.5f);
+		}
+
+		file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		return static_cast<bool>(file);
+	}
+}
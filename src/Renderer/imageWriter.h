@@ -0,0 +1,9 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <span>
+
+namespace RayTracer {
+	// Writes a binary PPM (P6), colours are clamped to [0, 1] and the first row is the top of the image
+	bool writePPM(const char* path, std::span<const glm::vec4> pixels, int width, int height);
+}
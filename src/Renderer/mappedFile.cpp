@@ -0,0 +1,120 @@
+#pragma once
+
+#include "mappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace RayTracer {
+	MappedFile::MappedFile()
+		: m_data(nullptr), m_size(0) {
+#if defined(_WIN32)
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = nullptr;
+#endif
+	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	bool MappedFile::open(const std::filesystem::path& path) {
+		close();
+
+#if defined(_WIN32)
+		m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(m_file, &fileSize)) {
+			close();
+			return false;
+		}
+
+		m_size = static_cast<size_t>(fileSize.QuadPart);
+
+		// Mapping an empty file fails, but an empty file is still a valid open
+		if (m_size == 0) {
+			return true;
+		}
+
+		m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping == nullptr) {
+			close();
+			return false;
+		}
+
+		m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (m_data == nullptr) {
+			close();
+			return false;
+		}
+#else
+		int file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0) {
+			return false;
+		}
+
+		struct stat fileStatus;
+		if (fstat(file, &fileStatus) != 0) {
+			::close(file);
+			return false;
+		}
+
+		m_size = static_cast<size_t>(fileStatus.st_size);
+
+		if (m_size == 0) {
+			::close(file);
+			return true;
+		}
+
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+		// The mapping keeps its own reference to the file
+		::close(file);
+
+		if (data == MAP_FAILED) {
+			m_size = 0;
+			return false;
+		}
+
+		madvise(data, m_size, MADV_SEQUENTIAL);
+		m_data = static_cast<const char*>(data);
+#endif
+
+		return true;
+	}
+
+	void MappedFile::close() {
+#if defined(_WIN32)
+		if (m_data != nullptr) {
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping != nullptr) {
+			CloseHandle(m_mapping);
+			m_mapping = nullptr;
+		}
+		if (m_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(m_file);
+			m_file = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (m_data != nullptr) {
+			munmap(const_cast<char*>(m_data), m_size);
+		}
+#endif
+
+		m_data = nullptr;
+		m_size = 0;
+	}
+}
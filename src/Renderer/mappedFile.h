@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace RayTracer {
+	// Read only memory mapping of a whole file, the pages are only read from disk when they are touched
+	class MappedFile {
+	public:
+		MappedFile();
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool open(const std::filesystem::path& path);
+		void close();
+
+		const char* getData() const { return m_data; }
+		size_t getSize() const { return m_size; }
+
+	private:
+		const char* m_data;
+		size_t m_size;
+
+#if defined(_WIN32)
+		void* m_file;
+		void* m_mapping;
+#endif
+	};
+}
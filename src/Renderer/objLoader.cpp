@@ -0,0 +1,480 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "objLoader.h"
+#include "mappedFile.h"
+
+namespace RayTracer {
+	namespace {
+		// Chunks smaller than this are not worth a thread of their own
+		constexpr size_t minimumChunkSize = 1 << 20;
+
+		constexpr std::int32_t missingIndex = std::numeric_limits<std::int32_t>::min();
+
+		// Relative indices are stored below zero, offset so they can still reach back into earlier chunks
+		constexpr std::int64_t relativeBias = -(std::int64_t(1) << 30);
+		constexpr std::int32_t inheritedMaterial = -1;
+
+		// Everything one chunk of the file declares, string views point into the mapped file so lines are never copied
+		struct ObjChunk {
+			const char* begin;
+			const char* end;
+
+			std::vector<glm::vec3> positions;
+			std::vector<glm::vec3> normals;
+
+			// Zero based and absolute when the file used a positive index
+			// Negative (relative) indices are stored as relativeBias + chunk local index until the chunk's offset is known
+			std::vector<std::int32_t> cornerPositions;
+			std::vector<std::int32_t> cornerNormals;
+			std::vector<std::uint32_t> faceCornerCounts;
+
+			// Index into materialNames, or inheritedMaterial for faces before the chunk's first usemtl
+			std::vector<std::int32_t> faceMaterials;
+			std::vector<std::string_view> materialNames;
+			std::vector<std::string_view> materialLibraries;
+
+			size_t positionOffset = 0;
+			size_t normalOffset = 0;
+			size_t triangleOffset = 0;
+			size_t triangleCount = 0;
+
+			// Index into the loader's material list for every entry of materialNames, and for faces before the first usemtl
+			std::vector<std::uint32_t> materialIndices;
+			std::uint32_t startMaterial = 0;
+
+			const char* errorLine = nullptr;
+			const char* errorMessage = nullptr;
+		};
+
+		bool isSpace(char character) {
+			return character == ' ' || character == '\t' || character == '\r';
+		}
+
+		const char* skipSpaces(const char* cursor, const char* end) {
+			while (cursor < end && isSpace(*cursor)) {
+				cursor++;
+			}
+			return cursor;
+		}
+
+		const char* findLineEnd(const char* cursor, const char* end) {
+			while (cursor < end && *cursor != '\n') {
+				cursor++;
+			}
+			return cursor;
+		}
+
+		bool isKeyword(const char* cursor, const char* end, std::string_view keyword) {
+			size_t length = keyword.size();
+			return static_cast<size_t>(end - cursor) > length && std::string_view(cursor, length) == keyword && isSpace(cursor[length]);
+		}
+
+		// Rest of the line without surrounding whitespace, used for material and library names
+		std::string_view readName(const char* cursor, const char* lineEnd) {
+			cursor = skipSpaces(cursor, lineEnd);
+			while (lineEnd > cursor && isSpace(lineEnd[-1])) {
+				lineEnd--;
+			}
+			return std::string_view(cursor, lineEnd - cursor);
+		}
+
+		bool readFloat(const char*& cursor, const char* lineEnd, float& value) {
+			cursor = skipSpaces(cursor, lineEnd);
+
+			// from_chars rejects a leading plus sign, which some exporters write
+			if (cursor < lineEnd && *cursor == '+') {
+				cursor++;
+			}
+
+			std::from_chars_result result = std::from_chars(cursor, lineEnd, value);
+			if (result.ec != std::errc()) {
+				return false;
+			}
+
+			cursor = result.ptr;
+			return true;
+		}
+
+		bool readVector(const char* cursor, const char* lineEnd, glm::vec3& vector) {
+			return readFloat(cursor, lineEnd, vector.x) && readFloat(cursor, lineEnd, vector.y) && readFloat(cursor, lineEnd, vector.z);
+		}
+
+		// Turns a one based or negative OBJ index into the encoding described on ObjChunk
+		bool readIndex(const char*& cursor, const char* lineEnd, size_t localCount, std::int32_t& index) {
+			std::int64_t value;
+			std::from_chars_result result = std::from_chars(cursor, lineEnd, value);
+			if (result.ec != std::errc() || value == 0) {
+				return false;
+			}
+
+			cursor = result.ptr;
+
+			if (value > 0) {
+				index = static_cast<std::int32_t>(value - 1);
+				return value <= std::numeric_limits<std::int32_t>::max();
+			}
+
+			// Can be negative when the index reaches back into an earlier chunk
+			std::int64_t localIndex = static_cast<std::int64_t>(localCount) + value;
+			index = static_cast<std::int32_t>(relativeBias + localIndex);
+			return localIndex > relativeBias && localIndex < -relativeBias;
+		}
+
+		bool parseFace(const char* cursor, const char* lineEnd, ObjChunk& chunk) {
+			std::uint32_t cornerCount = 0;
+
+			while (true) {
+				cursor = skipSpaces(cursor, lineEnd);
+				if (cursor >= lineEnd) {
+					break;
+				}
+
+				// Corners are v, v/vt, v//vn or v/vt/vn, texture coordinates are not used
+				std::int32_t position;
+				std::int32_t normal = missingIndex;
+
+				if (!readIndex(cursor, lineEnd, chunk.positions.size(), position)) {
+					return false;
+				}
+
+				if (cursor < lineEnd && *cursor == '/') {
+					cursor++;
+					while (cursor < lineEnd && *cursor != '/' && !isSpace(*cursor)) {
+						cursor++;
+					}
+
+					if (cursor < lineEnd && *cursor == '/') {
+						cursor++;
+						if (!readIndex(cursor, lineEnd, chunk.normals.size(), normal)) {
+							return false;
+						}
+					}
+				}
+
+				chunk.cornerPositions.push_back(position);
+				chunk.cornerNormals.push_back(normal);
+				cornerCount++;
+			}
+
+			if (cornerCount < 3) {
+				chunk.cornerPositions.resize(chunk.cornerPositions.size() - cornerCount);
+				chunk.cornerNormals.resize(chunk.cornerNormals.size() - cornerCount);
+				return true;
+			}
+
+			chunk.faceCornerCounts.push_back(cornerCount);
+			chunk.faceMaterials.push_back(chunk.materialNames.empty() ? inheritedMaterial : static_cast<std::int32_t>(chunk.materialNames.size() - 1));
+			chunk.triangleCount += cornerCount - 2;
+			return true;
+		}
+
+		void parseChunk(ObjChunk& chunk) {
+			const char* cursor = chunk.begin;
+
+			while (cursor < chunk.end) {
+				const char* lineEnd = findLineEnd(cursor, chunk.end);
+				const char* line = skipSpaces(cursor, lineEnd);
+				cursor = lineEnd + 1;
+
+				if (line >= lineEnd || *line == '#') {
+					continue;
+				}
+
+				bool isValid = true;
+
+				if (isKeyword(line, lineEnd, "v")) {
+					glm::vec3 position;
+					isValid = readVector(line + 1, lineEnd, position);
+					chunk.positions.push_back(position);
+				}
+
+				else if (isKeyword(line, lineEnd, "vn")) {
+					glm::vec3 normal;
+					isValid = readVector(line + 2, lineEnd, normal);
+					chunk.normals.push_back(normal);
+				}
+
+				else if (isKeyword(line, lineEnd, "f")) {
+					isValid = parseFace(line + 1, lineEnd, chunk);
+				}
+
+				else if (isKeyword(line, lineEnd, "usemtl")) {
+					chunk.materialNames.push_back(readName(line + 6, lineEnd));
+				}
+
+				else if (isKeyword(line, lineEnd, "mtllib")) {
+					chunk.materialLibraries.push_back(readName(line + 6, lineEnd));
+				}
+
+				// Objects, groups, smoothing groups, texture coordinates and lines do not change the triangles
+
+				if (!isValid) {
+					chunk.errorLine = line;
+					return;
+				}
+			}
+		}
+
+		// Converts the chunk's faces into triangles, writing to its own range of the output so chunks can run in parallel
+		// OBJ positions and normals become scene vertices and normals in file order, so an index only needs firstVertex or firstNormal added
+		void buildTriangles(ObjChunk& chunk, std::uint32_t firstVertex, std::uint32_t firstNormal, std::uint32_t firstMaterial, Triangle* triangles, size_t positionCount, size_t normalCount) {
+			// Relative indices before the start of the file wrap around to a huge value, which fails the range checks below
+			auto resolve = [](std::int32_t index, size_t offset) {
+				return index >= 0 ? static_cast<size_t>(index) : static_cast<size_t>(static_cast<std::int64_t>(offset) + index - relativeBias);
+			};
+
+			size_t corner = 0;
+			Triangle* output = triangles + chunk.triangleOffset;
+
+			for (size_t face = 0; face < chunk.faceCornerCounts.size(); face++) {
+				std::uint32_t cornerCount = chunk.faceCornerCounts[face];
+				std::int32_t materialSlot = chunk.faceMaterials[face];
+				std::uint32_t materialIndex = firstMaterial + (materialSlot == inheritedMaterial ? chunk.startMaterial : chunk.materialIndices[materialSlot]);
+
+				size_t positionIndices[3] = {};
+				size_t normalIndices[3] = {};
+
+				for (std::uint32_t i = 0; i < cornerCount; i++, corner++) {
+					size_t position = resolve(chunk.cornerPositions[corner], chunk.positionOffset);
+					if (position >= positionCount) {
+						chunk.errorMessage = "face references a vertex that does not exist";
+						return;
+					}
+
+					std::int32_t normalIndex = chunk.cornerNormals[corner];
+					size_t normal = normalIndex == missingIndex ? normalCount : resolve(normalIndex, chunk.normalOffset);
+					if (normalIndex != missingIndex && normal >= normalCount) {
+						chunk.errorMessage = "face references a normal that does not exist";
+						return;
+					}
+
+					// Fan triangulation around the first corner, which is exact for the convex polygons exporters write
+					if (i == 0) {
+						positionIndices[0] = position;
+						normalIndices[0] = normal;
+						continue;
+					}
+
+					positionIndices[1] = positionIndices[2];
+					normalIndices[1] = normalIndices[2];
+					positionIndices[2] = position;
+					normalIndices[2] = normal;
+
+					if (i < 2) {
+						continue;
+					}
+
+					Triangle& triangle = *output++;
+					triangle.materialIndex = materialIndex;
+
+					// A corner without a normal leaves the whole triangle flat shaded
+					bool hasNormals = normalIndices[0] < normalCount && normalIndices[1] < normalCount && normalIndices[2] < normalCount;
+					for (int j = 0; j < 3; j++) {
+						triangle.vertexIndices[j] = firstVertex + static_cast<std::uint32_t>(positionIndices[j]);
+						triangle.normalIndices[j] = hasNormals ? firstNormal + static_cast<std::uint32_t>(normalIndices[j]) : noNormal;
+					}
+				}
+			}
+		}
+
+		bool loadMTL(const std::filesystem::path& path, std::vector<Material>& materials, std::unordered_map<std::string, std::uint32_t>& materialIndices) {
+			MappedFile file;
+			if (!file.open(path)) {
+				std::cerr << "Could not open material library " << path.string() << std::endl;
+				return false;
+			}
+
+			const char* cursor = file.getData();
+			const char* end = cursor + file.getSize();
+
+			Material* material = nullptr;
+
+			while (cursor < end) {
+				const char* lineEnd = findLineEnd(cursor, end);
+				const char* line = skipSpaces(cursor, lineEnd);
+				cursor = lineEnd + 1;
+
+				if (isKeyword(line, lineEnd, "newmtl")) {
+					std::string name(readName(line + 6, lineEnd));
+					materialIndices[name] = static_cast<std::uint32_t>(materials.size());
+					materials.push_back(Material(glm::vec3(0.8f)));
+					material = &materials.back();
+					continue;
+				}
+
+				if (material == nullptr) {
+					continue;
+				}
+
+				glm::vec3 value;
+				float scalar;
+				const char* valueStart = line + 2;
+
+				if (isKeyword(line, lineEnd, "Kd") && readVector(valueStart, lineEnd, value)) {
+					material->materialColour = value;
+				}
+
+				else if (isKeyword(line, lineEnd, "Ke") && readVector(valueStart, lineEnd, value)) {
+					// Material keeps the emission as a colour and a strength, so the brightest channel becomes the strength
+					float strength = std::max(std::max(value.x, value.y), value.z);
+					material->emissiveStrength = strength;
+					material->emissionColour = strength > 0.0f ? value / strength : glm::vec3(0.0f);
+				}
+
+				// Metallic from the PBR extension is the closest match to reflectivness
+				// The specular exponent Ns is a highlight size rather than a reflectance, so it is ignored and materials without Pm stay diffuse
+				else if (isKeyword(line, lineEnd, "Pm") && readFloat(valueStart, lineEnd, scalar)) {
+					material->reflectivness = std::clamp(scalar, 0.0f, 1.0f);
+				}
+			}
+
+			return true;
+		}
+	}
+
+	bool loadOBJ(const std::filesystem::path& path, std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<Triangle>& triangles, std::vector<Material>& materials,
+		unsigned threadCount, std::vector<std::filesystem::path>* materialLibraries) {
+		MappedFile file;
+		if (!file.open(path)) {
+			std::cerr << "Could not open " << path.string() << std::endl;
+			return false;
+		}
+
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		const char* data = file.getData();
+		size_t size = file.getSize();
+		size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, size / minimumChunkSize));
+
+		// Chunk boundaries are moved forward to the next line start, so no line is split between chunks
+		std::vector<ObjChunk> chunks(chunkCount);
+		const char* chunkStart = data;
+		for (size_t i = 0; i < chunkCount; i++) {
+			const char* chunkEnd = i + 1 == chunkCount ? data + size : std::max(chunkStart, data + size * (i + 1) / chunkCount);
+			while (chunkEnd < data + size && chunkEnd > data && chunkEnd[-1] != '\n') {
+				chunkEnd++;
+			}
+
+			chunks[i].begin = chunkStart;
+			chunks[i].end = chunkEnd;
+			chunkStart = chunkEnd;
+		}
+
+		auto runChunks = [&](auto&& function) {
+			std::vector<std::thread> workers;
+			for (size_t i = 1; i < chunkCount; i++) {
+				workers.emplace_back([&, i]() { function(chunks[i]); });
+			}
+
+			function(chunks[0]);
+
+			for (std::thread& worker : workers) {
+				worker.join();
+			}
+		};
+
+		runChunks([](ObjChunk& chunk) { parseChunk(chunk); });
+
+		for (const ObjChunk& chunk : chunks) {
+			if (chunk.errorLine != nullptr) {
+				std::cerr << "Could not parse " << path.string() << " near: " << std::string_view(chunk.errorLine, findLineEnd(chunk.errorLine, data + size) - chunk.errorLine) << std::endl;
+				return false;
+			}
+		}
+
+		// Material libraries are small, so they are read on this thread once every chunk has been scanned
+		std::vector<Material> fileMaterials = { Material(glm::vec3(0.8f)) };
+		std::unordered_map<std::string, std::uint32_t> materialIndices;
+
+		for (const ObjChunk& chunk : chunks) {
+			for (std::string_view library : chunk.materialLibraries) {
+				// Missing libraries are reported too, so a cache built without one is invalidated once it appears
+				std::filesystem::path libraryPath = path.parent_path() / std::filesystem::path(library);
+				loadMTL(libraryPath, fileMaterials, materialIndices);
+				if (materialLibraries != nullptr) {
+					materialLibraries->push_back(libraryPath);
+				}
+			}
+		}
+
+		// Counts before each chunk turn chunk local data into global offsets, and usemtl state carries over between chunks
+		size_t positionCount = 0;
+		size_t normalCount = 0;
+		size_t triangleCount = 0;
+		std::uint32_t currentMaterial = 0;
+
+		for (ObjChunk& chunk : chunks) {
+			chunk.positionOffset = positionCount;
+			chunk.normalOffset = normalCount;
+			chunk.triangleOffset = triangleCount;
+			chunk.startMaterial = currentMaterial;
+
+			positionCount += chunk.positions.size();
+			normalCount += chunk.normals.size();
+			triangleCount += chunk.triangleCount;
+
+			for (std::string_view name : chunk.materialNames) {
+				auto found = materialIndices.find(std::string(name));
+				if (found == materialIndices.end()) {
+					std::cerr << "Unknown material " << name << " in " << path.string() << ", using the default" << std::endl;
+				}
+
+				currentMaterial = found == materialIndices.end() ? 0 : found->second;
+				chunk.materialIndices.push_back(currentMaterial);
+			}
+		}
+
+		// Triangles and the GPU copies index vertices, normals and materials with 32 bits, the largest normal index stands for none
+		size_t firstVertex = vertices.size();
+		size_t firstNormal = normals.size();
+		size_t firstMaterial = materials.size();
+		if (firstVertex + positionCount > std::numeric_limits<std::uint32_t>::max() || firstNormal + normalCount >= noNormal ||
+			firstMaterial + fileMaterials.size() > std::numeric_limits<std::uint32_t>::max()) {
+			std::cerr << "Could not load " << path.string() << ": too many vertices, normals or materials" << std::endl;
+			return false;
+		}
+
+		size_t firstTriangle = triangles.size();
+		triangles.resize(firstTriangle + triangleCount);
+		vertices.resize(firstVertex + positionCount);
+		normals.resize(firstNormal + normalCount);
+
+		// Exporters do not always write unit normals, and interpolating normals of different lengths would skew the shading
+		auto getUnitNormal = [](const glm::vec3& normal) {
+			float length = glm::length(normal);
+			return length > 0.0f ? normal / length : normal;
+		};
+
+		runChunks([&](ObjChunk& chunk) {
+			std::copy(chunk.positions.begin(), chunk.positions.end(), vertices.begin() + firstVertex + chunk.positionOffset);
+			std::transform(chunk.normals.begin(), chunk.normals.end(), normals.begin() + firstNormal + chunk.normalOffset, getUnitNormal);
+			buildTriangles(chunk, static_cast<std::uint32_t>(firstVertex), static_cast<std::uint32_t>(firstNormal), static_cast<std::uint32_t>(firstMaterial),
+				triangles.data() + firstTriangle, positionCount, normalCount);
+		});
+
+		for (const ObjChunk& chunk : chunks) {
+			if (chunk.errorMessage != nullptr) {
+				std::cerr << "Could not load " << path.string() << ": " << chunk.errorMessage << std::endl;
+				triangles.erase(triangles.begin() + firstTriangle, triangles.end());
+				vertices.erase(vertices.begin() + firstVertex, vertices.end());
+				normals.erase(normals.begin() + firstNormal, normals.end());
+				return false;
+			}
+		}
+
+		materials.insert(materials.end(), fileMaterials.begin(), fileMaterials.end());
+		return true;
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "scene.h"
+
+namespace RayTracer {
+	// Appends the triangles of a Wavefront OBJ file, n-gons are fan triangulated and materials come from its mtllib files
+	// Positions are appended to vertices, normals to normals and materials to the material table, the new triangles index into all three
+	// The file is memory mapped and split into one chunk per thread, passing 0 uses every hardware thread
+	// Prints the reason and leaves the vectors untouched when the file cannot be loaded
+	// materialLibraries receives the path of every MTL file the OBJ names, including ones that could not be opened
+	bool loadOBJ(const std::filesystem::path& path, std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<Triangle>& triangles, std::vector<Material>& materials,
+		unsigned threadCount = 0, std::vector<std::filesystem::path>* materialLibraries = nullptr);
+}
@@ -0,0 +1,829 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#include <glm/gtc/constants.hpp>
+
+#include "pathTracer.h"
+#include "profiler.h"
+
+namespace RayTracer {
+	namespace {
+		// Branchless orthonormal basis around a unit vector, from Duff et al. "Building an Orthonormal Basis, Revisited"
+		void getOrthonormalBasis(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent) {
+			float sign = std::copysign(1.0f, normal.z);
+			float a = -1.0f / (sign + normal.z);
+			float b = normal.x * normal.y * a;
+			tangent = glm::vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+			bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+		}
+
+		// Veach's power heuristic with an exponent of 2, the weight for a sample drawn with pdf when the other strategy had otherPdf
+		float getPowerHeuristic(float pdf, float otherPdf) {
+			float pdfSquared = pdf * pdf;
+			return pdfSquared / (pdfSquared + otherPdf * otherPdf);
+		}
+	}
+
+	PathTracer::PathTracer() {
+		m_activePixelFraction = 1.0f;
+		m_frameIndex = 0;
+		m_width = 0;
+		m_height = 0;
+		m_reprojectedPixelFraction = 1.0f;
+		m_simdLevel = SIMD_SCALAR;
+		m_intersectSphereBlock = getSphereBlockFunction(m_simdLevel);
+	}
+
+	void PathTracer::init() {
+		m_threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		m_tileSize = 16;
+		m_usePacketTracing = true;
+		m_simdLevel = detectSIMDLevel();
+		m_intersectSphereBlock = getSphereBlockFunction(m_simdLevel);
+		m_samplerType = SAMPLER_SOBOL;
+		m_useReprojection = true;
+		m_tileScheduler.init(m_threadCount);
+	}
+
+	void PathTracer::render(const Scene& scene, std::span<glm::vec4> frameBuffer, int width, int height, int bounceLimit, SamplingMode samplingMode, bool isAccumulating, float adaptiveThreshold) {
+		ProfileZone zone("Path Trace");
+		size_t pixelCount = static_cast<size_t>(width) * height;
+
+		if (width != m_width || height != m_height) {
+			m_accumilateFrameBuffer.assign(pixelCount, glm::vec3(0.0f));
+			m_pixelStatistics.assign(pixelCount, PixelStatistics());
+			m_features.albedo.assign(pixelCount, glm::vec3(1.0f));
+			m_features.normal.assign(pixelCount, glm::vec3(0.0f));
+			m_features.depth.assign(pixelCount, 0.0f);
+			m_activePixelFraction = 1.0f;
+			m_camera = scene.m_camera;
+			m_width = width;
+			m_height = height;
+		}
+
+		if (m_tileScheduler.getThreadCount() != static_cast<unsigned>(m_threadCount)) {
+			m_tileScheduler.init(m_threadCount);
+		}
+
+		// Reprojection traces rays, so the kernels have to be current before it runs
+		m_intersectSphereBlock = getSphereBlockFunction(m_simdLevel);
+		m_samplingMode = samplingMode;
+
+		// Without accumulation every pixel starts again anyway
+		if (scene.m_camera != m_camera) {
+			if (isAccumulating && m_useReprojection) {
+				reproject(scene, width, height);
+			}
+
+			else if (isAccumulating) {
+				std::fill(m_accumilateFrameBuffer.begin(), m_accumilateFrameBuffer.end(), glm::vec3(0.0f));
+				std::fill(m_pixelStatistics.begin(), m_pixelStatistics.end(), PixelStatistics());
+				m_reprojectedPixelFraction = 0.0f;
+			}
+
+			m_camera = scene.m_camera;
+		}
+
+		const Camera& camera = m_camera;
+
+		const PacketKernels& packetKernels = getPacketKernels(m_simdLevel);
+
+		// Converged pixels are skipped, and the samples they would have taken go to the pixels that are still noisy
+		bool isAdaptive = isAccumulating && adaptiveThreshold > 0.0f;
+		int samplesPerPixel = isAdaptive ? getAdaptiveSampleCount(m_activePixelFraction) : 1;
+		std::atomic<size_t> activePixelCount = 0;
+
+		m_tileScheduler.dispatchTiles(width, height, m_tileSize, [&](const Tile& tile) {
+			auto getPrimaryRay = [&](int i, int j) {
+				Ray ray;
+				ray.origin = camera.location;
+				ray.direction = camera.getRayDirection(j + 0.5f, i + 0.5f, width, height);
+				return ray;
+			};
+
+			auto getSampler = [&](int i, int j) {
+				int pixelIndex = i * width + j;
+				return Sampler(m_samplerType, j, i, isAccumulating ? m_pixelStatistics[pixelIndex].sampleCount : m_frameIndex);
+			};
+
+			auto addSample = [&](int pixelIndex, const glm::vec3& colour) {
+				m_accumilateFrameBuffer[pixelIndex] += colour;
+				m_pixelStatistics[pixelIndex].addSample(getLuminance(colour));
+			};
+
+			thread_local std::vector<int> activeColumns;
+			size_t tileActivePixels = 0;
+
+			ProfileZone traceZone("Trace Tile", PROFILE_FINE);
+			for (int i = tile.yStart; i < tile.yEnd; i++) {
+				activeColumns.clear();
+
+				for (int j = tile.xStart; j < tile.xEnd; j++) {
+					int pixelIndex = i * width + j;
+
+					if (!isAccumulating) {
+						m_accumilateFrameBuffer[pixelIndex] = glm::vec3(0.0f);
+						m_pixelStatistics[pixelIndex] = PixelStatistics();
+					}
+
+					if (!isAdaptive || !m_pixelStatistics[pixelIndex].isConverged(adaptiveThreshold)) {
+						activeColumns.push_back(j);
+					}
+				}
+
+				tileActivePixels += activeColumns.size();
+
+				for (int sample = 0; sample < samplesPerPixel; sample++) {
+					if (!m_usePacketTracing) {
+						for (int j : activeColumns) {
+							Ray ray = getPrimaryRay(i, j);
+
+							PrimitiveHit primaryHit;
+							primaryHit.distance = std::numeric_limits<float>::max();
+							primaryHit.primitiveId = findClosestHit(scene, ray, primaryHit.distance);
+
+							if (sample == 0) {
+								writeFeatures(scene, ray, primaryHit, i * width + j);
+							}
+
+							Sampler sampler = getSampler(i, j);
+							addSample(i * width + j, traceRay(scene, ray, bounceLimit, &primaryHit, sampler));
+						}
+						continue;
+					}
+
+					// Neighbouring pixels of a row are coherent, so the first hit of each run is found for the whole packet at once
+					for (size_t first = 0; first < activeColumns.size(); first += RayPacket::packetSize) {
+						int rayCount = static_cast<int>(std::min<size_t>(RayPacket::packetSize, activeColumns.size() - first));
+
+						Ray rays[RayPacket::packetSize];
+						for (int k = 0; k < rayCount; k++) {
+							rays[k] = getPrimaryRay(i, activeColumns[first + k]);
+						}
+
+						RayPacket packet;
+						packet.setRays(rays, rayCount);
+						tracePacket(scene, packet, packetKernels);
+
+						for (int k = 0; k < rayCount; k++) {
+							PrimitiveHit primaryHit = packet.getHit(k);
+
+							if (sample == 0) {
+								writeFeatures(scene, rays[k], primaryHit, i * width + activeColumns[first + k]);
+							}
+
+							Sampler sampler = getSampler(i, activeColumns[first + k]);
+							addSample(i * width + activeColumns[first + k], traceRay(scene, rays[k], bounceLimit, &primaryHit, sampler));
+						}
+					}
+				}
+			}
+
+			activePixelCount += tileActivePixels;
+
+			// Every pixel is written, the frame buffer is one of several streaming buffers and does not keep the last frame
+			ProfileZone accumulateZone("Accumulate", PROFILE_FINE);
+			for (int i = tile.yStart; i < tile.yEnd; i++) {
+				for (int j = tile.xStart; j < tile.xEnd; j++) {
+					int pixelIndex = i * width + j;
+					float sampleCount = static_cast<float>(std::max(1u, m_pixelStatistics[pixelIndex].sampleCount));
+					frameBuffer[pixelIndex] = glm::vec4(m_accumilateFrameBuffer[pixelIndex] / sampleCount, 1.0f);
+				}
+			}
+		});
+
+		m_activePixelFraction = static_cast<float>(activePixelCount) / static_cast<float>(pixelCount);
+		m_frameIndex++;
+	}
+
+	float PathTracer::getActivePixelFraction() const {
+		return m_activePixelFraction;
+	}
+
+	float PathTracer::getReprojectedPixelFraction() const {
+		return m_reprojectedPixelFraction;
+	}
+
+	void PathTracer::reproject(const Scene& scene, int width, int height) {
+		ProfileZone zone("Reproject");
+		size_t pixelCount = static_cast<size_t>(width) * height;
+
+		std::swap(m_accumilateFrameBuffer, m_historyFrameBuffer);
+		std::swap(m_pixelStatistics, m_historyStatistics);
+		std::swap(m_features, m_historyFeatures);
+
+		m_accumilateFrameBuffer.resize(pixelCount);
+		m_pixelStatistics.resize(pixelCount);
+		m_features.albedo.resize(pixelCount);
+		m_features.normal.resize(pixelCount);
+		m_features.depth.resize(pixelCount);
+
+		const Camera& previousCamera = m_camera;
+		const Camera& camera = scene.m_camera;
+		std::atomic<size_t> reprojectedPixelCount = 0;
+
+		m_tileScheduler.dispatchTiles(width, height, m_tileSize, [&](const Tile& tile) {
+			size_t tileReprojectedPixels = 0;
+
+			for (int i = tile.yStart; i < tile.yEnd; i++) {
+				for (int j = tile.xStart; j < tile.xEnd; j++) {
+					size_t pixelIndex = static_cast<size_t>(i) * width + j;
+
+					Ray ray;
+					ray.origin = camera.location;
+					ray.direction = camera.getRayDirection(j + 0.5f, i + 0.5f, width, height);
+
+					PrimitiveHit primaryHit;
+					primaryHit.distance = std::numeric_limits<float>::max();
+					primaryHit.primitiveId = findClosestHit(scene, ray, primaryHit.distance);
+					writeFeatures(scene, ray, primaryHit, pixelIndex);
+
+					// Misses are projected as directions, the background is the same from anywhere
+					bool isMiss = primaryHit.primitiveId == noPrimitive;
+					glm::vec3 hitPoint = isMiss ? previousCamera.location + ray.direction : ray.origin + ray.direction * primaryHit.distance;
+					float expectedDepth = glm::distance(hitPoint, previousCamera.location);
+					const glm::vec3& normal = m_features.normal[pixelIndex];
+
+					m_accumilateFrameBuffer[pixelIndex] = glm::vec3(0.0f);
+					m_pixelStatistics[pixelIndex] = PixelStatistics();
+
+					glm::vec2 previousPixel;
+					if (!previousCamera.project(hitPoint, width, height, previousPixel)) {
+						continue;
+					}
+
+					// Bilinear over the four previous pixel centres around the point, skipping the ones that saw a different surface
+					float x = previousPixel.x - 0.5f;
+					float y = previousPixel.y - 0.5f;
+					int x0 = static_cast<int>(glm::floor(x));
+					int y0 = static_cast<int>(glm::floor(y));
+					float fractionX = x - x0;
+					float fractionY = y - y0;
+
+					float totalWeight = 0.0f;
+					float sampleCount = 0.0f;
+					glm::vec3 mean(0.0f);
+					float luminanceMean = 0.0f;
+					float luminanceSquaredMean = 0.0f;
+
+					for (int tap = 0; tap < 4; tap++) {
+						int tapX = x0 + (tap & 1);
+						int tapY = y0 + (tap >> 1);
+						if (tapX < 0 || tapY < 0 || tapX >= width || tapY >= height) {
+							continue;
+						}
+
+						size_t tapIndex = static_cast<size_t>(tapY) * width + tapX;
+						const PixelStatistics& statistics = m_historyStatistics[tapIndex];
+						if (statistics.sampleCount == 0) {
+							continue;
+						}
+
+						float tapDepth = m_historyFeatures.depth[tapIndex];
+						if (isMiss ? tapDepth != 0.0f : tapDepth == 0.0f) {
+							continue;
+						}
+
+						if (!isMiss) {
+							bool isSameDepth = glm::abs(tapDepth - expectedDepth) <= reprojectionDepthTolerance * expectedDepth;
+							bool isSameNormal = glm::dot(m_historyFeatures.normal[tapIndex], normal) >= reprojectionNormalTolerance;
+							if (!isSameDepth || !isSameNormal) {
+								continue;
+							}
+						}
+
+						float weight = ((tap & 1) ? fractionX : 1.0f - fractionX) * ((tap >> 1) ? fractionY : 1.0f - fractionY);
+						float count = static_cast<float>(statistics.sampleCount);
+
+						totalWeight += weight;
+						sampleCount += weight * count;
+						mean += weight / count * m_historyFrameBuffer[tapIndex];
+						luminanceMean += weight / count * statistics.luminanceSum;
+						luminanceSquaredMean += weight / count * statistics.luminanceSquaredSum;
+					}
+
+					// A sliver of a valid pixel is too little to trust
+					if (totalWeight < 0.05f) {
+						continue;
+					}
+
+					float reflectivity = isMiss ? 0.0f : scene.getMaterial(primaryHit.primitiveId).reflectivness;
+					float maximumCount = glm::floor(maximumReprojectedSamples * (1.0f - reflectivity));
+					float count = std::min(glm::floor(sampleCount / totalWeight + 0.5f), maximumCount);
+					if (count < 1.0f) {
+						continue;
+					}
+
+					m_accumilateFrameBuffer[pixelIndex] = mean / totalWeight * count;
+					m_pixelStatistics[pixelIndex].sampleCount = static_cast<std::uint32_t>(count);
+					m_pixelStatistics[pixelIndex].luminanceSum = luminanceMean / totalWeight * count;
+					m_pixelStatistics[pixelIndex].luminanceSquaredSum = luminanceSquaredMean / totalWeight * count;
+					tileReprojectedPixels++;
+				}
+			}
+
+			reprojectedPixelCount += tileReprojectedPixels;
+		});
+
+		m_reprojectedPixelFraction = static_cast<float>(reprojectedPixelCount) / static_cast<float>(pixelCount);
+	}
+
+	void PathTracer::denoise(std::span<glm::vec4> frameBuffer, int width, int height) {
+		if (m_features.depth.size() != static_cast<size_t>(width) * height) {
+			return;
+		}
+
+		ProfileZone zone("Denoise");
+
+		// Resolved again rather than read back from frameBuffer, which may be mapped write only
+		m_resolvedFrameBuffer.resize(m_accumilateFrameBuffer.size());
+		m_tileScheduler.dispatchTiles(width, height, m_tileSize, [&](const Tile& tile) {
+			for (int i = tile.yStart; i < tile.yEnd; i++) {
+				for (int j = tile.xStart; j < tile.xEnd; j++) {
+					int pixelIndex = i * width + j;
+					float sampleCount = static_cast<float>(std::max(1u, m_pixelStatistics[pixelIndex].sampleCount));
+					m_resolvedFrameBuffer[pixelIndex] = glm::vec4(m_accumilateFrameBuffer[pixelIndex] / sampleCount, 1.0f);
+				}
+			}
+		});
+
+		// Follows the instruction set picked for tracing
+		m_denoiser.m_simdLevel = m_simdLevel;
+		m_denoiser.denoise(m_resolvedFrameBuffer, frameBuffer, m_features, width, height, m_tileScheduler, m_tileSize);
+	}
+
+	const FeatureBuffers& PathTracer::getFeatureBuffers() const {
+		return m_features;
+	}
+
+	int PathTracer::getAdaptiveSampleCount(float activePixelFraction) {
+		// Keeps the samples per frame close to one per pixel, capped so a few stubborn pixels cannot stall a frame
+		if (activePixelFraction <= 0.0f) {
+			return 1;
+		}
+
+		return std::clamp(static_cast<int>(std::lround(1.0f / activePixelFraction)), 1, maximumAdaptiveSamples);
+	}
+
+	float PathTracer::getLuminance(const glm::vec3& colour) {
+		return glm::dot(colour, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	void PixelStatistics::addSample(float luminance) {
+		sampleCount++;
+		luminanceSum += luminance;
+		luminanceSquaredSum += luminance * luminance;
+	}
+
+	bool PixelStatistics::isConverged(float threshold) const {
+		if (sampleCount < PathTracer::minimumAdaptiveSamples) {
+			return false;
+		}
+
+		// Standard error of the mean luminance, relative to the mean but floored so near black pixels are not sampled forever
+		float count = static_cast<float>(sampleCount);
+		float mean = luminanceSum / count;
+		float variance = glm::max(0.0f, luminanceSquaredSum / count - mean * mean) * count / (count - 1.0f);
+		float standardError = glm::sqrt(variance / count);
+
+		return standardError <= threshold * glm::max(mean, luminanceFloor);
+	}
+
+	glm::vec3 PathTracer::traceRay(const Scene& scene, Ray& ray, int bounceLimit, const PrimitiveHit* primaryHit, Sampler& sampler) {
+		if (m_samplingMode == SAMPLING_IMPORTANCE) {
+			return traceImportanceSampledRay(scene, ray, bounceLimit, primaryHit, sampler);
+		}
+
+		if (m_samplingMode == SAMPLING_NEXT_EVENT) {
+			return traceNextEventRay(scene, ray, bounceLimit, primaryHit, sampler);
+		}
+
+		glm::vec3 colour(0.0f);
+		glm::vec3 attenuation(1.0f);
+
+		HitSphere hitSphere = HitSphere({ glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f), Material({ { 0.0f, 0.0f, 0.0f } }), glm::vec3(0.0f) });
+
+		for (int t = 0; t < bounceLimit; t++) {
+			float closestIntersection = std::numeric_limits<float>::max();
+			std::uint32_t closestPrimitive = t == 0 && primaryHit != nullptr ? getPrimaryHit(*primaryHit, closestIntersection) : findClosestHit(scene, ray, closestIntersection);
+
+			if (closestPrimitive != noPrimitive) {
+				getHitSurface(scene, ray, closestPrimitive, closestIntersection, hitSphere);
+				hitSphere.hitLight += hitSphere.hitMaterial.emissiveStrength * hitSphere.hitMaterial.emissionColour * attenuation;
+
+				ray.origin = hitSphere.hitPoint + 0.001f * hitSphere.hitNormal;
+
+				sampler.setBounce(t);
+				glm::vec3 randomNum = getRandomOnUnitSphere(sampler.get2D(DIMENSION_BOUNCE));
+				if (glm::dot(randomNum, hitSphere.hitNormal) < 0) {
+					// randomNum and hitNormal are both unit vectors, so this does not need to be normalized
+					randomNum = glm::reflect(randomNum, hitSphere.hitNormal);
+				}
+
+				// Combines the specular and diffuse bounces
+				// Uses Lamberts cosine law for diffuse bounces (favours bounces closer to the normal)
+				ray.direction = glm::normalize((1 - hitSphere.hitMaterial.reflectivness) * glm::normalize(hitSphere.hitNormal + randomNum) + hitSphere.hitMaterial.reflectivness * glm::reflect(ray.direction, hitSphere.hitNormal));
+
+				colour += hitSphere.hitLight * hitSphere.hitColour;
+
+				hitSphere.hitColour *= hitSphere.hitMaterial.materialColour;
+			}
+
+			else {
+				if (t == 0) {
+					return scene.m_background;
+				}
+
+				colour += scene.m_background * hitSphere.hitColour * attenuation;
+				return colour;
+			}
+
+			attenuation *= 0.75f;
+		}
+		return colour;
+	}
+
+	glm::vec3 PathTracer::traceImportanceSampledRay(const Scene& scene, Ray& ray, int bounceLimit, const PrimitiveHit* primaryHit, Sampler& sampler) {
+		glm::vec3 radiance(0.0f);
+		glm::vec3 throughput(1.0f);
+
+		HitSphere hitSurface = HitSphere({ glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f), Material({ { 0.0f, 0.0f, 0.0f } }), glm::vec3(0.0f) });
+
+		for (int t = 0; t < bounceLimit; t++) {
+			float closestIntersection = std::numeric_limits<float>::max();
+			std::uint32_t closestPrimitive = t == 0 && primaryHit != nullptr ? getPrimaryHit(*primaryHit, closestIntersection) : findClosestHit(scene, ray, closestIntersection);
+
+			if (closestPrimitive == noPrimitive) {
+				return radiance + scene.m_background * throughput;
+			}
+
+			getHitSurface(scene, ray, closestPrimitive, closestIntersection, hitSurface);
+			const Material& material = hitSurface.hitMaterial;
+			radiance += throughput * material.emissiveStrength * material.emissionColour;
+			sampler.setBounce(t);
+
+			// The mirror lobe is picked with probability reflectivness, the diffuse lobe otherwise, so each lobe's weight cancels its selection probability
+			// The diffuse lobe is drawn with a cosine distribution, which cancels the Lambertian cos / pi so the path weight is just the albedo
+			ray.origin = hitSurface.hitPoint + 0.001f * hitSurface.hitNormal;
+			if (sampler.get1D(DIMENSION_LOBE) < material.reflectivness) {
+				ray.direction = glm::reflect(ray.direction, hitSurface.hitNormal);
+			}
+
+			else {
+				ray.direction = getCosineWeightedOnHemisphere(hitSurface.hitNormal, sampler.get2D(DIMENSION_BOUNCE));
+			}
+
+			throughput *= material.materialColour;
+
+			// Russian roulette, dim paths are ended early and the survivors are scaled up by the same probability so the estimate stays unbiased
+			if (t + 1 >= rouletteStartBounce) {
+				float survivalProbability = std::min(1.0f, glm::max(glm::max(throughput.x, throughput.y), throughput.z));
+				if (sampler.get1D(DIMENSION_ROULETTE) >= survivalProbability) {
+					return radiance;
+				}
+
+				throughput /= survivalProbability;
+			}
+		}
+		return radiance;
+	}
+
+	glm::vec3 PathTracer::traceNextEventRay(const Scene& scene, Ray& ray, int bounceLimit, const PrimitiveHit* primaryHit, Sampler& sampler) {
+		glm::vec3 radiance(0.0f);
+		glm::vec3 throughput(1.0f);
+
+		HitSphere hitSurface = HitSphere({ glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f), Material({ { 0.0f, 0.0f, 0.0f } }), glm::vec3(0.0f) });
+
+		// Solid angle pdf of the last bounce direction, 0 for camera rays and mirror bounces which light sampling can never reproduce
+		float bouncePdf = 0.0f;
+		glm::vec3 bounceOrigin(0.0f);
+
+		for (int t = 0; t < bounceLimit; t++) {
+			float closestIntersection = std::numeric_limits<float>::max();
+			std::uint32_t closestPrimitive = t == 0 && primaryHit != nullptr ? getPrimaryHit(*primaryHit, closestIntersection) : findClosestHit(scene, ray, closestIntersection);
+
+			if (closestPrimitive == noPrimitive) {
+				return radiance + scene.m_background * throughput;
+			}
+
+			getHitSurface(scene, ray, closestPrimitive, closestIntersection, hitSurface);
+			const Material& material = hitSurface.hitMaterial;
+			sampler.setBounce(t);
+
+			glm::vec3 emission = material.emissiveStrength * material.emissionColour;
+			if (emission != glm::vec3(0.0f)) {
+				// The previous bounce already sampled this light directly, so both estimates are weighted by the power heuristic
+				float misWeight = bouncePdf > 0.0f ? getPowerHeuristic(bouncePdf, getLightPdf(scene, closestPrimitive, bounceOrigin, ray.direction, closestIntersection)) : 1.0f;
+				radiance += throughput * emission * misWeight;
+			}
+
+			// Shaded from whichever side was hit, so triangles are lit on both faces
+			glm::vec3 normal = glm::dot(hitSurface.hitNormal, ray.direction) > 0.0f ? -hitSurface.hitNormal : hitSurface.hitNormal;
+			glm::vec3 incoming = ray.direction;
+			ray.origin = hitSurface.hitPoint + 0.001f * normal;
+
+			// Only the diffuse part can be connected to a light, a mirror only sees it along its reflected ray
+			float diffuseWeight = 1.0f - material.reflectivness;
+			if (diffuseWeight > 0.0f) {
+				radiance += throughput * sampleLight(scene, ray.origin, normal, material.materialColour, diffuseWeight, sampler);
+			}
+
+			if (sampler.get1D(DIMENSION_LOBE) < material.reflectivness) {
+				ray.direction = glm::reflect(incoming, normal);
+				bouncePdf = 0.0f;
+			}
+
+			else {
+				ray.direction = getCosineWeightedOnHemisphere(normal, sampler.get2D(DIMENSION_BOUNCE));
+				bouncePdf = diffuseWeight * glm::dot(ray.direction, normal) / glm::pi<float>();
+				bounceOrigin = ray.origin;
+			}
+
+			// Each lobe is picked with its own weight, so the colour is the whole path weight either way
+			throughput *= material.materialColour;
+
+			if (t + 1 >= rouletteStartBounce) {
+				float survivalProbability = std::min(1.0f, glm::max(glm::max(throughput.x, throughput.y), throughput.z));
+				if (sampler.get1D(DIMENSION_ROULETTE) >= survivalProbability) {
+					return radiance;
+				}
+
+				throughput /= survivalProbability;
+			}
+		}
+		return radiance;
+	}
+
+	glm::vec3 PathTracer::sampleLight(const Scene& scene, const glm::vec3& origin, const glm::vec3& normal, const glm::vec3& diffuseColour, float diffuseWeight, Sampler& sampler) {
+		const std::vector<std::uint32_t>& lights = scene.getLights();
+		if (lights.empty()) {
+			return glm::vec3(0.0f);
+		}
+
+		std::uint32_t light = lights[std::min(static_cast<size_t>(sampler.get1D(DIMENSION_LIGHT_CHOICE) * lights.size()), lights.size() - 1)];
+
+		glm::vec3 direction;
+		float lightPdf;
+		if (!sampleLightDirection(scene, light, origin, sampler.get2D(DIMENSION_LIGHT), direction, lightPdf)) {
+			return glm::vec3(0.0f);
+		}
+
+		float cosine = glm::dot(direction, normal);
+		if (cosine <= 0.0f) {
+			return glm::vec3(0.0f);
+		}
+
+		// The light is visible when it is the first thing the shadow ray hits
+		Ray shadowRay{ origin, direction };
+		float distance = std::numeric_limits<float>::max();
+		if (findClosestHit(scene, shadowRay, distance) != light) {
+			return glm::vec3(0.0f);
+		}
+
+		const Material& lightMaterial = scene.getMaterial(light);
+		float bsdfPdf = diffuseWeight * cosine / glm::pi<float>();
+		glm::vec3 bsdf = diffuseWeight * diffuseColour / glm::pi<float>();
+
+		return lightMaterial.emissiveStrength * lightMaterial.emissionColour * bsdf * cosine / lightPdf * getPowerHeuristic(lightPdf, bsdfPdf);
+	}
+
+	bool PathTracer::sampleLightDirection(const Scene& scene, std::uint32_t light, const glm::vec3& origin, const glm::vec2& sample, glm::vec3& direction, float& pdf) {
+		const std::uint32_t sphereCount = static_cast<std::uint32_t>(scene.m_spheres.size());
+		float lightCount = static_cast<float>(scene.getLights().size());
+
+		if (light < sphereCount) {
+			// Uniform direction inside the cone the sphere covers, which never wastes samples on its far side
+			const Sphere& sphere = scene.m_spheres[light];
+			glm::vec3 toCentre = sphere.centre - origin;
+			float distanceSquared = glm::dot(toCentre, toCentre);
+			float radiusSquared = sphere.radius * sphere.radius;
+
+			if (distanceSquared <= radiusSquared) {
+				return false;
+			}
+
+			// 1 - cos written through sin squared so small, distant spheres do not round the cone away
+			float sinSquared = radiusSquared / distanceSquared;
+			float cosMax = glm::sqrt(1.0f - sinSquared);
+			float oneMinusCosMax = sinSquared / (1.0f + cosMax);
+
+			float cosTheta = 1.0f - sample.x * oneMinusCosMax;
+			float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+			float angle = 2.0f * glm::pi<float>() * sample.y;
+
+			glm::vec3 axis = toCentre / glm::sqrt(distanceSquared);
+			glm::vec3 tangent, bitangent;
+			getOrthonormalBasis(axis, tangent, bitangent);
+
+			direction = glm::normalize(sinTheta * glm::cos(angle) * tangent + sinTheta * glm::sin(angle) * bitangent + cosTheta * axis);
+			pdf = 1.0f / (2.0f * glm::pi<float>() * oneMinusCosMax * lightCount);
+			return true;
+		}
+
+		// Uniform point on the triangle, the area pdf is converted to solid angle at origin
+		const Triangle& triangle = scene.m_triangles[light - sphereCount];
+		const glm::vec3& v0 = scene.m_vertices[triangle.vertexIndices[0]];
+		const glm::vec3& v1 = scene.m_vertices[triangle.vertexIndices[1]];
+		const glm::vec3& v2 = scene.m_vertices[triangle.vertexIndices[2]];
+
+		float squareRoot = glm::sqrt(sample.x);
+		float u = 1.0f - squareRoot;
+		float v = sample.y * squareRoot;
+		glm::vec3 point = v0 + u * (v1 - v0) + v * (v2 - v0);
+
+		glm::vec3 offset = point - origin;
+		float distance = glm::length(offset);
+		if (distance <= 0.0f) {
+			return false;
+		}
+
+		direction = offset / distance;
+		pdf = getLightPdf(scene, light, origin, direction, distance);
+		return pdf > 0.0f;
+	}
+
+	float PathTracer::getLightPdf(const Scene& scene, std::uint32_t light, const glm::vec3& origin, const glm::vec3& direction, float distance) {
+		const std::uint32_t sphereCount = static_cast<std::uint32_t>(scene.m_spheres.size());
+		float lightCount = static_cast<float>(scene.getLights().size());
+
+		if (light < sphereCount) {
+			const Sphere& sphere = scene.m_spheres[light];
+			glm::vec3 toCentre = sphere.centre - origin;
+			float distanceSquared = glm::dot(toCentre, toCentre);
+			float radiusSquared = sphere.radius * sphere.radius;
+
+			if (distanceSquared <= radiusSquared) {
+				return 0.0f;
+			}
+
+			float sinSquared = radiusSquared / distanceSquared;
+			float oneMinusCosMax = sinSquared / (1.0f + glm::sqrt(1.0f - sinSquared));
+			return 1.0f / (2.0f * glm::pi<float>() * oneMinusCosMax * lightCount);
+		}
+
+		const Triangle& triangle = scene.m_triangles[light - sphereCount];
+		const glm::vec3& v0 = scene.m_vertices[triangle.vertexIndices[0]];
+		glm::vec3 areaNormal = glm::cross(scene.m_vertices[triangle.vertexIndices[1]] - v0, scene.m_vertices[triangle.vertexIndices[2]] - v0);
+
+		// areaNormal is twice the triangle's area along its normal, so |dot(areaNormal, direction)| / 2 is the area times the cosine at the light
+		float projectedArea = 0.5f * glm::abs(glm::dot(areaNormal, direction));
+		if (projectedArea <= 0.0f) {
+			return 0.0f;
+		}
+
+		return distance * distance / (projectedArea * lightCount);
+	}
+
+	void PathTracer::writeFeatures(const Scene& scene, const Ray& ray, const PrimitiveHit& primaryHit, size_t pixelIndex) {
+		// Camera rays go through pixel centres, so the first hit is the same every sample
+		if (primaryHit.primitiveId == noPrimitive) {
+			m_features.albedo[pixelIndex] = glm::vec3(1.0f);
+			m_features.normal[pixelIndex] = glm::vec3(0.0f);
+			m_features.depth[pixelIndex] = 0.0f;
+			return;
+		}
+
+		HitSphere hit = HitSphere({ glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f), Material({ { 0.0f, 0.0f, 0.0f } }), glm::vec3(0.0f) });
+		getHitSurface(scene, ray, primaryHit.primitiveId, primaryHit.distance, hit);
+
+		// Lights are kept as they are rather than divided by their albedo
+		bool isEmissive = hit.hitMaterial.emissiveStrength > 0.0f && hit.hitMaterial.emissionColour != glm::vec3(0.0f);
+		m_features.albedo[pixelIndex] = isEmissive ? glm::vec3(1.0f) : hit.hitMaterial.materialColour;
+		m_features.normal[pixelIndex] = glm::dot(hit.hitNormal, ray.direction) > 0.0f ? -hit.hitNormal : hit.hitNormal;
+		m_features.depth[pixelIndex] = primaryHit.distance;
+	}
+
+	std::uint32_t PathTracer::getPrimaryHit(const PrimitiveHit& primaryHit, float& closestIntersection) {
+		closestIntersection = primaryHit.distance;
+		return primaryHit.primitiveId;
+	}
+
+	std::uint32_t PathTracer::findClosestHit(const Scene& scene, const Ray& ray, float& closestIntersection) {
+		const std::uint32_t sphereCount = static_cast<std::uint32_t>(scene.m_spheres.size());
+		const SphereSoA& sphereSoA = scene.getSphereSoA();
+		const std::vector<std::uint32_t>& primitiveIndices = scene.getBVH().getPrimitiveIndices();
+
+		std::uint32_t closestPrimitive = noPrimitive;
+
+		scene.getBVH().traverseLeaves(ray.origin, ray.direction, closestIntersection, [&](const BVHNode& leaf, float& closest) {
+			bool isHit = false;
+
+			// All of the leaf's spheres are tested together from the SoA copy, so no material bytes are touched
+			std::uint32_t sphereBegin, sphereEnd;
+			sphereSoA.getLeafRange(leaf.leftOrFirst, leaf.primitiveCount, sphereBegin, sphereEnd);
+			if (sphereBegin != sphereEnd) {
+				std::uint32_t sphere = m_intersectSphereBlock(sphereSoA, sphereBegin, sphereEnd, ray, closest);
+				if (sphere != noPrimitive) {
+					closestPrimitive = sphere;
+					isHit = true;
+				}
+			}
+
+			// Every primitive of the leaf is a sphere
+			if (sphereEnd - sphereBegin == static_cast<std::uint32_t>(leaf.primitiveCount)) {
+				return isHit;
+			}
+
+			for (std::int32_t i = 0; i < leaf.primitiveCount; i++) {
+				std::uint32_t primitiveId = primitiveIndices[leaf.leftOrFirst + i];
+				float intersection;
+
+				if (primitiveId < sphereCount) {
+					continue;
+				}
+
+				const Triangle& triangle = scene.m_triangles[primitiveId - sphereCount];
+				const glm::vec3& v0 = scene.m_vertices[triangle.vertexIndices[0]];
+				const glm::vec3& v1 = scene.m_vertices[triangle.vertexIndices[1]];
+				const glm::vec3& v2 = scene.m_vertices[triangle.vertexIndices[2]];
+
+				if (isRayIntersectTriangle(ray, v0, v1, v2, intersection) && intersection < closest) {
+					closest = intersection;
+					closestPrimitive = primitiveId;
+					isHit = true;
+				}
+			}
+			return isHit;
+		});
+
+		return closestPrimitive;
+	}
+
+	void PathTracer::getHitSurface(const Scene& scene, const Ray& ray, std::uint32_t primitive, float distance, HitSphere& hit) {
+		const std::uint32_t sphereCount = static_cast<std::uint32_t>(scene.m_spheres.size());
+		hit.hitPoint = ray.origin + ray.direction * distance;
+
+		if (primitive < sphereCount) {
+			const Sphere& sphere = scene.m_spheres[primitive];
+			hit.hitNormal = glm::normalize(hit.hitPoint - sphere.centre);
+			hit.hitMaterial = scene.m_materials[sphere.materialIndex];
+		}
+
+		else {
+			// Matches getShadingNormal in the compute shader
+			const Triangle& triangle = scene.m_triangles[primitive - sphereCount];
+			hit.hitNormal = scene.getShadingNormal(triangle, hit.hitPoint);
+			hit.hitMaterial = scene.m_materials[triangle.materialIndex];
+		}
+	}
+
+	bool PathTracer::isRayIntersectTriangle(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& intersection) {
+		// Moller-Trumbore, solves origin + t * direction = v0 + u * edge0 + v * edge1 for (t, u, v)
+		glm::vec3 edge0 = v1 - v0;
+		glm::vec3 edge1 = v2 - v0;
+
+		glm::vec3 pVector = glm::cross(ray.direction, edge1);
+		float determinant = glm::dot(edge0, pVector);
+
+		// Ray is parallel to the triangle
+		if (glm::abs(determinant) < 1e-8f) {
+			return false;
+		}
+
+		float inverseDeterminant = 1.0f / determinant;
+
+		glm::vec3 tVector = ray.origin - v0;
+		float u = glm::dot(tVector, pVector) * inverseDeterminant;
+		if (u < 0.0f || u > 1.0f) {
+			return false;
+		}
+
+		glm::vec3 qVector = glm::cross(tVector, edge0);
+		float v = glm::dot(ray.direction, qVector) * inverseDeterminant;
+		if (v < 0.0f || u + v > 1.0f) {
+			return false;
+		}
+
+		float t = glm::dot(edge1, qVector) * inverseDeterminant;
+		if (t > 0.001f) {
+			intersection = t;
+			return true;
+		}
+		return false;
+	}
+
+	glm::vec3 PathTracer::getRandomOnUnitSphere(const glm::vec2& sample) {
+		// Archimedes' hat box theorem, a uniform height on the sphere's axis gives a uniform point on its surface
+		float z = 1.0f - 2.0f * sample.x;
+		float radius = glm::sqrt(glm::max(0.0f, 1.0f - z * z));
+		float angle = 2.0f * glm::pi<float>() * sample.y;
+
+		return glm::vec3(radius * glm::cos(angle), radius * glm::sin(angle), z);
+	}
+
+	glm::vec3 PathTracer::getCosineWeightedOnHemisphere(const glm::vec3& normal, const glm::vec2& sample) {
+		// Uniform point on the unit disk projected up onto the hemisphere (Malley's method)
+		float radiusSquared = sample.x;
+		float angle = 2.0f * glm::pi<float>() * sample.y;
+		float radius = glm::sqrt(radiusSquared);
+
+		glm::vec3 tangent, bitangent;
+		getOrthonormalBasis(normal, tangent, bitangent);
+
+		return radius * glm::cos(angle) * tangent + radius * glm::sin(angle) * bitangent + glm::sqrt(glm::max(0.0f, 1.0f - radiusSquared)) * normal;
+	}
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+#include "scene.h"
+#include "tileScheduler.h"
+#include "rayPacket.h"
+#include "denoiser.h"
+#include "sampler.h"
+
+namespace RayTracer {
+	struct HitSphere {
+		glm::vec3 hitPoint;
+		glm::vec3 hitColour;
+		glm::vec3 hitNormal;
+
+		Material hitMaterial;
+
+		glm::vec3 hitLight;
+	};
+
+	// Running luminance sums of one pixel while accumulating, enough for the variance of its mean
+	struct PixelStatistics {
+		std::uint32_t sampleCount = 0;
+		float luminanceSum = 0.0f;
+		float luminanceSquaredSum = 0.0f;
+
+		// Mean luminances below this count as this bright when comparing the error against the threshold
+		static constexpr float luminanceFloor = 0.1f;
+
+		void addSample(float luminance);
+
+		// True once the standard error of the mean is below threshold times the mean, after at least PathTracer::minimumAdaptiveSamples samples
+		bool isConverged(float threshold) const;
+	};
+
+	// How both integrators pick bounce directions, the compute shader uses the same values
+	enum SamplingMode {
+		// Uniform hemisphere directions, every path runs the full bounce limit with a fixed 0.75 falloff per bounce
+		SAMPLING_UNIFORM,
+
+		// Cosine weighted diffuse bounces with Russian roulette termination
+		SAMPLING_IMPORTANCE,
+
+		// SAMPLING_IMPORTANCE plus a shadow ray to a random light at every diffuse bounce, combined with the bounce through multiple importance sampling
+		// Partly reflective materials pick either the mirror or the diffuse lobe per bounce instead of blending the two directions
+		SAMPLING_NEXT_EVENT
+	};
+
+	// CPU integrator, has no windowing or OpenGL dependencies so it can also run headless
+	class PathTracer {
+	public:
+		PathTracer();
+		void init();
+
+		// Traces one sample per pixel into frameBuffer, averaged with every earlier sample of the pixel when accumulating
+		// Rendered from scene.m_camera, a camera that moved since the last render reprojects or restarts the accumulation
+		// A positive adaptiveThreshold stops sampling pixels whose relative error fell below it and spends their samples on the others
+		// The scene's acceleration structure has to be up to date
+		void render(const Scene& scene, std::span<glm::vec4> frameBuffer, int width, int height, int bounceLimit, SamplingMode samplingMode, bool isAccumulating, float adaptiveThreshold);
+
+		// Fraction of pixels that were still sampled in the last render
+		float getActivePixelFraction() const;
+
+		// Fraction of pixels that kept some of their samples the last time the camera moved
+		float getReprojectedPixelFraction() const;
+
+		// Runs m_denoiser over the last render's accumulated colour, guided by its first hits, and writes the result to frameBuffer
+		// frameBuffer is only written, so it can be a write only mapping
+		void denoise(std::span<glm::vec4> frameBuffer, int width, int height);
+		const FeatureBuffers& getFeatureBuffers() const;
+
+		// Samples each active pixel takes per frame when only activePixelFraction of the image is still sampled
+		static int getAdaptiveSampleCount(float activePixelFraction);
+		static float getLuminance(const glm::vec3& colour);
+
+		// Paths shorter than this are never ended by Russian roulette
+		static constexpr int rouletteStartBounce = 3;
+
+		// Adaptive sampling never stops a pixel before it has this many samples, and gives no pixel more than maximumAdaptiveSamples per frame
+		static constexpr std::uint32_t minimumAdaptiveSamples = 16;
+		static constexpr int maximumAdaptiveSamples = 8;
+
+		// Reprojected pixels keep at most this many samples, scaled down by the reflectivity of the surface since reflections move with the camera
+		static constexpr std::uint32_t maximumReprojectedSamples = 64;
+
+		// A previous pixel still shows the same surface when its first hit distance is within this fraction of the expected one and its normal within this cosine
+		static constexpr float reprojectionDepthTolerance = 0.05f;
+		static constexpr float reprojectionNormalTolerance = 0.9f;
+
+	private:
+		// primaryHit skips the first closest hit search when the packet path already found it
+		glm::vec3 traceRay(const Scene& scene, Ray& ray, int bounceLimit, const PrimitiveHit* primaryHit, Sampler& sampler);
+		glm::vec3 traceImportanceSampledRay(const Scene& scene, Ray& ray, int bounceLimit, const PrimitiveHit* primaryHit, Sampler& sampler);
+		glm::vec3 traceNextEventRay(const Scene& scene, Ray& ray, int bounceLimit, const PrimitiveHit* primaryHit, Sampler& sampler);
+
+		// Light arriving at origin from one random light, weighted against the diffuse lobe that would have had to find it by chance
+		glm::vec3 sampleLight(const Scene& scene, const glm::vec3& origin, const glm::vec3& normal, const glm::vec3& diffuseColour, float diffuseWeight, Sampler& sampler);
+
+		// Maps sample to a direction from origin towards light, pdf is per solid angle and includes the chance of picking this light
+		// getLightPdf returns the same pdf for a direction that reaches the light after distance
+		bool sampleLightDirection(const Scene& scene, std::uint32_t light, const glm::vec3& origin, const glm::vec2& sample, glm::vec3& direction, float& pdf);
+		float getLightPdf(const Scene& scene, std::uint32_t light, const glm::vec3& origin, const glm::vec3& direction, float distance);
+
+		void writeFeatures(const Scene& scene, const Ray& ray, const PrimitiveHit& primaryHit, size_t pixelIndex);
+
+		// Resamples the samples accumulated from m_camera at the pixels scene.m_camera now sees the same surfaces through, the rest start again
+		void reproject(const Scene& scene, int width, int height);
+
+		std::uint32_t getPrimaryHit(const PrimitiveHit& primaryHit, float& closestIntersection);
+		std::uint32_t findClosestHit(const Scene& scene, const Ray& ray, float& closestIntersection);
+		void getHitSurface(const Scene& scene, const Ray& ray, std::uint32_t primitive, float distance, HitSphere& hit);
+
+		bool isRayIntersectTriangle(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& closestIntersection);
+		glm::vec3 getRandomOnUnitSphere(const glm::vec2& sample);
+		glm::vec3 getCosineWeightedOnHemisphere(const glm::vec3& normal, const glm::vec2& sample);
+
+	public:
+		// The scheduler restarts its workers when m_threadCount changes
+		int m_threadCount;
+		int m_tileSize;
+
+		// Primary rays are traced in packets of RayPacket::packetSize using the chosen instruction set
+		bool m_usePacketTracing;
+		SIMDLevel m_simdLevel;
+
+		// Sample numbers are indexed by pixel and by the pixel's sample count, or by the frame when not accumulating
+		SamplerType m_samplerType;
+
+		// Moving the camera while accumulating keeps the samples of surfaces that stay in view instead of restarting every pixel
+		bool m_useReprojection;
+
+		Denoiser m_denoiser;
+
+	private:
+		std::vector<glm::vec3> m_accumilateFrameBuffer;
+		std::vector<PixelStatistics> m_pixelStatistics;
+		FeatureBuffers m_features;
+
+		// The accumulated colour divided by each pixel's sample count, the denoiser's input
+		std::vector<glm::vec4> m_resolvedFrameBuffer;
+		float m_activePixelFraction;
+		std::uint32_t m_frameIndex;
+
+		// Camera and size the accumulated samples were rendered with
+		Camera m_camera;
+		int m_width, m_height;
+
+		// Last frame's buffers while reprojecting, kept between moves so they are not reallocated
+		std::vector<glm::vec3> m_historyFrameBuffer;
+		std::vector<PixelStatistics> m_historyStatistics;
+		FeatureBuffers m_historyFeatures;
+		float m_reprojectedPixelFraction;
+
+		// Picked from m_simdLevel and the render arguments at the start of every render
+		SphereBlockFunction m_intersectSphereBlock;
+		SamplingMode m_samplingMode;
+		TileScheduler m_tileScheduler;
+	};
+}
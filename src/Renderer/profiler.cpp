@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#include "profiler.h"
+#include "simd.h"
+
+#if defined(RAYTRACER_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(RAYTRACER_X86)
+#include <x86intrin.h>
+#endif
+
+namespace RayTracer {
+	namespace {
+		double getSteadyMicroseconds() {
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// The time stamp counter runs at a constant rate on every core of a current x86 CPU and costs a few nanoseconds to read
+		std::uint64_t readTimestamp() {
+#if defined(RAYTRACER_X86)
+			return __rdtsc();
+#else
+			return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+		}
+
+		// Zone names are string literals, only quotes and backslashes need escaping
+		void writeJSONString(std::ofstream& file, const char* text) {
+			file << '"';
+			for (const char* c = text; *c != '\0'; c++) {
+				if (*c == '"' || *c == '\\') {
+					file << '\\';
+				}
+				file << *c;
+			}
+			file << '"';
+		}
+
+		constexpr int calibrationZoneCount = 1024;
+	}
+
+	Profiler& Profiler::get() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	Profiler::Profiler() {
+		m_overheadBudget = 0.01f;
+		m_isRecording = false;
+		m_generation = 0;
+		m_startTicks = 0;
+		m_stopTicks = 0;
+		m_startMicroseconds = 0.0;
+		m_stopMicroseconds = 0.0;
+		m_zoneCost = 1;
+	}
+
+	void Profiler::start() {
+		// Times recording zones on this thread, the calibration zones go with the previous recording
+		ThreadBuffer& calibrationBuffer = getThreadBuffer();
+		std::uint64_t calibrationStart = readTimestamp();
+		for (int i = 0; i < calibrationZoneCount; i++) {
+			std::uint64_t begin = readTimestamp();
+			record(calibrationBuffer, "Calibration", begin, readTimestamp());
+		}
+		m_zoneCost.store(std::max<std::uint64_t>(1, (readTimestamp() - calibrationStart) / calibrationZoneCount), std::memory_order_relaxed);
+
+		// Threads may be recording, so each one empties its own buffer once it sees the new generation
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_startMicroseconds = getSteadyMicroseconds();
+		m_startTicks.store(readTimestamp(), std::memory_order_relaxed);
+		m_generation.fetch_add(1, std::memory_order_release);
+		m_isRecording.store(true, std::memory_order_release);
+	}
+
+	void Profiler::stop() {
+		// This thread's zones cannot end while it waits here
+		ThreadBuffer& ownBuffer = getThreadBuffer();
+
+		// Held throughout, so a writeChromeTrace on another thread reads the stop time only once every zone has ended
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_isRecording.exchange(false)) {
+			return;
+		}
+
+		waitForOpenZones(ownBuffer);
+		m_stopMicroseconds = getSteadyMicroseconds();
+		m_stopTicks = readTimestamp();
+	}
+
+	bool Profiler::isRecording() const {
+		return m_isRecording.load(std::memory_order_relaxed);
+	}
+
+	bool Profiler::writeChromeTrace(const char* path) {
+		stop();
+
+		std::ofstream file(path);
+		if (!file) {
+			return false;
+		}
+
+		// Zones the thread that stopped recording still had open may have ended since, on that thread
+		ThreadBuffer& ownBuffer = getThreadBuffer();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		waitForOpenZones(ownBuffer);
+
+		std::uint64_t startTicks = m_startTicks.load(std::memory_order_relaxed);
+		double elapsedMicroseconds = std::max(m_stopMicroseconds - m_startMicroseconds, 1.0);
+		double ticksPerMicrosecond = std::max(static_cast<double>(m_stopTicks - startTicks), 1.0) / elapsedMicroseconds;
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		file.setf(std::ios::fixed);
+		file.precision(3);
+
+		bool isFirstEvent = true;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : m_threadBuffers) {
+			if (!isCurrent(*buffer)) {
+				continue;
+			}
+
+			std::uint64_t eventCount = buffer->eventCount.load(std::memory_order_acquire);
+			if (eventCount == 0) {
+				continue;
+			}
+
+			file << (isFirstEvent ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->threadIndex
+				<< ",\"args\":{\"name\":\"Thread " << buffer->threadIndex << "\"}}";
+			isFirstEvent = false;
+
+			// Oldest kept event first, zones still open at start or closed after stop are left out
+			for (std::uint64_t i = eventCount - std::min<std::uint64_t>(eventCount, eventCapacity); i < eventCount; i++) {
+				const Event& event = buffer->events[i % eventCapacity];
+				if (event.begin < startTicks || event.end > m_stopTicks) {
+					continue;
+				}
+
+				file << ",\n{\"name\":";
+				writeJSONString(file, event.name);
+				file << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadIndex
+					<< ",\"ts\":" << (event.begin - startTicks) / ticksPerMicrosecond
+					<< ",\"dur\":" << (event.end - event.begin) / ticksPerMicrosecond << "}";
+			}
+		}
+
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+
+	size_t Profiler::getDroppedZoneCount() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t droppedZoneCount = 0;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : m_threadBuffers) {
+			if (isCurrent(*buffer)) {
+				droppedZoneCount += buffer->droppedZoneCount.load(std::memory_order_relaxed);
+			}
+		}
+		return droppedZoneCount;
+	}
+
+	size_t Profiler::getOverwrittenZoneCount() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t overwrittenZoneCount = 0;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : m_threadBuffers) {
+			if (!isCurrent(*buffer)) {
+				continue;
+			}
+
+			std::uint64_t eventCount = buffer->eventCount.load(std::memory_order_acquire);
+			overwrittenZoneCount += eventCount > eventCapacity ? eventCount - eventCapacity : 0;
+		}
+		return overwrittenZoneCount;
+	}
+
+	Profiler::ThreadBuffer& Profiler::getThreadBuffer() {
+		// Buffers are never freed, so one outlives its thread and the pointer stays valid across recordings
+		thread_local ThreadBuffer* threadBuffer = nullptr;
+		if (threadBuffer) {
+			// The counts are cleared before the new generation is published, so a getter that sees it sees them empty
+			std::uint64_t generation = m_generation.load(std::memory_order_acquire);
+			if (threadBuffer->generation.load(std::memory_order_relaxed) != generation) {
+				threadBuffer->eventCount.store(0, std::memory_order_relaxed);
+				threadBuffer->fineZoneCount.store(0, std::memory_order_relaxed);
+				threadBuffer->droppedZoneCount.store(0, std::memory_order_relaxed);
+				threadBuffer->generation.store(generation, std::memory_order_release);
+			}
+			return *threadBuffer;
+		}
+
+		std::unique_ptr<ThreadBuffer> buffer = std::make_unique<ThreadBuffer>();
+		buffer->events = std::make_unique<Event[]>(eventCapacity);
+		buffer->eventCount = 0;
+		buffer->fineZoneCount = 0;
+		buffer->droppedZoneCount = 0;
+		buffer->openZoneCount = 0;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		buffer->generation = m_generation.load(std::memory_order_relaxed);
+		buffer->threadIndex = static_cast<int>(m_threadBuffers.size());
+		threadBuffer = buffer.get();
+		m_threadBuffers.push_back(std::move(buffer));
+		return *threadBuffer;
+	}
+
+	void Profiler::waitForOpenZones(const ThreadBuffer& ownBuffer) const {
+		// A zone counts itself open before checking m_isRecording again, so once that is false every zone either sees it or is waited for here
+		for (const std::unique_ptr<ThreadBuffer>& buffer : m_threadBuffers) {
+			if (buffer.get() == &ownBuffer) {
+				continue;
+			}
+
+			while (buffer->openZoneCount.load() != 0) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	bool Profiler::isCurrent(const ThreadBuffer& buffer) const {
+		return buffer.generation.load(std::memory_order_acquire) == m_generation.load(std::memory_order_relaxed);
+	}
+
+	bool Profiler::isFineZoneAffordable(ThreadBuffer& buffer, std::uint64_t now) const {
+		// Fine zones so far plus this one, against the budgeted share of the time since start
+		std::uint64_t startTicks = m_startTicks.load(std::memory_order_relaxed);
+		double budget = static_cast<double>(m_overheadBudget) * static_cast<double>(now - std::min(now, startTicks));
+		return static_cast<double>((buffer.fineZoneCount.load(std::memory_order_relaxed) + 1) * m_zoneCost.load(std::memory_order_relaxed)) <= budget;
+	}
+
+	void Profiler::record(ThreadBuffer& buffer, const char* name, std::uint64_t begin, std::uint64_t end) {
+		// Only this thread writes the buffer, the release publishes the event to writeChromeTrace
+		std::uint64_t index = buffer.eventCount.load(std::memory_order_relaxed);
+		buffer.events[index % eventCapacity] = { name, begin, end };
+		buffer.eventCount.store(index + 1, std::memory_order_release);
+	}
+
+	ProfileZone::ProfileZone(const char* name, ProfileDetail detail) {
+		m_name = name;
+		m_begin = 0;
+		m_isRecorded = false;
+
+		Profiler& profiler = Profiler::get();
+		if (!profiler.isRecording()) {
+			return;
+		}
+
+		// Checked again once counted as open, so stop() either waits for this zone or this zone sees it stopped
+		Profiler::ThreadBuffer& buffer = profiler.getThreadBuffer();
+		buffer.openZoneCount.fetch_add(1);
+		if (!profiler.m_isRecording.load()) {
+			buffer.openZoneCount.fetch_sub(1, std::memory_order_relaxed);
+			return;
+		}
+
+		m_begin = readTimestamp();
+
+		if (detail == PROFILE_FINE) {
+			// Only this thread writes its counts, so a load and store is enough
+			if (!profiler.isFineZoneAffordable(buffer, m_begin)) {
+				buffer.droppedZoneCount.store(buffer.droppedZoneCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				buffer.openZoneCount.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+			buffer.fineZoneCount.store(buffer.fineZoneCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		m_isRecorded = true;
+	}
+
+	ProfileZone::~ProfileZone() {
+		if (m_isRecorded) {
+			Profiler& profiler = Profiler::get();
+			Profiler::ThreadBuffer& buffer = profiler.getThreadBuffer();
+			profiler.record(buffer, m_name, m_begin, readTimestamp());
+
+			// Releases the event to a stop() waiting on another thread
+			buffer.openZoneCount.fetch_sub(1, std::memory_order_release);
+		}
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace RayTracer {
+	// Zones that run once or a few times a frame are always recorded
+	// Fine zones run per tile and are dropped once recording them would cost more than Profiler::m_overheadBudget of the thread's time
+	enum ProfileDetail {
+		PROFILE_COARSE,
+		PROFILE_FINE
+	};
+
+	// Scoped CPU zones, recorded per thread into a ring buffer and written out as a Chrome trace_event file
+	// Zones nest on each thread, so a trace shows e.g. the tiles of a frame under the render that dispatched them
+	// Timestamps are the CPU's time stamp counter where there is one, converted to microseconds against the steady clock on export
+	class Profiler {
+	public:
+		static Profiler& get();
+
+		// Forgets every recorded zone and starts recording
+		void start();
+
+		// Waits for the zones other threads opened while recording to end, so their buffers are no longer written
+		// Zones still open on the calling thread end after stop and are left out of the trace
+		void stop();
+		bool isRecording() const;
+
+		// Stops recording first, returns false if the file could not be written
+		bool writeChromeTrace(const char* path);
+
+		// Fine zones skipped to keep within m_overheadBudget, and zones overwritten because a thread's ring buffer wrapped, since start
+		size_t getDroppedZoneCount() const;
+		size_t getOverwrittenZoneCount() const;
+
+		// Zones kept per thread, the oldest are overwritten after that
+		static constexpr size_t eventCapacity = 1 << 16;
+
+	private:
+		struct Event {
+			const char* name;
+			std::uint64_t begin;
+			std::uint64_t end;
+		};
+
+		// Only the owning thread writes a buffer, the atomics let the getters read it while that thread records
+		struct ThreadBuffer {
+			std::unique_ptr<Event[]> events;
+			std::atomic<std::uint64_t> eventCount;
+
+			// Fine zones recorded and dropped since start
+			std::atomic<std::uint64_t> fineZoneCount;
+			std::atomic<std::uint64_t> droppedZoneCount;
+
+			// Recording the counts belong to, a buffer from an earlier one is emptied by its thread on next use
+			std::atomic<std::uint64_t> generation;
+			int threadIndex;
+
+			// Recorded zones that have begun but not ended, kept across recordings since a zone can outlive the one it began in
+			std::atomic<std::uint32_t> openZoneCount;
+		};
+
+		Profiler();
+
+		// This thread's buffer, emptied first if it still holds an earlier recording's zones
+		ThreadBuffer& getThreadBuffer();
+		bool isCurrent(const ThreadBuffer& buffer) const;
+
+		// Spins until every other thread has ended its recorded zones, the calling thread's own cannot end meanwhile
+		void waitForOpenZones(const ThreadBuffer& ownBuffer) const;
+		bool isFineZoneAffordable(ThreadBuffer& buffer, std::uint64_t now) const;
+		void record(ThreadBuffer& buffer, const char* name, std::uint64_t begin, std::uint64_t end);
+
+		friend class ProfileZone;
+
+	public:
+		// Fraction of a thread's time that fine zones may cost
+		float m_overheadBudget;
+
+	private:
+		std::atomic<bool> m_isRecording;
+		mutable std::mutex m_mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> m_threadBuffers;
+
+		// Bumped by start(), threads reset their own buffers when they see it change
+		std::atomic<std::uint64_t> m_generation;
+
+		// Time stamp counter and steady clock read together at start and stop, which gives the counter's rate
+		// Zones read the start ticks and zone cost while start() may be writing them, the rest is only touched under m_mutex
+		std::atomic<std::uint64_t> m_startTicks;
+		std::uint64_t m_stopTicks;
+		double m_startMicroseconds, m_stopMicroseconds;
+
+		// Measured cost of one zone in counter ticks
+		std::atomic<std::uint64_t> m_zoneCost;
+	};
+
+	// Records the time from construction to destruction under name, which has to outlive the recording, e.g. a string literal
+	// Costs one relaxed atomic load while the profiler is not recording
+	class ProfileZone {
+	public:
+		ProfileZone(const char* name, ProfileDetail detail = PROFILE_COARSE);
+		~ProfileZone();
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+
+	private:
+		const char* m_name;
+		std::uint64_t m_begin;
+		bool m_isRecorded;
+	};
+}
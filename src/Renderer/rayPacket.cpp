@@ -0,0 +1,468 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "rayPacket.h"
+
+namespace RayTracer {
+	namespace {
+		constexpr float hitEpsilon = 0.001f;
+		constexpr float parallelEpsilon = 1e-8f;
+
+		// The scalar kernels mirror the single ray sphere and triangle tests operation for operation, so all levels agree
+		void intersectSphereScalar(RayPacket& packet, const Sphere& sphere, std::uint32_t primitiveId) {
+			float radiusSquared = sphere.radius * sphere.radius;
+
+			for (int i = 0; i < RayPacket::packetSize; i++) {
+				float offsetX = packet.originX[i] - sphere.centre.x;
+				float offsetY = packet.originY[i] - sphere.centre.y;
+				float offsetZ = packet.originZ[i] - sphere.centre.z;
+
+				float bTerm = offsetX * packet.directionX[i] + offsetY * packet.directionY[i] + offsetZ * packet.directionZ[i];
+				float cTerm = offsetX * offsetX + offsetY * offsetY + offsetZ * offsetZ - radiusSquared;
+
+				float determinant = bTerm * bTerm - cTerm;
+				if (determinant < 0.0f) {
+					continue;
+				}
+
+				float determinantSqrt = std::sqrt(determinant);
+				float term0 = -bTerm - determinantSqrt;
+				float term1 = -bTerm + determinantSqrt;
+				float intersection = term0 > hitEpsilon ? term0 : term1;
+
+				if (intersection > hitEpsilon && intersection < packet.closest[i]) {
+					packet.closest[i] = intersection;
+					packet.primitiveId[i] = primitiveId;
+				}
+			}
+		}
+
+		void intersectTriangleScalar(RayPacket& packet, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, std::uint32_t primitiveId) {
+			glm::vec3 edge0 = v1 - v0;
+			glm::vec3 edge1 = v2 - v0;
+
+			for (int i = 0; i < RayPacket::packetSize; i++) {
+				glm::vec3 direction(packet.directionX[i], packet.directionY[i], packet.directionZ[i]);
+				glm::vec3 pVector = glm::cross(direction, edge1);
+				float determinant = glm::dot(edge0, pVector);
+
+				if (std::abs(determinant) < parallelEpsilon) {
+					continue;
+				}
+
+				float inverseDeterminant = 1.0f / determinant;
+
+				glm::vec3 tVector = glm::vec3(packet.originX[i], packet.originY[i], packet.originZ[i]) - v0;
+				float u = glm::dot(tVector, pVector) * inverseDeterminant;
+				if (u < 0.0f || u > 1.0f) {
+					continue;
+				}
+
+				glm::vec3 qVector = glm::cross(tVector, edge0);
+				float v = glm::dot(direction, qVector) * inverseDeterminant;
+				if (v < 0.0f || u + v > 1.0f) {
+					continue;
+				}
+
+				float intersection = glm::dot(edge1, qVector) * inverseDeterminant;
+				if (intersection > hitEpsilon && intersection < packet.closest[i]) {
+					packet.closest[i] = intersection;
+					packet.primitiveId[i] = primitiveId;
+				}
+			}
+		}
+
+		std::uint32_t intersectAABBScalar(const RayPacket& packet, const BVHNode& node, float& nearestEntry) {
+			std::uint32_t mask = 0;
+			nearestEntry = std::numeric_limits<float>::max();
+
+			for (int i = 0; i < RayPacket::packetSize; i++) {
+				float t0X = (node.boundsMin.x - packet.originX[i]) * packet.inverseDirectionX[i];
+				float t0Y = (node.boundsMin.y - packet.originY[i]) * packet.inverseDirectionY[i];
+				float t0Z = (node.boundsMin.z - packet.originZ[i]) * packet.inverseDirectionZ[i];
+				float t1X = (node.boundsMax.x - packet.originX[i]) * packet.inverseDirectionX[i];
+				float t1Y = (node.boundsMax.y - packet.originY[i]) * packet.inverseDirectionY[i];
+				float t1Z = (node.boundsMax.z - packet.originZ[i]) * packet.inverseDirectionZ[i];
+
+				float tNear = std::max(std::max(std::min(t0X, t1X), std::min(t0Y, t1Y)), std::min(t0Z, t1Z));
+				float tFar = std::min(std::min(std::max(t0X, t1X), std::max(t0Y, t1Y)), std::max(t0Z, t1Z));
+
+				if (tFar >= tNear && tFar > 0.0f && tNear < packet.closest[i]) {
+					mask |= 1u << i;
+					nearestEntry = std::min(nearestEntry, tNear);
+				}
+			}
+
+			return mask & packet.activeMask;
+		}
+
+#if defined(RAYTRACER_X86)
+		// The SSE kernels run the packet as two halves of four lanes
+		RAYTRACER_TARGET_SSE42 void intersectSphereSSE(RayPacket& packet, const Sphere& sphere, std::uint32_t primitiveId) {
+			const __m128 centreX = _mm_set1_ps(sphere.centre.x);
+			const __m128 centreY = _mm_set1_ps(sphere.centre.y);
+			const __m128 centreZ = _mm_set1_ps(sphere.centre.z);
+			const __m128 radiusSquared = _mm_set1_ps(sphere.radius * sphere.radius);
+			const __m128 epsilon = _mm_set1_ps(hitEpsilon);
+			const __m128 id = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(primitiveId)));
+
+			for (int i = 0; i < RayPacket::packetSize; i += 4) {
+				__m128 offsetX = _mm_sub_ps(_mm_load_ps(packet.originX + i), centreX);
+				__m128 offsetY = _mm_sub_ps(_mm_load_ps(packet.originY + i), centreY);
+				__m128 offsetZ = _mm_sub_ps(_mm_load_ps(packet.originZ + i), centreZ);
+
+				__m128 bTerm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(offsetX, _mm_load_ps(packet.directionX + i)), _mm_mul_ps(offsetY, _mm_load_ps(packet.directionY + i))), _mm_mul_ps(offsetZ, _mm_load_ps(packet.directionZ + i)));
+				__m128 cTerm = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(offsetX, offsetX), _mm_mul_ps(offsetY, offsetY)), _mm_mul_ps(offsetZ, offsetZ)), radiusSquared);
+
+				__m128 determinant = _mm_sub_ps(_mm_mul_ps(bTerm, bTerm), cTerm);
+				__m128 isHit = _mm_cmpge_ps(determinant, _mm_setzero_ps());
+
+				__m128 determinantSqrt = _mm_sqrt_ps(_mm_max_ps(determinant, _mm_setzero_ps()));
+				__m128 negativeB = _mm_sub_ps(_mm_setzero_ps(), bTerm);
+				__m128 term0 = _mm_sub_ps(negativeB, determinantSqrt);
+				__m128 term1 = _mm_add_ps(negativeB, determinantSqrt);
+				__m128 intersection = _mm_blendv_ps(term1, term0, _mm_cmpgt_ps(term0, epsilon));
+
+				__m128 closest = _mm_load_ps(packet.closest + i);
+				isHit = _mm_and_ps(isHit, _mm_and_ps(_mm_cmpgt_ps(intersection, epsilon), _mm_cmplt_ps(intersection, closest)));
+
+				_mm_store_ps(packet.closest + i, _mm_blendv_ps(closest, intersection, isHit));
+				float* primitiveIds = reinterpret_cast<float*>(packet.primitiveId + i);
+				_mm_store_ps(primitiveIds, _mm_blendv_ps(_mm_load_ps(primitiveIds), id, isHit));
+			}
+		}
+
+		RAYTRACER_TARGET_SSE42 void intersectTriangleSSE(RayPacket& packet, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, std::uint32_t primitiveId) {
+			glm::vec3 edge0 = v1 - v0;
+			glm::vec3 edge1 = v2 - v0;
+
+			const __m128 edge0X = _mm_set1_ps(edge0.x), edge0Y = _mm_set1_ps(edge0.y), edge0Z = _mm_set1_ps(edge0.z);
+			const __m128 edge1X = _mm_set1_ps(edge1.x), edge1Y = _mm_set1_ps(edge1.y), edge1Z = _mm_set1_ps(edge1.z);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 signMask = _mm_set1_ps(-0.0f);
+			const __m128 id = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(primitiveId)));
+
+			for (int i = 0; i < RayPacket::packetSize; i += 4) {
+				__m128 directionX = _mm_load_ps(packet.directionX + i);
+				__m128 directionY = _mm_load_ps(packet.directionY + i);
+				__m128 directionZ = _mm_load_ps(packet.directionZ + i);
+
+				__m128 pX = _mm_sub_ps(_mm_mul_ps(directionY, edge1Z), _mm_mul_ps(edge1Y, directionZ));
+				__m128 pY = _mm_sub_ps(_mm_mul_ps(directionZ, edge1X), _mm_mul_ps(edge1Z, directionX));
+				__m128 pZ = _mm_sub_ps(_mm_mul_ps(directionX, edge1Y), _mm_mul_ps(edge1X, directionY));
+
+				__m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge0X, pX), _mm_mul_ps(edge0Y, pY)), _mm_mul_ps(edge0Z, pZ));
+				__m128 isHit = _mm_cmpge_ps(_mm_andnot_ps(signMask, determinant), _mm_set1_ps(parallelEpsilon));
+				__m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+				__m128 tX = _mm_sub_ps(_mm_load_ps(packet.originX + i), _mm_set1_ps(v0.x));
+				__m128 tY = _mm_sub_ps(_mm_load_ps(packet.originY + i), _mm_set1_ps(v0.y));
+				__m128 tZ = _mm_sub_ps(_mm_load_ps(packet.originZ + i), _mm_set1_ps(v0.z));
+
+				__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tX, pX), _mm_mul_ps(tY, pY)), _mm_mul_ps(tZ, pZ)), inverseDeterminant);
+				isHit = _mm_and_ps(isHit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+				__m128 qX = _mm_sub_ps(_mm_mul_ps(tY, edge0Z), _mm_mul_ps(edge0Y, tZ));
+				__m128 qY = _mm_sub_ps(_mm_mul_ps(tZ, edge0X), _mm_mul_ps(edge0Z, tX));
+				__m128 qZ = _mm_sub_ps(_mm_mul_ps(tX, edge0Y), _mm_mul_ps(edge0X, tY));
+
+				__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ)), inverseDeterminant);
+				isHit = _mm_and_ps(isHit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+
+				__m128 intersection = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, qX), _mm_mul_ps(edge1Y, qY)), _mm_mul_ps(edge1Z, qZ)), inverseDeterminant);
+				__m128 closest = _mm_load_ps(packet.closest + i);
+				isHit = _mm_and_ps(isHit, _mm_and_ps(_mm_cmpgt_ps(intersection, _mm_set1_ps(hitEpsilon)), _mm_cmplt_ps(intersection, closest)));
+
+				_mm_store_ps(packet.closest + i, _mm_blendv_ps(closest, intersection, isHit));
+				float* primitiveIds = reinterpret_cast<float*>(packet.primitiveId + i);
+				_mm_store_ps(primitiveIds, _mm_blendv_ps(_mm_load_ps(primitiveIds), id, isHit));
+			}
+		}
+
+		RAYTRACER_TARGET_SSE42 std::uint32_t intersectAABBSSE(const RayPacket& packet, const BVHNode& node, float& nearestEntry) {
+			std::uint32_t mask = 0;
+			__m128 nearest = _mm_set1_ps(std::numeric_limits<float>::max());
+
+			for (int i = 0; i < RayPacket::packetSize; i += 4) {
+				__m128 originX = _mm_load_ps(packet.originX + i);
+				__m128 originY = _mm_load_ps(packet.originY + i);
+				__m128 originZ = _mm_load_ps(packet.originZ + i);
+				__m128 inverseX = _mm_load_ps(packet.inverseDirectionX + i);
+				__m128 inverseY = _mm_load_ps(packet.inverseDirectionY + i);
+				__m128 inverseZ = _mm_load_ps(packet.inverseDirectionZ + i);
+
+				__m128 t0X = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), originX), inverseX);
+				__m128 t0Y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), originY), inverseY);
+				__m128 t0Z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), originZ), inverseZ);
+				__m128 t1X = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), originX), inverseX);
+				__m128 t1Y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), originY), inverseY);
+				__m128 t1Z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), originZ), inverseZ);
+
+				__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0X, t1X), _mm_min_ps(t0Y, t1Y)), _mm_min_ps(t0Z, t1Z));
+				__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0X, t1X), _mm_max_ps(t0Y, t1Y)), _mm_max_ps(t0Z, t1Z));
+
+				__m128 isHit = _mm_and_ps(_mm_cmpge_ps(tFar, tNear), _mm_cmpgt_ps(tFar, _mm_setzero_ps()));
+				isHit = _mm_and_ps(isHit, _mm_cmplt_ps(tNear, _mm_load_ps(packet.closest + i)));
+
+				mask |= static_cast<std::uint32_t>(_mm_movemask_ps(isHit)) << i;
+				nearest = _mm_min_ps(nearest, _mm_blendv_ps(_mm_set1_ps(std::numeric_limits<float>::max()), tNear, isHit));
+			}
+
+			mask &= packet.activeMask;
+
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, nearest);
+			nearestEntry = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+			return mask;
+		}
+
+		// The AVX2 kernels cover the whole packet in one register
+		RAYTRACER_TARGET_AVX2 void intersectSphereAVX2(RayPacket& packet, const Sphere& sphere, std::uint32_t primitiveId) {
+			const __m256 epsilon = _mm256_set1_ps(hitEpsilon);
+
+			__m256 offsetX = _mm256_sub_ps(_mm256_load_ps(packet.originX), _mm256_set1_ps(sphere.centre.x));
+			__m256 offsetY = _mm256_sub_ps(_mm256_load_ps(packet.originY), _mm256_set1_ps(sphere.centre.y));
+			__m256 offsetZ = _mm256_sub_ps(_mm256_load_ps(packet.originZ), _mm256_set1_ps(sphere.centre.z));
+
+			__m256 bTerm = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(offsetX, _mm256_load_ps(packet.directionX)), _mm256_mul_ps(offsetY, _mm256_load_ps(packet.directionY))), _mm256_mul_ps(offsetZ, _mm256_load_ps(packet.directionZ)));
+			__m256 cTerm = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(offsetX, offsetX), _mm256_mul_ps(offsetY, offsetY)), _mm256_mul_ps(offsetZ, offsetZ)), _mm256_set1_ps(sphere.radius * sphere.radius));
+
+			__m256 determinant = _mm256_sub_ps(_mm256_mul_ps(bTerm, bTerm), cTerm);
+			__m256 isHit = _mm256_cmp_ps(determinant, _mm256_setzero_ps(), _CMP_GE_OQ);
+
+			__m256 determinantSqrt = _mm256_sqrt_ps(_mm256_max_ps(determinant, _mm256_setzero_ps()));
+			__m256 negativeB = _mm256_sub_ps(_mm256_setzero_ps(), bTerm);
+			__m256 term0 = _mm256_sub_ps(negativeB, determinantSqrt);
+			__m256 term1 = _mm256_add_ps(negativeB, determinantSqrt);
+			__m256 intersection = _mm256_blendv_ps(term1, term0, _mm256_cmp_ps(term0, epsilon, _CMP_GT_OQ));
+
+			__m256 closest = _mm256_load_ps(packet.closest);
+			isHit = _mm256_and_ps(isHit, _mm256_and_ps(_mm256_cmp_ps(intersection, epsilon, _CMP_GT_OQ), _mm256_cmp_ps(intersection, closest, _CMP_LT_OQ)));
+
+			_mm256_store_ps(packet.closest, _mm256_blendv_ps(closest, intersection, isHit));
+			__m256i primitiveIds = _mm256_load_si256(reinterpret_cast<const __m256i*>(packet.primitiveId));
+			primitiveIds = _mm256_blendv_epi8(primitiveIds, _mm256_set1_epi32(static_cast<int>(primitiveId)), _mm256_castps_si256(isHit));
+			_mm256_store_si256(reinterpret_cast<__m256i*>(packet.primitiveId), primitiveIds);
+		}
+
+		RAYTRACER_TARGET_AVX2 void intersectTriangleAVX2(RayPacket& packet, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, std::uint32_t primitiveId) {
+			glm::vec3 edge0 = v1 - v0;
+			glm::vec3 edge1 = v2 - v0;
+
+			const __m256 edge0X = _mm256_set1_ps(edge0.x), edge0Y = _mm256_set1_ps(edge0.y), edge0Z = _mm256_set1_ps(edge0.z);
+			const __m256 edge1X = _mm256_set1_ps(edge1.x), edge1Y = _mm256_set1_ps(edge1.y), edge1Z = _mm256_set1_ps(edge1.z);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+
+			__m256 directionX = _mm256_load_ps(packet.directionX);
+			__m256 directionY = _mm256_load_ps(packet.directionY);
+			__m256 directionZ = _mm256_load_ps(packet.directionZ);
+
+			__m256 pX = _mm256_sub_ps(_mm256_mul_ps(directionY, edge1Z), _mm256_mul_ps(edge1Y, directionZ));
+			__m256 pY = _mm256_sub_ps(_mm256_mul_ps(directionZ, edge1X), _mm256_mul_ps(edge1Z, directionX));
+			__m256 pZ = _mm256_sub_ps(_mm256_mul_ps(directionX, edge1Y), _mm256_mul_ps(edge1X, directionY));
+
+			__m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge0X, pX), _mm256_mul_ps(edge0Y, pY)), _mm256_mul_ps(edge0Z, pZ));
+			__m256 isHit = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), determinant), _mm256_set1_ps(parallelEpsilon), _CMP_GE_OQ);
+			__m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+
+			__m256 tX = _mm256_sub_ps(_mm256_load_ps(packet.originX), _mm256_set1_ps(v0.x));
+			__m256 tY = _mm256_sub_ps(_mm256_load_ps(packet.originY), _mm256_set1_ps(v0.y));
+			__m256 tZ = _mm256_sub_ps(_mm256_load_ps(packet.originZ), _mm256_set1_ps(v0.z));
+
+			__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tX, pX), _mm256_mul_ps(tY, pY)), _mm256_mul_ps(tZ, pZ)), inverseDeterminant);
+			isHit = _mm256_and_ps(isHit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+			__m256 qX = _mm256_sub_ps(_mm256_mul_ps(tY, edge0Z), _mm256_mul_ps(edge0Y, tZ));
+			__m256 qY = _mm256_sub_ps(_mm256_mul_ps(tZ, edge0X), _mm256_mul_ps(edge0Z, tX));
+			__m256 qZ = _mm256_sub_ps(_mm256_mul_ps(tX, edge0Y), _mm256_mul_ps(edge0X, tY));
+
+			__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(directionX, qX), _mm256_mul_ps(directionY, qY)), _mm256_mul_ps(directionZ, qZ)), inverseDeterminant);
+			isHit = _mm256_and_ps(isHit, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+			__m256 intersection = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge1X, qX), _mm256_mul_ps(edge1Y, qY)), _mm256_mul_ps(edge1Z, qZ)), inverseDeterminant);
+			__m256 closest = _mm256_load_ps(packet.closest);
+			isHit = _mm256_and_ps(isHit, _mm256_and_ps(_mm256_cmp_ps(intersection, _mm256_set1_ps(hitEpsilon), _CMP_GT_OQ), _mm256_cmp_ps(intersection, closest, _CMP_LT_OQ)));
+
+			_mm256_store_ps(packet.closest, _mm256_blendv_ps(closest, intersection, isHit));
+			__m256i primitiveIds = _mm256_load_si256(reinterpret_cast<const __m256i*>(packet.primitiveId));
+			primitiveIds = _mm256_blendv_epi8(primitiveIds, _mm256_set1_epi32(static_cast<int>(primitiveId)), _mm256_castps_si256(isHit));
+			_mm256_store_si256(reinterpret_cast<__m256i*>(packet.primitiveId), primitiveIds);
+		}
+
+		RAYTRACER_TARGET_AVX2 std::uint32_t intersectAABBAVX2(const RayPacket& packet, const BVHNode& node, float& nearestEntry) {
+			__m256 originX = _mm256_load_ps(packet.originX);
+			__m256 originY = _mm256_load_ps(packet.originY);
+			__m256 originZ = _mm256_load_ps(packet.originZ);
+			__m256 inverseX = _mm256_load_ps(packet.inverseDirectionX);
+			__m256 inverseY = _mm256_load_ps(packet.inverseDirectionY);
+			__m256 inverseZ = _mm256_load_ps(packet.inverseDirectionZ);
+
+			__m256 t0X = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.x), originX), inverseX);
+			__m256 t0Y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.y), originY), inverseY);
+			__m256 t0Z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.z), originZ), inverseZ);
+			__m256 t1X = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.x), originX), inverseX);
+			__m256 t1Y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.y), originY), inverseY);
+			__m256 t1Z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.z), originZ), inverseZ);
+
+			__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0X, t1X), _mm256_min_ps(t0Y, t1Y)), _mm256_min_ps(t0Z, t1Z));
+			__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0X, t1X), _mm256_max_ps(t0Y, t1Y)), _mm256_max_ps(t0Z, t1Z));
+
+			__m256 isHit = _mm256_and_ps(_mm256_cmp_ps(tFar, tNear, _CMP_GE_OQ), _mm256_cmp_ps(tFar, _mm256_setzero_ps(), _CMP_GT_OQ));
+			isHit = _mm256_and_ps(isHit, _mm256_cmp_ps(tNear, _mm256_load_ps(packet.closest), _CMP_LT_OQ));
+
+			std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_ps(isHit)) & packet.activeMask;
+
+			__m256 nearest = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::max()), tNear, isHit);
+			__m128 halves = _mm_min_ps(_mm256_castps256_ps128(nearest), _mm256_extractf128_ps(nearest, 1));
+			halves = _mm_min_ps(halves, _mm_movehl_ps(halves, halves));
+			halves = _mm_min_ss(halves, _mm_shuffle_ps(halves, halves, 1));
+			nearestEntry = _mm_cvtss_f32(halves);
+			return mask;
+		}
+#endif
+	}
+
+	void RayPacket::setRays(const Ray* rays, int rayCount) {
+		activeMask = 0;
+
+		for (int i = 0; i < packetSize; i++) {
+			const Ray& ray = rays[i < rayCount ? i : 0];
+
+			originX[i] = ray.origin.x;
+			originY[i] = ray.origin.y;
+			originZ[i] = ray.origin.z;
+
+			directionX[i] = ray.direction.x;
+			directionY[i] = ray.direction.y;
+			directionZ[i] = ray.direction.z;
+
+			inverseDirectionX[i] = 1.0f / ray.direction.x;
+			inverseDirectionY[i] = 1.0f / ray.direction.y;
+			inverseDirectionZ[i] = 1.0f / ray.direction.z;
+
+			primitiveId[i] = noPrimitive;
+
+			if (i < rayCount) {
+				closest[i] = std::numeric_limits<float>::max();
+				activeMask |= 1u << i;
+			}
+
+			else {
+				closest[i] = 0.0f;
+			}
+		}
+	}
+
+	PrimitiveHit RayPacket::getHit(int lane) const {
+		return PrimitiveHit{ closest[lane], primitiveId[lane] };
+	}
+
+	float RayPacket::getFarthestClosest() const {
+		float farthest = 0.0f;
+		for (int i = 0; i < packetSize; i++) {
+			farthest = std::max(farthest, closest[i]);
+		}
+		return farthest;
+	}
+
+	const PacketKernels& getPacketKernels(SIMDLevel level) {
+		static const PacketKernels scalarKernels{ intersectSphereScalar, intersectTriangleScalar, intersectAABBScalar };
+
+#if defined(RAYTRACER_X86)
+		static const PacketKernels sseKernels{ intersectSphereSSE, intersectTriangleSSE, intersectAABBSSE };
+		static const PacketKernels avx2Kernels{ intersectSphereAVX2, intersectTriangleAVX2, intersectAABBAVX2 };
+
+		// Never hand out kernels the CPU cannot run, whatever level was asked for
+		switch (std::min(level, detectSIMDLevel())) {
+		case SIMD_AVX2:
+			return avx2Kernels;
+		case SIMD_SSE42:
+			return sseKernels;
+		default:
+			return scalarKernels;
+		}
+#else
+		return scalarKernels;
+#endif
+	}
+
+	void tracePacket(const Scene& scene, RayPacket& packet, const PacketKernels& kernels) {
+		const std::vector<BVHNode>& nodes = scene.getBVH().getNodes();
+		const std::vector<std::uint32_t>& primitiveIndices = scene.getBVH().getPrimitiveIndices();
+		const std::uint32_t sphereCount = static_cast<std::uint32_t>(scene.m_spheres.size());
+
+		float entry;
+		if (nodes.empty() || kernels.intersectAABB(packet, nodes[0], entry) == 0) {
+			return;
+		}
+
+		// Same near-first walk as BVH::traverse, a node is entered when any lane of the packet reaches it
+		std::uint32_t stack[BVH::maxDepth];
+		float stackDistances[BVH::maxDepth];
+		int stackSize = 0;
+
+		std::uint32_t nodeIndex = 0;
+
+		while (true) {
+			const BVHNode& node = nodes[nodeIndex];
+
+			if (node.isLeaf()) {
+				for (std::int32_t i = 0; i < node.primitiveCount; i++) {
+					std::uint32_t primitive = primitiveIndices[node.leftOrFirst + i];
+
+					if (primitive < sphereCount) {
+						kernels.intersectSphere(packet, scene.m_spheres[primitive], primitive);
+					}
+
+					else {
+						const Triangle& triangle = scene.m_triangles[primitive - sphereCount];
+						kernels.intersectTriangle(packet, scene.m_vertices[triangle.vertexIndices[0]], scene.m_vertices[triangle.vertexIndices[1]], scene.m_vertices[triangle.vertexIndices[2]], primitive);
+					}
+				}
+			}
+
+			else {
+				std::uint32_t nearIndex = node.leftOrFirst;
+				std::uint32_t farIndex = node.leftOrFirst + 1;
+
+				float nearDistance;
+				float farDistance;
+				std::uint32_t nearMask = kernels.intersectAABB(packet, nodes[nearIndex], nearDistance);
+				std::uint32_t farMask = kernels.intersectAABB(packet, nodes[farIndex], farDistance);
+
+				if (farMask != 0 && (nearMask == 0 || farDistance < nearDistance)) {
+					std::swap(nearIndex, farIndex);
+					std::swap(nearDistance, farDistance);
+					std::swap(nearMask, farMask);
+				}
+
+				if (nearMask != 0) {
+					if (farMask != 0) {
+						stack[stackSize] = farIndex;
+						stackDistances[stackSize] = farDistance;
+						stackSize++;
+					}
+
+					nodeIndex = nearIndex;
+					continue;
+				}
+			}
+
+			// A far child can only be skipped once every lane has a hit in front of it
+			float farthestClosest = packet.getFarthestClosest();
+			while (stackSize > 0 && stackDistances[stackSize - 1] >= farthestClosest) {
+				stackSize--;
+			}
+
+			if (stackSize == 0) {
+				break;
+			}
+
+			nodeIndex = stack[--stackSize];
+		}
+	}
+}
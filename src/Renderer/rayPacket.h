@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+#include "scene.h"
+#include "simd.h"
+
+namespace RayTracer {
+	// Closest hit of a single ray, primitive ids below the sphere count are spheres, the rest are triangles
+	struct PrimitiveHit {
+		float distance;
+		std::uint32_t primitiveId;
+	};
+
+	// Up to packetSize coherent rays stored as structure of arrays so each component loads straight into a SIMD register
+	struct alignas(32) RayPacket {
+		static constexpr int packetSize = 8;
+
+		float originX[packetSize];
+		float originY[packetSize];
+		float originZ[packetSize];
+
+		float directionX[packetSize];
+		float directionY[packetSize];
+		float directionZ[packetSize];
+
+		float inverseDirectionX[packetSize];
+		float inverseDirectionY[packetSize];
+		float inverseDirectionZ[packetSize];
+
+		float closest[packetSize];
+		std::uint32_t primitiveId[packetSize];
+
+		// Bit per lane holding a real ray, the unused lanes repeat lane 0 with a closest distance of 0 so they never hit
+		std::uint32_t activeMask;
+
+		void setRays(const Ray* rays, int rayCount);
+		PrimitiveHit getHit(int lane) const;
+		float getFarthestClosest() const;
+	};
+
+	// One table per SIMD level, picked once so tracing a packet never re-checks the CPU
+	struct PacketKernels {
+		void (*intersectSphere)(RayPacket& packet, const Sphere& sphere, std::uint32_t primitiveId);
+		void (*intersectTriangle)(RayPacket& packet, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, std::uint32_t primitiveId);
+
+		// Returns a bit per lane that enters the node before its closest hit, and the smallest entry distance of those lanes
+		std::uint32_t (*intersectAABB)(const RayPacket& packet, const BVHNode& node, float& nearestEntry);
+	};
+
+	const PacketKernels& getPacketKernels(SIMDLevel level);
+
+	// Finds the closest primitive of every lane, walking the scene BVH once for the whole packet
+	// The scene's acceleration structure has to be up to date
+	void tracePacket(const Scene& scene, RayPacket& packet, const PacketKernels& kernels);
+}
@@ -1,127 +1,67 @@
 #pragma once
 
 #include <iostream>
-#include <numeric>
 #include <algorithm>
-#include <execution>
-#include <random>
 #include <filesystem>
+#include <chrono>
 
 #include "rayTracer.h"
+#include "profiler.h"
 #include "../Shader/shader.h"
 
 namespace RayTracer {
+	namespace {
+		void uploadShaderStorageBuffer(GLuint buffer, const void* data, size_t elementSize, size_t elementCount, size_t& allocatedCount, DirtyRange& dirtyRange) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+
+			if (elementCount != allocatedCount) {
+				glBufferData(GL_SHADER_STORAGE_BUFFER, elementCount * elementSize, data, GL_DYNAMIC_DRAW);
+				allocatedCount = elementCount;
+			}
+
+			else if (dirtyRange.isDirty()) {
+				size_t end = std::min(dirtyRange.end, elementCount);
+				if (dirtyRange.begin < end) {
+					glBufferSubData(GL_SHADER_STORAGE_BUFFER, dirtyRange.begin * elementSize, (end - dirtyRange.begin) * elementSize,
+						static_cast<const char*>(data) + dirtyRange.begin * elementSize);
+				}
+			}
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			dirtyRange.clear();
+		}
+	}
+
 	RayTracer::RayTracer() {
 	}
 
 	void RayTracer::init() {
-		Material material1 = Material({ 1.0f, 1.0f, 1.0f });
-		Material material2 = Material({ 1.0f, 1.0f, 1.0f });
-		Material material3 = Material({ 1.0f, 0.9f, 0.4f });
-		Material material4 = Material({ 1.0f, 0.3f, 0.0f });
-		Material material5 = Material({ 0.5f, 1.0f, 1.0f });
-
-		material1.emissionColour = glm::vec3(1.0f);
-		material1.emissiveStrength = 2.3f;
-
-		material2.reflectivness = 1.0f;
-
-		m_spheres = {
-			Sphere({ { 0.0f, 23.9f, -3.0f }, 9.3f, material1 }),
-			Sphere({ { 0.0f, 0.0f, -2.5f }, 1.0f, material2 }),
-			Sphere({ { 3.0f, 0.0f, -3.0f }, 1.25f, material3 }),
-			Sphere({ { -3.0f, 0.0f, -3.0f }, 1.25f, material4 }),
-			Sphere({ { 0.0f, -20.0f, -3.0f }, 19.0f, material5 }),
-		};
-
-		m_triangles = {
-			Triangle({
-				{ 0.099900f, 1.729058f, -0.019480f },
-				{ -1.593872f, 0.669219f, -0.108247f },
-				{ -0.933950f, -0.508988f, 1.366992f },
-				{ -0.4170f, 0.6100f, 0.6738f }, material3
-			}),
-			Triangle({
-				{ 0.099900f, 1.729058f, -0.019480f },
-				{ -0.933950f, -0.508988f, 1.366992f },
-				{ 0.759822f, 0.550850f, 1.455759f },
-				{ -0.4170f, 0.6100f, 0.6738f }, material3
-			}),
-
-				// Face 2 (4/5/2 3/4/2 7/6/2 8/7/2)
-				Triangle({
-					{ 1.593872f, -0.669219f, 0.108247f },
-					{ 0.759822f, 0.550850f, 1.455759f },
-					{ -0.933950f, -0.508988f, 1.366992f },
-					{ 0.3300f, -0.5891f, 0.7376f }, material3
-				}),
-				Triangle({
-					{ 1.593872f, -0.669219f, 0.108247f },
-					{ -0.933950f, -0.508988f, 1.366992f },
-					{ -0.099900f, -1.729058f, 0.019480f },
-					{ 0.3300f, -0.5891f, 0.7376f }, material3
-				}),
-
-				// Face 3 (8/8/3 7/9/3 5/10/3 6/11/3)
-				Triangle({
-					{ -0.099900f, -1.729058f, 0.019480f },
-					{ -0.933950f, -0.508988f, 1.366992f },
-					{ -1.593872f, 0.669219f, -0.108247f },
-					{ -0.8469f, -0.5299f, -0.0444f }, material3
-				}),
-				Triangle({
-					{ -0.099900f, -1.729058f, 0.019480f },
-					{ -1.593872f, 0.669219f, -0.108247f },
-					{ -0.759822f, -0.550850f, -1.455759f },
-					{ -0.8469f, -0.5299f, -0.0444f }, material3
-				}),
-
-				// Face 4 (6/12/4 2/13/4 4/5/4 8/14/4)
-				Triangle({
-					{ -0.759822f, -0.550850f, -1.455759f },
-					{ 0.933950f, 0.508988f, -1.366992f },
-					{ 1.593872f, -0.669219f, 0.108247f },
-					{ 0.4170f, -0.6100f, -0.6738f }, material3
-				}),
-				Triangle({
-					{ -0.759822f, -0.550850f, -1.455759f },
-					{ 1.593872f, -0.669219f, 0.108247f },
-					{ -0.099900f, -1.729058f, 0.019480f },
-					{ 0.4170f, -0.6100f, -0.6738f }, material3
-				}),
-
-				// Face 5 (2/13/5 1/1/5 3/4/5 4/5/5)
-				Triangle({
-					{ 0.933950f, 0.508988f, -1.366992f },
-					{ 0.099900f, 1.729058f, -0.019480f },
-					{ 0.759822f, 0.550850f, 1.455759f },
-					{ 0.8469f, 0.5299f, 0.0444f }, material3
-				}),
-				Triangle({
-					{ 0.933950f, 0.508988f, -1.366992f },
-					{ 0.759822f, 0.550850f, 1.455759f },
-					{ 1.593872f, -0.669219f, 0.108247f },
-					{ 0.8469f, 0.5299f, 0.0444f }, material3
-				}),
-
-				// Face 6 (6/11/6 5/10/6 1/1/6 2/13/6)
-				Triangle({
-					{ -0.759822f, -0.550850f, -1.455759f },
-					{ -1.593872f, 0.669219f, -0.108247f },
-					{ 0.099900f, 1.729058f, -0.019480f },
-					{ -0.3300f, 0.5891f, -0.7376f }, material3
-				}),
-				Triangle({
-					{ -0.759822f, -0.550850f, -1.455759f },
-					{ 0.099900f, 1.729058f, -0.019480f },
-					{ 0.933950f, 0.508988f, -1.366992f },
-					{ -0.3300f, 0.5891f, -0.7376f }, material3
-				}),
-		};
+		// The spheres still render without the mesh, so the window stays usable
+		if (!m_scene.loadDefault()) {
+			std::cerr << "Could not load the default scene's mesh, only its spheres are shown" << std::endl;
+		}
 
 		m_accumilate = false;
+		m_useComputeShader = true;
 		m_frames = 1;
-		m_background = glm::vec3(0.5f);
+		m_samplingMode = SAMPLING_NEXT_EVENT;
+		m_adaptiveThreshold = 0.0f;
+		m_activePixelFraction = 1.0f;
+		m_denoise = false;
+		m_useProgressivePreview = false;
+		m_isInteracting = false;
+		m_previewBudget = 1000.0f / 60.0f;
+		m_previewLevel = 0;
+		m_dispatchBudget = 10.0f;
+		m_dispatchTileSize = 128;
+		m_dispatchedTileCount = 0;
+		m_tileCount = 0;
+		m_pixelCost = 0.0f;
+		m_dispatchPixelCost = 0.0f;
+		m_nextTile = 0;
+		m_dispatchedPixels = 0;
+
+		m_pathTracer.init();
 
 		m_computeShader.init();
 		m_computeShader.attachShader((std::filesystem::path(PROJECT_DIR) / "assets" / "shaders" / "computeShader.glsl").string().c_str(), COMPUTE_SHADER);
@@ -129,27 +69,106 @@ namespace RayTracer {
 
 		glGenBuffers(1, &m_sphereSSBO);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sphereSSBO);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, m_spheres.size() * sizeof(Sphere), m_spheres.data(), GL_STATIC_DRAW);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_scene.m_spheres.size() * sizeof(Sphere), m_scene.m_spheres.data(), GL_DYNAMIC_DRAW);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_sphereSSBO);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		m_sphereSSBOCount = m_scene.m_spheres.size();
 
 		glGenBuffers(1, &m_triangleSSBO);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_triangleSSBO);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, m_triangles.size() * sizeof(Triangle), m_triangles.data(), GL_STATIC_DRAW);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_scene.m_triangles.size() * sizeof(Triangle), m_scene.m_triangles.data(), GL_DYNAMIC_DRAW);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_triangleSSBO);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		m_triangleSSBOCount = m_scene.m_triangles.size();
+
+		// Vertices are tightly packed vec3s, the shader reads them as a float array since a vec3 array would be padded to 16 bytes
+		glGenBuffers(1, &m_vertexSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_vertexSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_scene.m_vertices.size() * sizeof(glm::vec3), m_scene.m_vertices.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_vertexSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		m_vertexSSBOCount = m_scene.m_vertices.size();
+
+		// Packed the same way as the vertices
+		glGenBuffers(1, &m_normalSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_normalSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_scene.m_normals.size() * sizeof(glm::vec3), m_scene.m_normals.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, m_normalSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		m_normalSSBOCount = m_scene.m_normals.size();
+
+		glGenBuffers(1, &m_materialSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_materialSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_scene.m_materials.size() * sizeof(Material), m_scene.m_materials.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_materialSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		m_materialSSBOCount = m_scene.m_materials.size();
+
+		glGenBuffers(1, &m_bvhNodeSSBO);
+		glGenBuffers(1, &m_bvhPrimitiveSSBO);
+		glGenBuffers(1, &m_lightSSBO);
+
+		// The sampler tables never change, so they are uploaded once, blue noise ranks first and the sequence steps after
+		const std::vector<std::uint32_t>& blueNoiseMask = Sampler::getBlueNoiseMask();
+		const std::vector<std::uint32_t>& sequenceSteps = Sampler::getSequenceSteps();
+		glGenBuffers(1, &m_samplerSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_samplerSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (blueNoiseMask.size() + sequenceSteps.size()) * sizeof(std::uint32_t), nullptr, GL_STATIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, blueNoiseMask.size() * sizeof(std::uint32_t), blueNoiseMask.data());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, blueNoiseMask.size() * sizeof(std::uint32_t), sequenceSteps.size() * sizeof(std::uint32_t), sequenceSteps.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, m_samplerSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		std::uint32_t activePixelCount = 0;
+		glGenBuffers(1, &m_activePixelSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_activePixelSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(std::uint32_t), &activePixelCount, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		GLbitfield readbackFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		for (ActivePixelReadback& readback : m_activePixelReadbacks) {
+			glGenBuffers(1, &readback.buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+			glBufferStorage(GL_COPY_WRITE_BUFFER, sizeof(std::uint32_t), nullptr, readbackFlags);
+			readback.mappedCount = static_cast<const std::uint32_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, sizeof(std::uint32_t), readbackFlags));
+			readback.fence = nullptr;
+			readback.dispatchedPixels = 0;
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		m_firstActivePixelReadback = 0;
+		m_pendingActivePixelReadbacks = 0;
+
+		m_profiler.init();
+
+		m_statisticsTexture = 0;
+		m_statisticsWidth = 0;
+		m_statisticsHeight = 0;
 
-		m_params.info.x = m_spheres.size();
+		m_isBVHUploadDirty = false;
+		m_isBVHRebuilt = false;
+
+		m_params.info.x = m_scene.m_spheres.size();
 		m_params.info.y = 0;
 		m_params.info.z = 1;
 		m_params.info.w = 0;
-		m_params.currentTime = 0.0f;
-		m_params.backgroundColourandNumBounces = glm::vec4(m_background, 12.0f);
+		m_params.samplingMode = m_samplingMode;
+		m_params.adaptiveThreshold = 0.0f;
+		m_params.samplesPerPixel = 1;
+		m_params.samplerType = m_pathTracer.m_samplerType;
+		m_params.previewLevel = 0;
+		m_params.backgroundColourandNumBounces = glm::vec4(m_scene.m_background, 12.0f);
 
 		std::cout << "Sphere count: " << m_params.info.x << std::endl;
 
 		std::cout << "Sphere size: " << sizeof(Sphere) << std::endl;
 
+		glGenBuffers(1, &m_CameraUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, m_CameraUBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraUBO), nullptr, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 3, m_CameraUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		m_lastCamera = m_scene.m_camera;
+
 		glGenBuffers(1, &m_paramsUBO);
 		glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
 		glBufferData(GL_UNIFORM_BUFFER, sizeof(ParamsUBO), nullptr, GL_DYNAMIC_DRAW);
@@ -158,26 +177,13 @@ namespace RayTracer {
 		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 	}
 
-	std::vector<glm::vec3> RayTracer::run(int bounceLimit, Renderer* renderer) {
+	void RayTracer::run(int bounceLimit, Renderer* renderer) {
+		ProfileZone zone("Ray Tracer Run");
 		static bool firstRun = true;
 		FrameBufferSettings frameBufferSize = renderer->getFrameBufferSize();
-		std::vector<glm::vec3> frameBuffer(frameBufferSize.width * frameBufferSize.height);
-
-		if (m_accumilateFrameBuffer.empty() || frameBuffer.size() != m_accumilateFrameBuffer.size()) {
-			m_accumilateFrameBuffer.resize(frameBufferSize.width * frameBufferSize.height, glm::vec3(0.0f));
-		}
-
-		Camera camera;
-		camera.fov = 45.0f;
-		camera.location = glm::vec3(0.0f, 0.0f, -10.0f);
 		int fbHeight = frameBufferSize.height;
 		int fbWidth = frameBufferSize.width;
 
-		float rayFactor = glm::tan(glm::radians(camera.fov) / 2.0f);
-		float aspectRatio = frameBufferSize.width / static_cast<float>(frameBufferSize.height);
-
-		float rayFactorAR = rayFactor * aspectRatio;
-
 		if (m_accumilate) {
 			firstRun = false;
 			m_frames++;
@@ -192,220 +198,326 @@ namespace RayTracer {
 			m_params.info.z = m_frames;
 		}
 
-#define COMPUTE_SHADER
-		// #define SINGLE_THREAD
-#ifdef COMPUTE_SHADER
-		frameBuffer.resize(fbHeight * fbWidth, glm::vec3(0.0f));
+		// The CPU path tracer carries its samples over to the new view itself unless reprojection is off
+		bool isCameraMoved = m_scene.m_camera != m_lastCamera;
+		m_lastCamera = m_scene.m_camera;
+		if (isCameraMoved && m_accumilate && (m_useComputeShader || !m_pathTracer.m_useReprojection)) {
+			m_frames = 1;
+			m_params.info.z = m_frames;
+		}
 
-		if (firstRun) {
-			renderer->updateOpenGLTexture(frameBuffer);
+		// Accumulation starts again from the first full resolution frame
+		int previewLevel = getPreviewLevel(fbWidth, fbHeight);
+		bool isPreviewing = previewLevel > 0;
+		if (isPreviewing && m_accumilate) {
+			m_frames = 0;
+			m_params.info.z = m_frames;
 		}
 
-		m_computeShader.useShader();
-		m_computeShader.bindImageTexture(0, renderer->getTexture(), GL_READ_WRITE, GL_RGBA32F);
+		BVHUpdate bvhUpdate = m_scene.updateAccelerationStructure();
+		if (bvhUpdate != BVH_UNCHANGED) {
+			m_isBVHUploadDirty = true;
+			m_isBVHRebuilt |= bvhUpdate == BVH_REBUILT;
+		}
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_sphereSSBO);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, m_spheres.size() * sizeof(Sphere), m_spheres.data(), GL_STATIC_DRAW);
+		if (m_useComputeShader) {
+			if (firstRun) {
+				renderer->clearTexture();
+			}
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_triangleSSBO);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, m_triangles.size() * sizeof(Triangle), m_triangles.data(), GL_STATIC_DRAW);
+			bool isAdaptive = m_accumilate && m_adaptiveThreshold > 0.0f;
+			updateAdaptiveSampling(fbWidth, fbHeight, isAdaptive);
+			updateDispatchCost();
 
-		m_params.currentTime = static_cast<float>(glfwGetTime());
+			// Zero sample counts make the shader drop the colour accumulated from the old view or the preview
+			if (isCameraMoved || isPreviewing) {
+				glClearTexImage(m_statisticsTexture, 0, GL_RGBA, GL_FLOAT, nullptr);
+			}
 
-		glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
-		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ParamsUBO), &m_params);
+			m_computeShader.useShader();
+			m_computeShader.bindImageTexture(0, renderer->getTexture(), GL_READ_WRITE, GL_RGBA32F);
+			m_computeShader.bindImageTexture(1, m_statisticsTexture, GL_READ_WRITE, GL_RGBA32F);
+
+			m_profiler.beginStage(STAGE_SCENE_UPLOAD);
+			uploadSceneBuffers();
+
+			m_params.samplingMode = m_samplingMode;
+			m_params.adaptiveThreshold = m_accumilate ? m_adaptiveThreshold : 0.0f;
+			m_params.samplesPerPixel = m_params.adaptiveThreshold > 0.0f ? PathTracer::getAdaptiveSampleCount(m_activePixelFraction) : 1;
+			m_params.samplerType = m_pathTracer.m_samplerType;
+			m_params.previewLevel = previewLevel;
+
+			glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ParamsUBO), &m_params);
+
+			const Camera& camera = m_scene.m_camera;
+			CameraUBO cameraUBO;
+			cameraUBO.location = glm::vec4(camera.location, glm::tan(glm::radians(camera.fov) / 2.0f));
+			cameraUBO.forward = glm::vec4(camera.getForward(), 0.0f);
+			cameraUBO.right = glm::vec4(camera.getRight(), 0.0f);
+			cameraUBO.up = glm::vec4(camera.getUp(), 0.0f);
+
+			glBindBuffer(GL_UNIFORM_BUFFER, m_CameraUBO);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraUBO), &cameraUBO);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			m_profiler.endStage(STAGE_SCENE_UPLOAD);
+
+			// Frames dispatched while every query is in flight go untimed on the GPU
+			m_profiler.beginStage(STAGE_TRACE);
+
+			// A preview invocation traces one block of 2^previewLevel pixels, previews are cheap enough to go out whole
+			if (isPreviewing) {
+				int blockSize = 1 << previewLevel;
+				int tracedWidth = (fbWidth + blockSize - 1) / blockSize;
+				int tracedHeight = (fbHeight + blockSize - 1) / blockSize;
+
+				glUniform2i(0, 0, 0);
+				m_computeShader.dispatchCompute(glm::vec3((tracedWidth + 16 - 1) / 16, (tracedHeight + 16 - 1) / 16, 1));
+				m_dispatchedPixels = static_cast<size_t>(tracedWidth) * tracedHeight;
+			}
 
-		m_computeShader.dispatchCompute(glm::vec3((fbWidth + 16 - 1) / 16, (fbHeight + 16 - 1) / 16, 1));
+			else {
+				m_dispatchedPixels = dispatchTiles(fbWidth, fbHeight);
+			}
 
-		m_params.info.y++;
-		m_params.backgroundColourandNumBounces = glm::vec4(m_background, bounceLimit);
+			// A preview is one small dispatch that leaves the GPU underused, its time per pixel would skew the tile budget
+			m_profiler.endStage(STAGE_TRACE, isPreviewing ? 0.0 : static_cast<double>(m_dispatchedPixels));
 
-#else
-#ifdef SINGLE_THREAD
-		for (int i = 0; i < fbHeight; i++) {
-			for (int j = 0; j < fbWidth; j++) {
-				Ray ray;
-				ray.origin = camera.location;
-				ray.direction = glm::normalize(glm::vec3(
-					(2.0f * (j + 0.5f) / frameBufferSize.width - 1.0f) * rayFactorAR,
-					(1.0f - 2.0f * (i + 0.5f) / frameBufferSize.height) * rayFactor,
-					1.0f));
+			// Preview frames trace blocks, so their count says nothing about the full resolution pixels
+			if (isAdaptive && !isPreviewing) {
+				queueActivePixelReadback();
+			}
 
-				glm::vec3 colour = traceRay(ray, m_spheres, bounceLimit);
+			m_params.info.y++;
+			m_params.backgroundColourandNumBounces = glm::vec4(m_scene.m_background, bounceLimit);
+		}
 
-				int pixelIndex = i * frameBufferSize.width + j;
+		else {
+			std::span<glm::vec4> frameBuffer = renderer->getFrameBuffer();
+			m_profiler.beginStage(STAGE_TRACE);
+			auto renderStart = std::chrono::steady_clock::now();
 
-				if (m_accumilate) {
-					m_accumilateFrameBuffer[pixelIndex] += colour;
-					frameBuffer[pixelIndex] = m_accumilateFrameBuffer[pixelIndex] / glm::vec3(m_frames);
-				}
+			if (isPreviewing) {
+				renderPreview(frameBuffer, fbWidth, fbHeight, previewLevel, bounceLimit);
+			}
+
+			else {
+				m_pathTracer.render(m_scene, frameBuffer, fbWidth, fbHeight, bounceLimit, m_samplingMode, m_accumilate, m_adaptiveThreshold);
+				m_activePixelFraction = m_pathTracer.getActivePixelFraction();
 
-				else {
-					m_accumilateFrameBuffer[pixelIndex] = glm::vec3(0.0f);
-					frameBuffer[pixelIndex] = colour;
+				// Only the displayed copy is filtered, the accumulated samples stay untouched
+				if (m_denoise) {
+					m_pathTracer.denoise(frameBuffer, fbWidth, fbHeight);
 				}
 			}
+
+			std::chrono::duration<float> renderTime = std::chrono::steady_clock::now() - renderStart;
+			m_profiler.endStage(STAGE_TRACE);
+			int blockSize = 1 << previewLevel;
+			int tracedPixels = ((fbWidth + blockSize - 1) / blockSize) * ((fbHeight + blockSize - 1) / blockSize);
+			m_pixelCost = renderTime.count() / std::max(1, tracedPixels);
 		}
-#else
-		std::vector<int> indices(fbWidth * fbHeight);
-		std::iota(indices.begin(), indices.end(), 0);
-
-		// Thanks to The Cherno for the for_each + lambda idea for parallelism
-		std::for_each(
-			std::execution::par,
-			indices.begin(),
-			indices.end(),
-			[&](int idx) {
-				int i = idx / fbWidth;
-				int j = idx % fbWidth;
-
-				Ray ray;
-				ray.origin = camera.location;
-				ray.direction = glm::normalize(glm::vec3(
-					(2.0f * (j + 0.5f) / frameBufferSize.width - 1.0f) * rayFactorAR,
-					(1.0f - 2.0f * (i + 0.5f) / frameBufferSize.height) * rayFactor,
-					1.0f));
-
-				glm::vec3 colour = traceRay(ray, m_spheres, bounceLimit);
-
-				int pixelIndex = i * frameBufferSize.width + j;
-
-				if (m_accumilate) {
-					m_accumilateFrameBuffer[pixelIndex] += colour;
-					frameBuffer[pixelIndex] =
-						m_accumilateFrameBuffer[pixelIndex] / glm::vec3(m_frames);
-				}
-				else {
-					m_accumilateFrameBuffer[pixelIndex] = glm::vec3(0.0f);
-					frameBuffer[pixelIndex] = colour;
-				}
-			});
-#endif
-#endif
 
-		return frameBuffer;
+		m_previewLevel = previewLevel;
 	}
 
-	glm::vec3 RayTracer::traceRay(Ray& ray, const std::vector<Sphere>& spheres, int bounceLimit) {
-		glm::vec3 colour(0.0f);
-		glm::vec3 attenuation(1.0f);
-
-		HitSphere hitSphere = HitSphere({ glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.0f), Material({ { 0.0f, 0.0f, 0.0f } }), glm::vec3(0.0f) });
-
-		for (int t = 0; t < bounceLimit; t++) {
+	void RayTracer::updateAdaptiveSampling(int width, int height, bool isAdaptive) {
+		if (width != m_statisticsWidth || height != m_statisticsHeight) {
+			glDeleteTextures(1, &m_statisticsTexture);
+			glGenTextures(1, &m_statisticsTexture);
+			glBindTexture(GL_TEXTURE_2D, m_statisticsTexture);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+			glClearTexImage(m_statisticsTexture, 0, GL_RGBA, GL_FLOAT, nullptr);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			m_statisticsWidth = width;
+			m_statisticsHeight = height;
+		}
 
-			glm::vec3 bounceColour{ 0.0f };
+		// A zero timeout only polls, a copy the GPU has not reached yet is left for a later frame
+		while (m_pendingActivePixelReadbacks > 0) {
+			ActivePixelReadback& readback = m_activePixelReadbacks[m_firstActivePixelReadback];
+			GLenum result = glClientWaitSync(readback.fence, 0, 0);
+			if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+				break;
+			}
 
-			float closestIntersection = std::numeric_limits<float>::max();
-			for (auto& sphere : spheres) {
-				float intersection;
-				if (isRayIntersectSphere(ray, sphere, intersection)) {
-					if (intersection < closestIntersection) {
-						closestIntersection = intersection;
+			glDeleteSync(readback.fence);
+			readback.fence = nullptr;
 
-						hitSphere.hitPoint = ray.origin + ray.direction * intersection;
-						hitSphere.hitNormal = glm::normalize(hitSphere.hitPoint - sphere.centre);
-						hitSphere.hitMaterial = sphere.material;
-					}
-				}
+			// The count is out of the pixels that frame's tiles covered
+			if (isAdaptive && readback.dispatchedPixels > 0) {
+				m_activePixelFraction = std::min(1.0f, static_cast<float>(*readback.mappedCount) / static_cast<float>(readback.dispatchedPixels));
 			}
 
-			if (closestIntersection < std::numeric_limits<float>::max()) {
+			m_firstActivePixelReadback = (m_firstActivePixelReadback + 1) % activePixelReadbackCount;
+			m_pendingActivePixelReadbacks--;
+		}
 
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_activePixelSSBO);
 
-				hitSphere.hitLight += hitSphere.hitMaterial.emissiveStrength * hitSphere.hitMaterial.emissionColour * attenuation;
+		// The shader only counts while adaptive sampling is on
+		if (!isAdaptive) {
+			m_activePixelFraction = 1.0f;
+			return;
+		}
 
-				ray.origin = hitSphere.hitPoint + 0.001f * hitSphere.hitNormal;
+		std::uint32_t activePixelCount = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_activePixelSSBO);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &activePixelCount);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
 
-				glm::vec3 randomNum = getRandomOnUnitSphere();
-				if (glm::dot(randomNum, hitSphere.hitNormal) < 0) {
-					// randomNum and hitNormal are both unit vectors, so this does not need to be normalized
-					randomNum = glm::reflect(randomNum, hitSphere.hitNormal);
-				}
+	void RayTracer::queueActivePixelReadback() {
+		if (m_pendingActivePixelReadbacks == activePixelReadbackCount) {
+			return;
+		}
 
-				// Combines the specular and diffuse bounces
-				// Uses Lamberts cosine law for diffuse bounces (favours bounces closer to the normal)
-				ray.direction = glm::normalize((1 - hitSphere.hitMaterial.reflectivness) * glm::normalize(hitSphere.hitNormal + randomNum) + hitSphere.hitMaterial.reflectivness * glm::reflect(ray.direction, hitSphere.hitNormal));
+		ActivePixelReadback& readback = m_activePixelReadbacks[(m_firstActivePixelReadback + m_pendingActivePixelReadbacks) % activePixelReadbackCount];
 
-				colour += hitSphere.hitLight * hitSphere.hitColour;
+		// The shader's atomic writes have to land before the copy, and the copy before the CPU reads the mapping
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+		glCopyNamedBufferSubData(m_activePixelSSBO, readback.buffer, 0, 0, sizeof(std::uint32_t));
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback.dispatchedPixels = m_dispatchedPixels;
+		m_pendingActivePixelReadbacks++;
+	}
 
-				hitSphere.hitColour *= hitSphere.hitMaterial.materialColour;
-			}
+	int RayTracer::getPreviewLevel(int width, int height) {
+		if (!m_useProgressivePreview) {
+			return 0;
+		}
 
-			else {
-				if (t == 0) {
-					return m_background;
-				}
+		if (!m_isInteracting) {
+			return std::max(0, m_previewLevel - 1);
+		}
 
-				colour += m_background * hitSphere.hitColour * attenuation;
-				return colour;
-			}
+		// Nothing is timed yet, so the first interactive frame is the cheapest one
+		float pixelCost = m_useComputeShader ? m_dispatchPixelCost : m_pixelCost;
+		if (pixelCost <= 0.0f) {
+			return maxPreviewLevel;
+		}
 
-			attenuation *= 0.75f;
+		float pixelBudget = m_previewBudget / 1000.0f / pixelCost;
+		int level = 0;
+		while (level < maxPreviewLevel && static_cast<float>(width >> level) * static_cast<float>(height >> level) > pixelBudget) {
+			level++;
 		}
-		return colour;
+		return level;
 	}
 
-	bool RayTracer::isRayIntersectSphere(const Ray& ray, const Sphere& sphere, float& intersection) {
-		// Assuming ray direction is normalised
-		// Causes aTerm = 1
-		float bTerm = glm::dot(ray.origin - sphere.centre, ray.direction);
-		float cTerm = glm::dot(ray.origin - sphere.centre, ray.origin - sphere.centre) - sphere.radius * sphere.radius;
+	void RayTracer::renderPreview(std::span<glm::vec4> frameBuffer, int width, int height, int level, int bounceLimit) {
+		ProfileZone zone("Preview");
+		int blockSize = 1 << level;
+		int previewWidth = (width + blockSize - 1) / blockSize;
+		int previewHeight = (height + blockSize - 1) / blockSize;
+
+		m_previewFrameBuffer.resize(static_cast<size_t>(previewWidth) * previewHeight);
+		m_pathTracer.render(m_scene, m_previewFrameBuffer, previewWidth, previewHeight, bounceLimit, m_samplingMode, false, 0.0f);
+
+		// Nearest neighbour, the same blocks the compute shader writes
+		for (int y = 0; y < height; y++) {
+			const glm::vec4* previewRow = &m_previewFrameBuffer[static_cast<size_t>(y / blockSize) * previewWidth];
+			glm::vec4* row = &frameBuffer[static_cast<size_t>(y) * width];
+			for (int x = 0; x < width; x++) {
+				row[x] = previewRow[x / blockSize];
+			}
+		}
+	}
 
-		float determinant = bTerm * bTerm - cTerm;
+	void RayTracer::updateDispatchCost() {
+		double seconds = 0.0;
+		double pixels = 0.0;
+		if (m_profiler.getNewGpuTime(STAGE_TRACE, seconds, pixels) && pixels > 0.0) {
+			m_dispatchPixelCost = static_cast<float>(seconds / pixels);
+		}
+	}
 
-		if (determinant < 0) {
-			return false;
+	size_t RayTracer::dispatchTiles(int width, int height) {
+		ProfileZone zone("Dispatch Tiles");
+		int tileSize = std::max(16, m_dispatchTileSize / 16 * 16);
+		int tilesX = (width + tileSize - 1) / tileSize;
+		int tilesY = (height + tileSize - 1) / tileSize;
+		m_tileCount = tilesX * tilesY;
+
+		// Untimed, the whole image goes out as before
+		int tileBudget = m_tileCount;
+		if (m_dispatchPixelCost > 0.0f) {
+			float tileCost = m_dispatchPixelCost * static_cast<float>(tileSize * tileSize);
+			tileBudget = std::clamp(static_cast<int>(m_dispatchBudget / 1000.0f / tileCost), 1, m_tileCount);
 		}
 
-		float determinantSqrt = glm::sqrt(determinant);
+		if (m_nextTile >= m_tileCount) {
+			m_nextTile = 0;
+		}
 
-		float term0 = -bTerm - determinantSqrt;
-		float term1 = -bTerm + determinantSqrt;
+		size_t dispatchedPixels = 0;
+		for (int remaining = tileBudget; remaining > 0;) {
+			int tileY = m_nextTile / tilesX;
+			int firstTileX = m_nextTile % tilesX;
+			int runLength = std::min(remaining, tilesX - firstTileX);
 
-		if (term0 > 0.001f) {
-			intersection = term0;
-			return true;
-		}
-		if (term1 > 0.001f) {
-			intersection = term1;
-			return true;
-		}
-		return false;
-	}
+			int x = firstTileX * tileSize;
+			int y = tileY * tileSize;
+			int runWidth = std::min(runLength * tileSize, width - x);
+			int runHeight = std::min(tileSize, height - y);
 
-	glm::vec3 RayTracer::getRandomOnUnitSphere() {
-		// Thanks to The Cherno https://www.youtube.com/watch?v=1KTgc2SEt50&list=PLlrATfBNZ98edc5GshdBtREv5asFW3yXl&index=12 for the Thread Local idea
-		thread_local Random rng(123456789 + std::hash<std::thread::id>()(std::this_thread::get_id()));
-		thread_local std::normal_distribution<float> normalDistribution(0.0f, 1.0f);
+			glUniform2i(0, x, y);
+			glDispatchCompute((runWidth + 16 - 1) / 16, (runHeight + 16 - 1) / 16, 1);
+			dispatchedPixels += static_cast<size_t>(runWidth) * runHeight;
 
-		// Thanks to Sebastian Lauge https://www.youtube.com/watch?v=Qz0KTGYJtUk&t=545s for the uniform random on unit sphere idea
-		float x = normalDistribution(rng);
-		float y = normalDistribution(rng);
-		float z = normalDistribution(rng);
+			remaining -= runLength;
+			m_nextTile = (m_nextTile + runLength) % m_tileCount;
+		}
 
-		return glm::normalize(glm::vec3(x, y, z));
+		// Tiles never overlap, so one barrier after the last of them is enough
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		m_dispatchedTileCount = tileBudget;
+		return dispatchedPixels;
 	}
 
-	Random::Random(std::uint32_t seed) {
-		m_randomNumber = seed;
-	}
+	void RayTracer::uploadSceneBuffers() {
+		ProfileZone zone("Scene Upload");
+		uploadShaderStorageBuffer(m_sphereSSBO, m_scene.m_spheres.data(), sizeof(Sphere), m_scene.m_spheres.size(), m_sphereSSBOCount, m_scene.m_dirtySpheres);
+		uploadShaderStorageBuffer(m_triangleSSBO, m_scene.m_triangles.data(), sizeof(Triangle), m_scene.m_triangles.size(), m_triangleSSBOCount, m_scene.m_dirtyTriangles);
+		uploadShaderStorageBuffer(m_vertexSSBO, m_scene.m_vertices.data(), sizeof(glm::vec3), m_scene.m_vertices.size(), m_vertexSSBOCount, m_scene.m_dirtyVertices);
+		uploadShaderStorageBuffer(m_normalSSBO, m_scene.m_normals.data(), sizeof(glm::vec3), m_scene.m_normals.size(), m_normalSSBOCount, m_scene.m_dirtyNormals);
+		uploadShaderStorageBuffer(m_materialSSBO, m_scene.m_materials.data(), sizeof(Material), m_scene.m_materials.size(), m_materialSSBOCount, m_scene.m_dirtyMaterials);
+
+		// The light list is tiny next to the scene, so it is replaced whole
+		if (m_scene.m_isLightListDirty) {
+			const std::vector<std::uint32_t>& lights = m_scene.getLights();
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_lightSSBO);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, lights.size() * sizeof(std::uint32_t), lights.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			m_scene.m_isLightListDirty = false;
+		}
 
-	std::uint32_t Random::getRandomFloat() {
-		uint32_t result = m_randomNumber;
-		result ^= result << 13;
-		result ^= result >> 17;
-		result ^= result << 5;
-		m_randomNumber = result;
+		if (m_isBVHUploadDirty) {
+			const std::vector<BVHNode>& nodes = m_scene.getBVH().getNodes();
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bvhNodeSSBO);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, nodes.size() * sizeof(BVHNode), nodes.data(), GL_DYNAMIC_DRAW);
 
-		return result;
-	}
+			// A refit only moves node bounds, the primitive order is unchanged
+			if (m_isBVHRebuilt) {
+				const std::vector<std::uint32_t>& primitiveIndices = m_scene.getBVH().getPrimitiveIndices();
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bvhPrimitiveSSBO);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, primitiveIndices.size() * sizeof(std::uint32_t), primitiveIndices.data(), GL_DYNAMIC_DRAW);
+			}
 
-	Material::Material(glm::vec3 colour) {
-		materialColour = colour;
-		reflectivness = 0.0f;
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			m_isBVHUploadDirty = false;
+			m_isBVHRebuilt = false;
+		}
 
-		emissiveStrength = 0.0f;
-		emissionColour = glm::vec3(0.0f);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_sphereSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_triangleSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_bvhNodeSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_bvhPrimitiveSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_vertexSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_materialSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, m_lightSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, m_samplerSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, m_normalSSBO);
 	}
 }
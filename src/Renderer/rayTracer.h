@@ -2,109 +2,165 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <span>
+#include <array>
 
 #include "renderer.h"
+#include "scene.h"
+#include "pathTracer.h"
+#include "frameProfiler.h"
 #include "../Shader/shader.h"
 #include <glad/gl.h>
 
 
 namespace RayTracer {
-	struct alignas(16) Material {
-		glm::vec3 materialColour;
-		float reflectivness;
+	class RayTracer {
 
-		glm::vec3 emissionColour;
-		float emissiveStrength;
+	public:
+		RayTracer();
+		void init();
 
-		Material(glm::vec3 colour);
-	};
+		void run(int bounceLimit, Renderer* renderer);
 
-	struct alignas(16) Sphere {
-		glm::vec3 centre;
-		float radius;
-		Material material;
-	};
+	private:
+		void uploadSceneBuffers();
 
-	struct Triangle {
-		alignas(16) glm::vec3 v0;
-		alignas(16) glm::vec3 v1;
-		alignas(16) glm::vec3 v2;
-		alignas(16) glm::vec3 normal;
-		Material material;
-	};
+		// Resizes the compute shader's per pixel statistics, takes the newest active pixel count the GPU has finished and clears the counter
+		// Nothing waits on the GPU, the count is a few frames old and kept as it is while no copy has arrived
+		void updateAdaptiveSampling(int width, int height, bool isAdaptive);
 
-	struct Ray {
-		glm::vec3 origin;
-		glm::vec3 direction;
-	};
+		// Copies this frame's active pixel count into the next free readback buffer, frames with every buffer in flight are not read
+		void queueActivePixelReadback();
 
-	struct Camera {
-		glm::vec3 location;
-		float fov;
-	};
+		// Resolution level of this frame, the finest that fits m_previewBudget while interacting and one finer per frame after
+		int getPreviewLevel(int width, int height);
 
-	struct HitSphere {
-		glm::vec3 hitPoint;
-		glm::vec3 hitColour;
-		glm::vec3 hitNormal;
+		// Traces the CPU path tracer at 1 / 2^level resolution and fills each block of frameBuffer with its pixel
+		void renderPreview(std::span<glm::vec4> frameBuffer, int width, int height, int level, int bounceLimit);
 
-		Material hitMaterial;
+		// Reads back the compute shader's newest finished timing, never waits, preview frames carry no pixels and are skipped
+		void updateDispatchCost();
 
-		glm::vec3 hitLight;
-	};
+		// Issues the next tiles of the image after the ones the last frame dispatched, as many as fit m_dispatchBudget
+		// Tiles along one row go out as a single dispatch, returns the number of pixels covered
+		size_t dispatchTiles(int width, int height);
 
-	struct Random {
-		using resultType = std::uint32_t;
+	public:
+		Scene m_scene;
+		PathTracer m_pathTracer;
+		bool m_accumilate;
+		bool m_useComputeShader;
+		int m_frames;
 
-		Random() = default;
-		Random(std::uint32_t seed);
+		// Shared by the compute shader and the CPU path tracer
+		SamplingMode m_samplingMode;
 
-		static constexpr resultType min() { return 0; }
-		static constexpr resultType max() { return UINT32_MAX; }
+		// Relative error at which a pixel stops being sampled while accumulating, 0 samples every pixel every frame
+		float m_adaptiveThreshold;
 
-		resultType operator()() {
-			return getRandomFloat();
-		}
+		// Fraction of pixels sampled in the last frame, the compute shader's count arrives a few frames late
+		float m_activePixelFraction;
 
-	private:
-		resultType m_randomNumber;
-		std::uint32_t getRandomFloat();
-	};
+		// Filters the CPU path tracer's output with m_pathTracer.m_denoiser, the compute shader writes no feature buffers
+		bool m_denoise;
 
-	class RayTracer {
+		// Traces at a lower resolution while m_isInteracting, then refines through 1/4, 1/2 and full resolution over the next frames
+		// Coarse frames are previews and never accumulate
+		bool m_useProgressivePreview;
+		bool m_isInteracting;
 
-	public:
-		RayTracer();
-		void init();
+		// Milliseconds the preview levels are picked to fit in
+		float m_previewBudget;
 
-		std::vector<glm::vec3> run(int bounceLimit, Renderer* renderer);
+		// Resolution of the last frame is 1 / 2^m_previewLevel, 0 is full resolution
+		int m_previewLevel;
+		static constexpr int maxPreviewLevel = 3;
 
-	private:
-		glm::vec3 traceRay(Ray& ray, const std::vector<Sphere>& spheres, int bounceLimit);
-		bool isRayIntersectSphere(const Ray& ray, const Sphere& sphere, float& closestIntersection);
-		glm::vec3 getRandomOnUnitSphere();
+		// The compute shader traces the image in m_dispatchTileSize squares, and each frame only as many as fit m_dispatchBudget milliseconds
+		// Tiles left out continue in the next frame, so a pass over the image can span several frames without restarting the accumulation
+		float m_dispatchBudget;
+		int m_dispatchTileSize;
 
-	public:
-		std::vector<Sphere> m_spheres;
-		std::vector<Triangle> m_triangles;
-		bool m_accumilate;
-		int m_frames;
-		glm::vec3 m_background;
+		// Tiles of the last frame's dispatch and of the whole image
+		int m_dispatchedTileCount;
+		int m_tileCount;
+
+		// Times the scene upload and trace stages of run, the application times the rest of the frame through it
+		FrameProfiler m_profiler;
 
 	private:
-		std::vector<glm::vec3> m_accumilateFrameBuffer;
 		Shader m_computeShader;
 
 		GLuint m_sphereSSBO;
 		GLuint m_triangleSSBO;
+		GLuint m_vertexSSBO;
+		GLuint m_normalSSBO;
+		GLuint m_materialSSBO;
+		GLuint m_lightSSBO;
+		GLuint m_bvhNodeSSBO;
+		GLuint m_bvhPrimitiveSSBO;
+		GLuint m_samplerSSBO;
+
+		// Seconds per traced pixel of the CPU path's last frame
+		float m_pixelCost;
+
+		// Seconds per pixel of the compute shader's newest timed full resolution frame, read from m_profiler's trace stage
+		float m_dispatchPixelCost;
+		std::vector<glm::vec4> m_previewFrameBuffer;
+
+		// First tile of the next frame's dispatch, and the pixels the last frame covered
+		int m_nextTile;
+		size_t m_dispatchedPixels;
+
+		GLuint m_statisticsTexture;
+		GLuint m_activePixelSSBO;
+
+		// Persistently mapped copies of the active pixel counter, each readable once its fence has signalled
+		struct ActivePixelReadback {
+			GLuint buffer;
+			const std::uint32_t* mappedCount;
+			GLsync fence;
+			size_t dispatchedPixels;
+		};
+
+		static constexpr int activePixelReadbackCount = 3;
+		std::array<ActivePixelReadback, activePixelReadbackCount> m_activePixelReadbacks;
+
+		// Copies complete in the order they were queued, the oldest pending one is checked first
+		int m_firstActivePixelReadback;
+		int m_pendingActivePixelReadbacks;
+		int m_statisticsWidth, m_statisticsHeight;
+
+		// Element counts the SSBOs were last allocated for, a different count reallocates the whole buffer
+		size_t m_sphereSSBOCount;
+		size_t m_triangleSSBOCount;
+		size_t m_vertexSSBOCount;
+		size_t m_normalSSBOCount;
+		size_t m_materialSSBOCount;
+		bool m_isBVHUploadDirty;
+		bool m_isBVHRebuilt;
 
 		GLuint m_CameraUBO;
 		GLuint m_paramsUBO;
 
+		// Camera of the last frame, moving it restarts the compute shader's accumulation
+		Camera m_lastCamera;
+
+		struct CameraUBO {
+			alignas(16) glm::vec4 location;
+			alignas(16) glm::vec4 forward;
+			alignas(16) glm::vec4 right;
+			alignas(16) glm::vec4 up;
+		};
+
 		struct ParamsUBO {
 			alignas(16) glm::vec4 info;
 			alignas(16) glm::vec4 backgroundColourandNumBounces;
-			alignas(16) float currentTime;
+			alignas(16) std::int32_t samplingMode;
+			float adaptiveThreshold;
+			std::int32_t samplesPerPixel;
+			std::int32_t samplerType;
+			std::int32_t previewLevel;
 		};
 
 		ParamsUBO m_params;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+
 #include "renderer.h"
 
 namespace RayTracer {
@@ -11,11 +13,25 @@ namespace RayTracer {
 
 	void Renderer::init(GLFWwindow* window) {
 		m_window = window;
+		m_windowWidth = 1;
+		m_windowHeight = 1;
+		m_currentStreamingBuffer = 0;
+
 		createOpenGLTexture();
+		createStreamingBuffers();
 	}
 
-	void Renderer::render(std::vector<glm::vec3> frameBuffer) {
-		updateOpenGLTexture(frameBuffer);
+	void Renderer::render() {
+		StreamingBuffer& streamingBuffer = m_streamingBuffers[m_currentStreamingBuffer];
+
+		// Sourcing the upload from a pixel buffer lets glTexSubImage2D return before the copy has happened
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamingBuffer.buffer);
+		glBindTexture(GL_TEXTURE_2D, m_texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_windowWidth, m_windowHeight, GL_RGBA, GL_FLOAT, nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		streamingBuffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_currentStreamingBuffer = (m_currentStreamingBuffer + 1) % streamingBufferCount;
 	}
 
 	GLuint Renderer::getTexture() {
@@ -27,8 +43,33 @@ namespace RayTracer {
 	}
 
 	void Renderer::setWidthAndHeight(int width, int height) {
+		width = std::max(1, width);
+		height = std::max(1, height);
+
+		if (width == m_windowWidth && height == m_windowHeight) {
+			return;
+		}
+
 		m_windowWidth = width;
 		m_windowHeight = height;
+
+		// The texture has immutable storage, so a resize needs a new texture rather than glTexImage2D
+		destroyStreamingBuffers();
+		glDeleteTextures(1, &m_texture);
+
+		createOpenGLTexture();
+		createStreamingBuffers();
+	}
+
+	void Renderer::clearTexture() {
+		glClearTexImage(m_texture, 0, GL_RGBA, GL_FLOAT, nullptr);
+	}
+
+	std::span<glm::vec4> Renderer::getFrameBuffer() {
+		StreamingBuffer& streamingBuffer = m_streamingBuffers[m_currentStreamingBuffer];
+		waitForFence(streamingBuffer.fence);
+
+		return std::span<glm::vec4>(streamingBuffer.mappedData, static_cast<size_t>(m_windowWidth) * m_windowHeight);
 	}
 
 	void Renderer::createOpenGLTexture() {
@@ -40,10 +81,50 @@ namespace RayTracer {
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
-	void Renderer::updateOpenGLTexture(std::vector<glm::vec3> framebuffer) {
-		glBindTexture(GL_TEXTURE_2D, m_texture);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_windowWidth, m_windowHeight,
-			GL_RGB, GL_FLOAT, framebuffer.data());
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_windowWidth, m_windowHeight, 0, GL_RGB, GL_FLOAT, framebuffer.data());
+	void Renderer::createStreamingBuffers() {
+		GLsizeiptr size = static_cast<GLsizeiptr>(m_windowWidth) * m_windowHeight * sizeof(glm::vec4);
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		for (StreamingBuffer& streamingBuffer : m_streamingBuffers) {
+			glGenBuffers(1, &streamingBuffer.buffer);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamingBuffer.buffer);
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+			streamingBuffer.mappedData = static_cast<glm::vec4*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+			streamingBuffer.fence = nullptr;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		m_currentStreamingBuffer = 0;
+	}
+
+	void Renderer::destroyStreamingBuffers() {
+		for (StreamingBuffer& streamingBuffer : m_streamingBuffers) {
+			waitForFence(streamingBuffer.fence);
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamingBuffer.buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glDeleteBuffers(1, &streamingBuffer.buffer);
+
+			streamingBuffer.buffer = 0;
+			streamingBuffer.mappedData = nullptr;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	void Renderer::waitForFence(GLsync& fence) {
+		if (fence == nullptr) {
+			return;
+		}
+
+		while (true) {
+			GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) {
+				break;
+			}
+		}
+
+		glDeleteSync(fence);
+		fence = nullptr;
 	}
 }
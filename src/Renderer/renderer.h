@@ -4,6 +4,7 @@
 #include <glfw/glfw3.h>
 #include <glad/gl.h>
 #include <vector>
+#include <span>
 #include <glm/glm.hpp>
 
 namespace RayTracer {
@@ -17,20 +18,39 @@ namespace RayTracer {
 		~Renderer();
 
 		void init(GLFWwindow* window);
-		void render(std::vector<glm::vec3> frameBuffer);
+
+		// Uploads the framebuffer last handed out by getFrameBuffer and moves on to the next streaming buffer
+		void render();
 
 		GLuint getTexture();
 		FrameBufferSettings getFrameBufferSize();
 		void setWidthAndHeight(int width, int height);
-		void updateOpenGLTexture(std::vector<glm::vec3> framebuffer);
+		void clearTexture();
+
+		// Persistently mapped pixel buffer the CPU tracer writes into, waits until the GPU has finished reading its last upload
+		std::span<glm::vec4> getFrameBuffer();
 
 	private:
 		void createOpenGLTexture();
+		void createStreamingBuffers();
+		void destroyStreamingBuffers();
+		void waitForFence(GLsync& fence);
 
 	private:
+		// Ring of pixel buffers so the upload of one frame overlaps the tracing of the next
+		struct StreamingBuffer {
+			GLuint buffer;
+			glm::vec4* mappedData;
+			GLsync fence;
+		};
+
+		static constexpr int streamingBufferCount = 3;
+
 		GLFWwindow* m_window;
 		int m_windowWidth, m_windowHeight;
 
 		GLuint m_texture;
+		StreamingBuffer m_streamingBuffers[streamingBufferCount];
+		int m_currentStreamingBuffer;
 	};
 }
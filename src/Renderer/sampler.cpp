@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "sampler.h"
+
+namespace RayTracer {
+	namespace {
+		// Same integer hash as the compute shader
+		std::uint32_t hash(std::uint32_t x) {
+			x += (x << 10u);
+			x ^= (x >> 6u);
+			x += (x << 3u);
+			x ^= (x >> 11u);
+			x += (x << 15u);
+			return x;
+		}
+
+		// A xorshift step before the hash, which on its own leaves nearby inputs too alike
+		std::uint32_t mix(std::uint32_t x) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			return hash(x);
+		}
+
+		std::uint32_t reverseBits(std::uint32_t x) {
+			x = (x << 16) | (x >> 16);
+			x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+			x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+			x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+			x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+			return x;
+		}
+
+		// Owen scrambling as a hash, from Burley "Practical Hash-based Owen Scrambling"
+		// Every bit is flipped depending only on the bits above it, which keeps the Sobol strata intact
+		std::uint32_t getOwenScrambled(std::uint32_t x, std::uint32_t seed) {
+			x = reverseBits(x);
+			x += seed;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return reverseBits(x);
+		}
+
+		// The first two Sobol dimensions, van der Corput and the one whose direction numbers come from the Pascal matrix
+		std::uint32_t getSobol(std::uint32_t index, int dimension) {
+			if (dimension == 0) {
+				return reverseBits(index);
+			}
+
+			std::uint32_t result = 0;
+			for (std::uint32_t direction = 0x80000000u; index != 0; index >>= 1, direction ^= direction >> 1) {
+				if (index & 1u) {
+					result ^= direction;
+				}
+			}
+			return result;
+		}
+
+		// Top 24 bits, so the result is exactly representable and always below 1
+		float toUnitFloat(std::uint32_t x) {
+			return (x >> 8) * (1.0f / 16777216.0f);
+		}
+
+		// Fractional parts of the square roots of the first primes in 32 bit fixed point (Richtmyer's sequence)
+		// They are independent over the rationals, so stepping two dimensions by them never lines the samples up
+		std::vector<std::uint32_t> generateSequenceSteps() {
+			std::vector<std::uint32_t> steps;
+			steps.reserve(Sampler::sequenceDimensionCount);
+
+			for (std::uint32_t candidate = 2; steps.size() < Sampler::sequenceDimensionCount; candidate++) {
+				bool isPrime = true;
+				for (std::uint32_t divisor = 2; divisor * divisor <= candidate; divisor++) {
+					isPrime &= candidate % divisor != 0;
+				}
+
+				if (isPrime) {
+					double root = std::sqrt(static_cast<double>(candidate));
+					steps.push_back(static_cast<std::uint32_t>((root - std::floor(root)) * 4294967296.0));
+				}
+			}
+			return steps;
+		}
+
+		// Ulichney's void and cluster method on a torus, with the energy of every texel updated incrementally as points are added and removed
+		std::vector<std::uint32_t> generateBlueNoiseMask() {
+			constexpr int size = Sampler::blueNoiseSize;
+			static_assert(size * size == 1 << 12, "Sampler::getBlueNoise spreads the ranks over 32 bits assuming 4096 texels");
+			constexpr int texelCount = size * size;
+			constexpr float sigma = 1.5f;
+
+			std::vector<float> gaussian(texelCount);
+			for (int y = 0; y < size; y++) {
+				for (int x = 0; x < size; x++) {
+					float dx = static_cast<float>(std::min(x, size - x));
+					float dy = static_cast<float>(std::min(y, size - y));
+					gaussian[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+				}
+			}
+
+			std::vector<float> energy(texelCount, 0.0f);
+			std::vector<bool> pattern(texelCount, false);
+
+			auto setPoint = [&](std::vector<bool>& points, std::vector<float>& energies, int texel, bool isSet) {
+				points[texel] = isSet;
+				float sign = isSet ? 1.0f : -1.0f;
+				int texelX = texel % size;
+				int texelY = texel / size;
+
+				for (int y = 0; y < size; y++) {
+					const float* row = &gaussian[((y - texelY) & (size - 1)) * size];
+					for (int x = 0; x < size; x++) {
+						energies[y * size + x] += sign * row[(x - texelX) & (size - 1)];
+					}
+				}
+			};
+
+			// Highest energy point and lowest energy gap
+			auto findTightestCluster = [&](const std::vector<bool>& points, const std::vector<float>& energies) {
+				int best = -1;
+				for (int i = 0; i < texelCount; i++) {
+					if (points[i] && (best < 0 || energies[i] > energies[best])) {
+						best = i;
+					}
+				}
+				return best;
+			};
+
+			auto findLargestVoid = [&](const std::vector<bool>& points, const std::vector<float>& energies) {
+				int best = -1;
+				for (int i = 0; i < texelCount; i++) {
+					if (!points[i] && (best < 0 || energies[i] < energies[best])) {
+						best = i;
+					}
+				}
+				return best;
+			};
+
+			// Fixed seed, so the mask and every render using it is the same on every run
+			Random random(0x2545f491u);
+			int initialCount = texelCount / 10;
+			for (int placed = 0; placed < initialCount;) {
+				int texel = static_cast<int>(random() % texelCount);
+				if (!pattern[texel]) {
+					setPoint(pattern, energy, texel, true);
+					placed++;
+				}
+			}
+
+			// Moves the tightest cluster into the largest void until that changes nothing
+			for (int i = 0; i < texelCount; i++) {
+				int cluster = findTightestCluster(pattern, energy);
+				setPoint(pattern, energy, cluster, false);
+
+				int largestVoid = findLargestVoid(pattern, energy);
+				setPoint(pattern, energy, largestVoid, true);
+
+				if (largestVoid == cluster) {
+					break;
+				}
+			}
+
+			std::vector<std::uint32_t> ranks(texelCount);
+
+			// The initial points are ranked by removing them tightest first, the rest by filling the largest voids
+			std::vector<bool> remainingPattern = pattern;
+			std::vector<float> remainingEnergy = energy;
+			for (int rank = initialCount - 1; rank >= 0; rank--) {
+				int cluster = findTightestCluster(remainingPattern, remainingEnergy);
+				setPoint(remainingPattern, remainingEnergy, cluster, false);
+				ranks[cluster] = rank;
+			}
+
+			for (int rank = initialCount; rank < texelCount; rank++) {
+				int largestVoid = findLargestVoid(pattern, energy);
+				setPoint(pattern, energy, largestVoid, true);
+				ranks[largestVoid] = rank;
+			}
+
+			return ranks;
+		}
+	}
+
+	Random::Random(std::uint32_t seed) {
+		m_randomNumber = seed;
+	}
+
+	std::uint32_t Random::getRandomFloat() {
+		uint32_t result = m_randomNumber;
+		result ^= result << 13;
+		result ^= result >> 17;
+		result ^= result << 5;
+		m_randomNumber = result;
+
+		return result;
+	}
+
+	Sampler::Sampler(SamplerType type, std::uint32_t pixelX, std::uint32_t pixelY, std::uint32_t sampleIndex) {
+		m_type = type;
+		m_pixelX = pixelX;
+		m_pixelY = pixelY;
+		m_pixelSeed = hash(pixelX ^ hash(pixelY + 0x9e3779b9u));
+		m_sampleIndex = sampleIndex;
+		m_dimensionOffset = 0;
+	}
+
+	void Sampler::setBounce(int bounce) {
+		m_dimensionOffset = static_cast<std::uint32_t>(bounce) * DIMENSION_COUNT;
+	}
+
+	float Sampler::get1D(SampleDimension dimension) {
+		std::uint32_t dimensionIndex = m_dimensionOffset + dimension;
+
+		switch (m_type) {
+		case SAMPLER_SOBOL: {
+			// Each dimension shuffles the sample order with its own seed, so dimensions are not correlated with each other
+			std::uint32_t seed = getDimensionSeed(dimensionIndex);
+			std::uint32_t index = getOwenScrambled(m_sampleIndex, seed);
+			return toUnitFloat(getOwenScrambled(getSobol(index, 0), hash(seed ^ 0xa511e9b3u)));
+		}
+
+		case SAMPLER_BLUE_NOISE:
+			return toUnitFloat(getBlueNoise(dimensionIndex));
+
+		default:
+			return toUnitFloat(getRandom(dimensionIndex));
+		}
+	}
+
+	glm::vec2 Sampler::get2D(SampleDimension dimension) {
+		std::uint32_t dimensionIndex = m_dimensionOffset + dimension;
+
+		switch (m_type) {
+		case SAMPLER_SOBOL: {
+			std::uint32_t seed = getDimensionSeed(dimensionIndex);
+			std::uint32_t index = getOwenScrambled(m_sampleIndex, seed);
+			return glm::vec2(
+				toUnitFloat(getOwenScrambled(getSobol(index, 0), hash(seed ^ 0xa511e9b3u))),
+				toUnitFloat(getOwenScrambled(getSobol(index, 1), hash(seed ^ 0x63d83595u))));
+		}
+
+		case SAMPLER_BLUE_NOISE:
+			return glm::vec2(toUnitFloat(getBlueNoise(dimensionIndex)), toUnitFloat(getBlueNoise(dimensionIndex + 1)));
+
+		default:
+			return glm::vec2(toUnitFloat(getRandom(dimensionIndex)), toUnitFloat(getRandom(dimensionIndex + 1)));
+		}
+	}
+
+	const std::vector<std::uint32_t>& Sampler::getBlueNoiseMask() {
+		static const std::vector<std::uint32_t> mask = generateBlueNoiseMask();
+		return mask;
+	}
+
+	const std::vector<std::uint32_t>& Sampler::getSequenceSteps() {
+		static const std::vector<std::uint32_t> steps = generateSequenceSteps();
+		return steps;
+	}
+
+	std::uint32_t Sampler::getDimensionSeed(std::uint32_t dimension) const {
+		return hash(m_pixelSeed ^ hash(dimension + 1u));
+	}
+
+	std::uint32_t Sampler::getRandom(std::uint32_t dimension) const {
+		return mix(getDimensionSeed(dimension) ^ hash(m_sampleIndex + 0x632be5abu));
+	}
+
+	std::uint32_t Sampler::getBlueNoise(std::uint32_t dimension) const {
+		// Every dimension reads the mask at its own toroidal offset, the rank is centred in its 1 / texelCount wide bin
+		std::uint32_t offset = hash(dimension + 1u);
+		std::uint32_t x = (m_pixelX + offset) & (blueNoiseSize - 1);
+		std::uint32_t y = (m_pixelY + (offset >> 16)) & (blueNoiseSize - 1);
+
+		std::uint32_t rank = getBlueNoiseMask()[y * blueNoiseSize + x];
+		std::uint32_t step = getSequenceSteps()[dimension % sequenceDimensionCount];
+
+		// The mask value starts each pixel's sequence, so the first samples of neighbouring pixels are spread apart
+		return (rank << 20) + (1u << 19) + m_sampleIndex * step;
+	}
+}
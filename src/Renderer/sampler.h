@@ -0,0 +1,82 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+namespace RayTracer {
+	struct Random {
+		using resultType = std::uint32_t;
+
+		Random() = default;
+		Random(std::uint32_t seed);
+
+		static constexpr resultType min() { return 0; }
+		static constexpr resultType max() { return UINT32_MAX; }
+
+		resultType operator()() {
+			return getRandomFloat();
+		}
+
+	private:
+		resultType m_randomNumber;
+		std::uint32_t getRandomFloat();
+	};
+
+	// Where the random numbers of a path sample come from, the compute shader uses the same values
+	enum SamplerType {
+		// Independent random numbers hashed from the pixel, sample index and dimension
+		SAMPLER_RANDOM,
+
+		// Owen scrambled Sobol points, every pair of dimensions is stratified over a pixel's samples
+		SAMPLER_SOBOL,
+
+		// A tiled blue noise mask offset per dimension, stepped along a Kronecker sequence per sample, which spreads the error of neighbouring pixels apart
+		SAMPLER_BLUE_NOISE
+	};
+
+	// Dimensions one bounce draws from, every bounce gets its own DIMENSION_COUNT dimensions
+	// Fixed slots rather than a running counter, so paths that skip a draw do not shift the dimensions of the bounces after it
+	enum SampleDimension {
+		DIMENSION_BOUNCE,
+		DIMENSION_ROULETTE = 2,
+		DIMENSION_LIGHT_CHOICE,
+		DIMENSION_LIGHT,
+		DIMENSION_LOBE = 6,
+		DIMENSION_COUNT
+	};
+
+	// Numbers in [0, 1) for one sample of one pixel, indexed by (pixel, sample index, bounce, dimension)
+	// Nothing depends on the thread drawing them, so a render is bit identical for any thread count or tile order
+	class Sampler {
+	public:
+		Sampler(SamplerType type, std::uint32_t pixelX, std::uint32_t pixelY, std::uint32_t sampleIndex);
+
+		void setBounce(int bounce);
+
+		float get1D(SampleDimension dimension);
+
+		// Uses dimension and dimension + 1, which are stratified together
+		glm::vec2 get2D(SampleDimension dimension);
+
+		// Rank of every texel of a blueNoiseSize x blueNoiseSize void and cluster mask, generated once on first use
+		static const std::vector<std::uint32_t>& getBlueNoiseMask();
+		static constexpr int blueNoiseSize = 64;
+
+		// Per sample step of each blue noise dimension, dimensions past the end reuse the steps from the start
+		static const std::vector<std::uint32_t>& getSequenceSteps();
+		static constexpr std::uint32_t sequenceDimensionCount = 256;
+
+	private:
+		std::uint32_t getDimensionSeed(std::uint32_t dimension) const;
+		std::uint32_t getRandom(std::uint32_t dimension) const;
+		std::uint32_t getBlueNoise(std::uint32_t dimension) const;
+
+	private:
+		SamplerType m_type;
+		std::uint32_t m_pixelX, m_pixelY;
+		std::uint32_t m_pixelSeed;
+		std::uint32_t m_sampleIndex;
+		std::uint32_t m_dimensionOffset;
+	};
+}
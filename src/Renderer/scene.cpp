@@ -0,0 +1,339 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "scene.h"
+#include "objLoader.h"
+#include "sceneCache.h"
+#include "profiler.h"
+
+namespace RayTracer {
+	Scene::Scene() {
+		m_background = glm::vec3(0.5f);
+		m_isAccelerationStructureDirty = true;
+		m_bvhBuildTime = 0.0;
+		m_isBVHFromCache = false;
+		m_pendingUpdate = BVH_UNCHANGED;
+		m_isLightListDirty = false;
+		m_isLightUpdateNeeded = true;
+		m_cacheDirectory = getDefaultSceneCacheDirectory();
+	}
+
+	bool Scene::loadDefault() {
+		Material material1 = Material({ 1.0f, 1.0f, 1.0f });
+		Material material2 = Material({ 1.0f, 1.0f, 1.0f });
+		Material material3 = Material({ 1.0f, 0.9f, 0.4f });
+		Material material4 = Material({ 1.0f, 0.3f, 0.0f });
+		Material material5 = Material({ 0.5f, 1.0f, 1.0f });
+
+		material1.emissionColour = glm::vec3(1.0f);
+		material1.emissiveStrength = 2.3f;
+
+		material2.reflectivness = 1.0f;
+
+		m_materials = { material1, material2, material3, material4, material5 };
+
+		m_spheres = {
+			Sphere({ { 0.0f, 23.9f, -3.0f }, 9.3f, 0 }),
+			Sphere({ { 0.0f, 0.0f, -2.5f }, 1.0f, 1 }),
+			Sphere({ { 3.0f, 0.0f, -3.0f }, 1.25f, 2 }),
+			Sphere({ { -3.0f, 0.0f, -3.0f }, 1.25f, 3 }),
+			Sphere({ { 0.0f, -20.0f, -3.0f }, 19.0f, 4 }),
+		};
+
+		m_triangles.clear();
+		m_vertices.clear();
+		m_normals.clear();
+
+		m_background = glm::vec3(0.5f);
+		m_dirtySpheres.clear();
+		m_dirtyTriangles.clear();
+		m_dirtyVertices.clear();
+		m_dirtyNormals.clear();
+		m_dirtyMaterials.clear();
+		m_isAccelerationStructureDirty = true;
+		m_isLightUpdateNeeded = true;
+
+		return loadOBJ(std::filesystem::path(PROJECT_DIR) / "assets" / "Untitled.obj");
+	}
+
+	bool Scene::loadOBJ(const std::filesystem::path& path, unsigned threadCount) {
+		ProfileZone zone("Load OBJ");
+		std::filesystem::path cachePath = getSceneCachePath(m_cacheDirectory, path);
+
+		m_isLightUpdateNeeded = true;
+
+		// The cache holds the whole scene, so it is only valid on top of the same primitives and materials it was saved with
+		std::uint64_t sourceHash;
+		bool isCacheable = !m_cacheDirectory.empty() && hashFile(path, sourceHash);
+
+		if (isCacheable) {
+			// Sphere and Triangle are padded to 16 bytes, so only their members are hashed
+			for (const Sphere& sphere : m_spheres) {
+				sourceHash = hashBytes(&sphere.centre, sizeof(glm::vec3), sourceHash);
+				sourceHash = hashBytes(&sphere.radius, sizeof(float), sourceHash);
+				sourceHash = hashBytes(&sphere.materialIndex, sizeof(std::uint32_t), sourceHash);
+			}
+
+			for (const Triangle& triangle : m_triangles) {
+				sourceHash = hashBytes(triangle.vertexIndices, sizeof(triangle.vertexIndices), sourceHash);
+				sourceHash = hashBytes(&triangle.materialIndex, sizeof(std::uint32_t), sourceHash);
+				sourceHash = hashBytes(triangle.normalIndices, sizeof(triangle.normalIndices), sourceHash);
+			}
+
+			sourceHash = hashBytes(m_vertices.data(), m_vertices.size() * sizeof(glm::vec3), sourceHash);
+			sourceHash = hashBytes(m_normals.data(), m_normals.size() * sizeof(glm::vec3), sourceHash);
+			sourceHash = hashBytes(m_materials.data(), m_materials.size() * sizeof(Material), sourceHash);
+
+			if (readSceneCache(cachePath, sourceHash, m_spheres, m_triangles, m_vertices, m_normals, m_materials, m_bvh)) {
+				// The next update skips the build, but still reports a rebuild so GPU copies get replaced
+				updatePrimitiveBounds();
+				m_sphereSoA.build(m_spheres, m_bvh.getPrimitiveIndices());
+				m_isAccelerationStructureDirty = false;
+				m_bvhBuildTime = 0.0;
+				m_isBVHFromCache = true;
+				m_pendingUpdate = BVH_REBUILT;
+				return true;
+			}
+		}
+
+		std::vector<std::filesystem::path> materialLibraries;
+		if (!RayTracer::loadOBJ(path, m_vertices, m_normals, m_triangles, m_materials, threadCount, &materialLibraries)) {
+			return false;
+		}
+
+		if (isCacheable) {
+			// Built now rather than on the next update, so the tree can be saved alongside the triangles
+			m_pendingUpdate = std::max(m_pendingUpdate, updateAccelerationStructure());
+
+			std::error_code error;
+			std::filesystem::create_directories(m_cacheDirectory, error);
+			if (!writeSceneCache(cachePath, sourceHash, materialLibraries, m_spheres, m_triangles, m_vertices, m_normals, m_materials, m_bvh)) {
+				std::cerr << "Could not write scene cache " << cachePath.string() << std::endl;
+			}
+		}
+
+		return true;
+	}
+
+	void Scene::markSphereDirty(size_t index) {
+		m_dirtySpheres.mark(index);
+		m_isAccelerationStructureDirty = true;
+		m_isLightUpdateNeeded = true;
+	}
+
+	void Scene::markTriangleDirty(size_t index) {
+		m_dirtyTriangles.mark(index);
+		m_isAccelerationStructureDirty = true;
+		m_isLightUpdateNeeded = true;
+	}
+
+	void Scene::markVertexDirty(size_t index) {
+		// Every triangle using the vertex moves with it, which the refit picks up from the recomputed bounds
+		m_dirtyVertices.mark(index);
+		m_isAccelerationStructureDirty = true;
+	}
+
+	void Scene::markNormalDirty(size_t index) {
+		// Only shading reads normals, so neither the BVH nor the lights change
+		m_dirtyNormals.mark(index);
+	}
+
+	void Scene::markMaterialDirty(size_t index) {
+		// Materials are only read when shading, so the BVH is left alone, but one may have started or stopped emitting
+		m_dirtyMaterials.mark(index);
+		m_isLightUpdateNeeded = true;
+	}
+
+	BVHUpdate Scene::updateAccelerationStructure() {
+		BVHUpdate pendingUpdate = m_pendingUpdate;
+		m_pendingUpdate = BVH_UNCHANGED;
+
+		size_t primitiveCount = m_spheres.size() + m_triangles.size();
+		bool isRebuild = primitiveCount != m_primitiveBounds.size() || m_bvh.isEmpty();
+
+		if (m_isLightUpdateNeeded || isRebuild) {
+			updateLights();
+		}
+
+		if (!m_isAccelerationStructureDirty && !isRebuild) {
+			return pendingUpdate;
+		}
+
+		updatePrimitiveBounds();
+		m_isAccelerationStructureDirty = false;
+
+		BVHUpdate update = BVH_REFIT;
+
+		if (isRebuild) {
+			ProfileZone zone("BVH Build");
+			auto buildStart = std::chrono::steady_clock::now();
+			m_bvh.build(m_primitiveBounds);
+			m_bvhBuildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+			m_isBVHFromCache = false;
+			update = BVH_REBUILT;
+		}
+
+		else {
+			// Edits from the properties panel keep the primitive count, so refitting is enough
+			ProfileZone zone("BVH Refit");
+			m_bvh.refit(m_primitiveBounds);
+		}
+
+		m_sphereSoA.build(m_spheres, m_bvh.getPrimitiveIndices());
+		return std::max(update, pendingUpdate);
+	}
+
+	void Scene::updatePrimitiveBounds() {
+		m_primitiveBounds.resize(m_spheres.size() + m_triangles.size());
+
+		for (size_t i = 0; i < m_spheres.size(); i++) {
+			const Sphere& sphere = m_spheres[i];
+			m_primitiveBounds[i] = AABB{ sphere.centre - glm::vec3(sphere.radius), sphere.centre + glm::vec3(sphere.radius) };
+		}
+
+		for (size_t i = 0; i < m_triangles.size(); i++) {
+			const Triangle& triangle = m_triangles[i];
+			AABB& bounds = m_primitiveBounds[m_spheres.size() + i];
+			bounds = AABB();
+			bounds.grow(m_vertices[triangle.vertexIndices[0]]);
+			bounds.grow(m_vertices[triangle.vertexIndices[1]]);
+			bounds.grow(m_vertices[triangle.vertexIndices[2]]);
+		}
+	}
+
+	void Scene::updateLights() {
+		m_lights.clear();
+
+		auto isEmissive = [&](std::uint32_t materialIndex) {
+			const Material& material = m_materials[materialIndex];
+			return material.emissiveStrength > 0.0f && material.emissionColour != glm::vec3(0.0f);
+		};
+
+		for (size_t i = 0; i < m_spheres.size(); i++) {
+			if (isEmissive(m_spheres[i].materialIndex)) {
+				m_lights.push_back(static_cast<std::uint32_t>(i));
+			}
+		}
+
+		for (size_t i = 0; i < m_triangles.size(); i++) {
+			if (isEmissive(m_triangles[i].materialIndex)) {
+				m_lights.push_back(static_cast<std::uint32_t>(m_spheres.size() + i));
+			}
+		}
+
+		m_isLightUpdateNeeded = false;
+		m_isLightListDirty = true;
+	}
+
+	const std::vector<std::uint32_t>& Scene::getLights() const {
+		return m_lights;
+	}
+
+	const Material& Scene::getMaterial(std::uint32_t primitive) const {
+		return primitive < m_spheres.size() ? m_materials[m_spheres[primitive].materialIndex] : m_materials[m_triangles[primitive - m_spheres.size()].materialIndex];
+	}
+
+	glm::vec3 Scene::getShadingNormal(const Triangle& triangle, const glm::vec3& point) const {
+		const glm::vec3& v0 = m_vertices[triangle.vertexIndices[0]];
+		glm::vec3 edge0 = m_vertices[triangle.vertexIndices[1]] - v0;
+		glm::vec3 edge1 = m_vertices[triangle.vertexIndices[2]] - v0;
+		glm::vec3 faceNormal = glm::normalize(glm::cross(edge0, edge1));
+
+		if (triangle.normalIndices[0] == noNormal) {
+			return faceNormal;
+		}
+
+		// Barycentric coordinates of the point, the weights of the second and third corner
+		glm::vec3 offset = point - v0;
+		float d00 = glm::dot(edge0, edge0);
+		float d01 = glm::dot(edge0, edge1);
+		float d11 = glm::dot(edge1, edge1);
+		float d20 = glm::dot(offset, edge0);
+		float d21 = glm::dot(offset, edge1);
+		float inverseDenominator = 1.0f / (d00 * d11 - d01 * d01);
+		float v = (d11 * d20 - d01 * d21) * inverseDenominator;
+		float w = (d00 * d21 - d01 * d20) * inverseDenominator;
+
+		glm::vec3 normal = (1.0f - v - w) * m_normals[triangle.normalIndices[0]] + v * m_normals[triangle.normalIndices[1]] + w * m_normals[triangle.normalIndices[2]];
+		float length = glm::length(normal);
+		return length > 0.0f ? normal / length : faceNormal;
+	}
+
+	const BVH& Scene::getBVH() const {
+		return m_bvh;
+	}
+
+	double Scene::getBVHBuildTime() const {
+		return m_bvhBuildTime;
+	}
+
+	bool Scene::isBVHFromCache() const {
+		return m_isBVHFromCache;
+	}
+
+	const SphereSoA& Scene::getSphereSoA() const {
+		return m_sphereSoA;
+	}
+
+	void DirtyRange::mark(size_t index) {
+		if (!isDirty()) {
+			begin = index;
+			end = index + 1;
+			return;
+		}
+
+		begin = std::min(begin, index);
+		end = std::max(end, index + 1);
+	}
+
+	glm::vec3 Camera::getForward() const {
+		float yawRadians = glm::radians(yaw);
+		float pitchRadians = glm::radians(pitch);
+		return glm::vec3(glm::sin(yawRadians) * glm::cos(pitchRadians), glm::sin(pitchRadians), glm::cos(yawRadians) * glm::cos(pitchRadians));
+	}
+
+	// Stays level however far the camera pitches, so looking straight up or down still has a right
+	glm::vec3 Camera::getRight() const {
+		float yawRadians = glm::radians(yaw);
+		return glm::vec3(glm::cos(yawRadians), 0.0f, -glm::sin(yawRadians));
+	}
+
+	glm::vec3 Camera::getUp() const {
+		return glm::cross(getForward(), getRight());
+	}
+
+	glm::vec3 Camera::getRayDirection(float x, float y, int width, int height) const {
+		float rayFactor = glm::tan(glm::radians(fov) / 2.0f);
+		float rayFactorAR = rayFactor * (width / static_cast<float>(height));
+
+		return glm::normalize(getForward()
+			+ (2.0f * x / width - 1.0f) * rayFactorAR * getRight()
+			+ (1.0f - 2.0f * y / height) * rayFactor * getUp());
+	}
+
+	bool Camera::project(const glm::vec3& point, int width, int height, glm::vec2& pixel) const {
+		glm::vec3 offset = point - location;
+		float depth = glm::dot(offset, getForward());
+		if (depth <= 1e-6f) {
+			return false;
+		}
+
+		float rayFactor = glm::tan(glm::radians(fov) / 2.0f);
+		float rayFactorAR = rayFactor * (width / static_cast<float>(height));
+
+		pixel.x = (glm::dot(offset, getRight()) / (depth * rayFactorAR) + 1.0f) * 0.5f * width;
+		pixel.y = (1.0f - glm::dot(offset, getUp()) / (depth * rayFactor)) * 0.5f * height;
+		return true;
+	}
+
+	Material::Material(glm::vec3 colour) {
+		materialColour = colour;
+		reflectivness = 0.0f;
+
+		emissiveStrength = 0.0f;
+		emissionColour = glm::vec3(0.0f);
+	}
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <filesystem>
+#include <cstdint>
+#include <limits>
+
+#include "bvh.h"
+#include "sphereSoA.h"
+
+namespace RayTracer {
+	struct alignas(16) Material {
+		glm::vec3 materialColour;
+		float reflectivness;
+
+		glm::vec3 emissionColour;
+		float emissiveStrength;
+
+		Material(glm::vec3 colour);
+	};
+
+	// Primitives reference the scene's material table, so a material shared by many primitives is only stored once
+	struct alignas(16) Sphere {
+		glm::vec3 centre;
+		float radius;
+		std::uint32_t materialIndex;
+	};
+
+	// Marks a triangle without corner normals, which is shaded with the plane of its vertices
+	constexpr std::uint32_t noNormal = std::numeric_limits<std::uint32_t>::max();
+
+	// Corners index into the scene's vertices and normals, which keeps a triangle at 32 bytes and lets neighbours share them
+	struct alignas(16) Triangle {
+		std::uint32_t vertexIndices[3];
+		std::uint32_t materialIndex;
+
+		// Shading normals only, interpolated across the triangle so smooth meshes look smooth, intersection tests use the vertices
+		std::uint32_t normalIndices[3];
+	};
+
+	struct Ray {
+		glm::vec3 origin;
+		glm::vec3 direction;
+	};
+
+	// Shared by the CPU path tracer and the compute shader, fov is vertical and all angles are in degrees
+	// Yaw turns about +y and pitch tilts up, at 0 and 0 the camera looks down +z with +x to the right of the image
+	struct Camera {
+		glm::vec3 location = glm::vec3(0.0f, 0.0f, -10.0f);
+		float fov = 45.0f;
+		float yaw = 0.0f;
+		float pitch = 0.0f;
+
+		glm::vec3 getForward() const;
+		glm::vec3 getRight() const;
+		glm::vec3 getUp() const;
+
+		// Ray through a point of a width x height image in pixels, (0, 0) is the top left corner
+		glm::vec3 getRayDirection(float x, float y, int width, int height) const;
+
+		// Inverse of getRayDirection, false when point is behind the camera
+		bool project(const glm::vec3& point, int width, int height, glm::vec2& pixel) const;
+
+		bool operator==(const Camera& other) const = default;
+	};
+
+	// Half open range of elements that changed since the last upload
+	struct DirtyRange {
+		size_t begin = 0;
+		size_t end = 0;
+
+		void mark(size_t index);
+		bool isDirty() const { return begin < end; }
+		void clear() { begin = end = 0; }
+	};
+
+	// Primitive ids below the sphere count are spheres, the rest index into the triangles
+	constexpr std::uint32_t noPrimitive = std::numeric_limits<std::uint32_t>::max();
+
+	enum BVHUpdate {
+		BVH_UNCHANGED,
+		BVH_REFIT,
+		BVH_REBUILT
+	};
+
+	// Everything that gets traced, shared by the CPU path tracer and the compute shader
+	class Scene {
+	public:
+		Scene();
+
+		// The spheres are set up either way, returns false after printing why when the mesh in assets could not be loaded
+		bool loadDefault();
+
+		// Appends the triangles of an OBJ file and its materials, see loadOBJ in objLoader.h
+		// The result is cached with a prebuilt BVH in a .rtcache file under m_cacheDirectory, which is reused until the OBJ, its materials or the scene it was added to change
+		bool loadOBJ(const std::filesystem::path& path, unsigned threadCount = 0);
+
+		// Call after editing an element of m_spheres, m_triangles, m_vertices, m_normals or m_materials so the BVH and any GPU copies get updated
+		void markSphereDirty(size_t index);
+		void markTriangleDirty(size_t index);
+		void markVertexDirty(size_t index);
+		void markNormalDirty(size_t index);
+		void markMaterialDirty(size_t index);
+
+		// Rebuilds the BVH when the primitive count changed and refits it after edits, the SoA spheres are recompiled either way
+		// The light list is refreshed here as well
+		BVHUpdate updateAccelerationStructure();
+		const BVH& getBVH() const;
+		const SphereSoA& getSphereSoA() const;
+
+		// Seconds the last full BVH build took, 0 when the tree came from a scene cache instead
+		double getBVHBuildTime() const;
+		bool isBVHFromCache() const;
+
+		// Primitive ids of every sphere and triangle with an emissive material
+		const std::vector<std::uint32_t>& getLights() const;
+		const Material& getMaterial(std::uint32_t primitive) const;
+
+		// Unit normal at a point on the triangle, its corner normals interpolated or its face normal when it has none
+		glm::vec3 getShadingNormal(const Triangle& triangle, const glm::vec3& point) const;
+
+	public:
+		std::vector<Sphere> m_spheres;
+		std::vector<Triangle> m_triangles;
+		std::vector<glm::vec3> m_vertices;
+		std::vector<glm::vec3> m_normals;
+		std::vector<Material> m_materials;
+		glm::vec3 m_background;
+		Camera m_camera;
+
+		// Elements edited since the compute shader last uploaded them
+		DirtyRange m_dirtySpheres;
+		DirtyRange m_dirtyTriangles;
+		DirtyRange m_dirtyVertices;
+		DirtyRange m_dirtyNormals;
+		DirtyRange m_dirtyMaterials;
+
+		// Set whenever getLights changes, cleared by the compute shader upload
+		bool m_isLightListDirty;
+
+		// Where loadOBJ keeps its scene caches, the user's cache directory by default, empty turns the cache off
+		std::filesystem::path m_cacheDirectory;
+
+	private:
+		void updatePrimitiveBounds();
+		void updateLights();
+
+	private:
+		// Primitive ids below m_spheres.size() are spheres, the rest index into m_triangles
+		BVH m_bvh;
+		SphereSoA m_sphereSoA;
+		std::vector<AABB> m_primitiveBounds;
+		bool m_isAccelerationStructureDirty;
+		double m_bvhBuildTime;
+		bool m_isBVHFromCache;
+
+		std::vector<std::uint32_t> m_lights;
+		bool m_isLightUpdateNeeded;
+
+		// Work loadOBJ already did that the next updateAccelerationStructure still has to report
+		BVHUpdate m_pendingUpdate;
+	};
+}
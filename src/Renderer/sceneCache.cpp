@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "sceneCache.h"
+#include "mappedFile.h"
+
+namespace RayTracer {
+	namespace {
+		constexpr char cacheMagic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+		// Bump whenever the header or the layout of the stored arrays changes
+		constexpr std::uint32_t cacheVersion = 4;
+
+		// Stands in for the hash of a dependency that does not exist, a real file hashing to it is as unlikely as any other collision
+		constexpr std::uint64_t absentFileHash = 0;
+
+		constexpr std::uint64_t arrayAlignment = 64;
+
+		struct ArrayRange {
+			std::uint64_t offset;
+			std::uint64_t count;
+		};
+
+		struct CacheHeader {
+			char magic[8];
+			std::uint32_t version;
+
+			// Element sizes catch layout changes from a different compiler or platform, not just a version bump
+			std::uint32_t sphereSize;
+			std::uint32_t triangleSize;
+			std::uint32_t vertexSize;
+			std::uint32_t materialSize;
+			std::uint32_t nodeSize;
+
+			std::uint64_t sourceHash;
+			std::uint64_t fileSize;
+
+			ArrayRange spheres;
+			ArrayRange triangles;
+			ArrayRange vertices;
+			ArrayRange normals;
+			ArrayRange materials;
+			ArrayRange nodes;
+			ArrayRange primitiveIndices;
+
+			// Dependencies are a list of (hash, path length, UTF-8 path) records
+			ArrayRange dependencies;
+		};
+
+		std::uint64_t alignOffset(std::uint64_t offset) {
+			return (offset + arrayAlignment - 1) / arrayAlignment * arrayAlignment;
+		}
+
+		bool isRangeValid(const ArrayRange& range, std::uint64_t elementSize, std::uint64_t fileSize) {
+			return range.offset <= fileSize && range.count <= (fileSize - range.offset) / elementSize;
+		}
+
+		// The element types are trivially copyable, so this compiles down to one block copy out of the mapping
+		template<typename T>
+		void copyArray(const char* data, const ArrayRange& range, std::vector<T>& output) {
+			const T* elements = reinterpret_cast<const T*>(data + range.offset);
+			output.assign(elements, elements + range.count);
+		}
+	}
+
+	std::uint64_t hashBytes(const void* data, size_t size, std::uint64_t hash) {
+		constexpr std::uint64_t prime = 1099511628211ull;
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+		size_t wordCount = size / sizeof(std::uint64_t);
+		for (size_t i = 0; i < wordCount; i++) {
+			std::uint64_t word;
+			std::memcpy(&word, bytes + i * sizeof(std::uint64_t), sizeof(word));
+			hash = (hash ^ word) * prime;
+		}
+
+		for (size_t i = wordCount * sizeof(std::uint64_t); i < size; i++) {
+			hash = (hash ^ bytes[i]) * prime;
+		}
+
+		return (hash ^ size) * prime;
+	}
+
+	bool hashFile(const std::filesystem::path& path, std::uint64_t& hash) {
+		MappedFile file;
+		if (!file.open(path)) {
+			return false;
+		}
+
+		hash = hashBytes(file.getData(), file.getSize());
+		return true;
+	}
+
+	std::filesystem::path getDefaultSceneCacheDirectory() {
+		auto getVariable = [](const char* name) {
+			const char* value = std::getenv(name);
+			return value && *value != '\0' ? std::filesystem::path(value) : std::filesystem::path();
+		};
+
+#if defined(_WIN32)
+		std::filesystem::path directory = getVariable("LOCALAPPDATA");
+#elif defined(__APPLE__)
+		std::filesystem::path directory = getVariable("HOME");
+		if (!directory.empty()) {
+			directory /= "Library/Caches";
+		}
+#else
+		std::filesystem::path directory = getVariable("XDG_CACHE_HOME");
+		if (directory.empty()) {
+			directory = getVariable("HOME");
+			if (!directory.empty()) {
+				directory /= ".cache";
+			}
+		}
+#endif
+
+		return directory.empty() ? directory : directory / "RayTracer";
+	}
+
+	std::filesystem::path getSceneCachePath(const std::filesystem::path& directory, const std::filesystem::path& source) {
+		std::error_code error;
+		std::u8string name = std::filesystem::absolute(source, error).generic_u8string();
+
+		std::ostringstream fileName;
+		fileName << source.filename().string() << '-' << std::hex << std::setw(16) << std::setfill('0') << hashBytes(name.data(), name.size()) << ".rtcache";
+		return directory / fileName.str();
+	}
+
+	bool writeSceneCache(const std::filesystem::path& path, std::uint64_t sourceHash, const std::vector<std::filesystem::path>& dependencies,
+		const std::vector<Sphere>& spheres, const std::vector<Triangle>& triangles, const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals,
+		const std::vector<Material>& materials, const BVH& bvh) {
+		std::string dependencyRecords;
+		for (const std::filesystem::path& dependency : dependencies) {
+			std::uint64_t dependencyHash;
+			if (!hashFile(dependency, dependencyHash)) {
+				dependencyHash = absentFileHash;
+			}
+
+			std::u8string name = std::filesystem::absolute(dependency).generic_u8string();
+			std::uint64_t nameLength = name.size();
+			dependencyRecords.append(reinterpret_cast<const char*>(&dependencyHash), sizeof(dependencyHash));
+			dependencyRecords.append(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+			dependencyRecords.append(reinterpret_cast<const char*>(name.data()), name.size());
+		}
+
+		const std::vector<BVHNode>& nodes = bvh.getNodes();
+		const std::vector<std::uint32_t>& primitiveIndices = bvh.getPrimitiveIndices();
+
+		CacheHeader header = {};
+		std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+		header.version = cacheVersion;
+		header.sphereSize = sizeof(Sphere);
+		header.triangleSize = sizeof(Triangle);
+		header.vertexSize = sizeof(glm::vec3);
+		header.materialSize = sizeof(Material);
+		header.nodeSize = sizeof(BVHNode);
+		header.sourceHash = sourceHash;
+
+		// Every array starts on its own aligned offset, so a reader can use it straight from the mapping
+		std::uint64_t offset = alignOffset(sizeof(CacheHeader));
+		auto placeArray = [&](ArrayRange& range, std::uint64_t count, std::uint64_t elementSize) {
+			range.offset = offset;
+			range.count = count;
+			offset = alignOffset(offset + count * elementSize);
+		};
+
+		placeArray(header.spheres, spheres.size(), sizeof(Sphere));
+		placeArray(header.triangles, triangles.size(), sizeof(Triangle));
+		placeArray(header.vertices, vertices.size(), sizeof(glm::vec3));
+		placeArray(header.normals, normals.size(), sizeof(glm::vec3));
+		placeArray(header.materials, materials.size(), sizeof(Material));
+		placeArray(header.nodes, nodes.size(), sizeof(BVHNode));
+		placeArray(header.primitiveIndices, primitiveIndices.size(), sizeof(std::uint32_t));
+		placeArray(header.dependencies, dependencyRecords.size(), 1);
+		header.fileSize = offset;
+
+		// Written next to the destination and renamed over it, so a crash never leaves a half written cache behind
+		std::filesystem::path temporaryPath = path;
+		temporaryPath += ".tmp";
+
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			if (!file) {
+				return false;
+			}
+
+			std::uint64_t writtenEnd = 0;
+			auto writeAt = [&](std::uint64_t position, const void* data, std::uint64_t size) {
+				file.seekp(static_cast<std::streamoff>(position));
+				file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+
+				// Seeking alone does not grow the file, so empty arrays do not count as written
+				if (size > 0) {
+					writtenEnd = std::max(writtenEnd, position + size);
+				}
+			};
+
+			writeAt(0, &header, sizeof(header));
+			writeAt(header.spheres.offset, spheres.data(), spheres.size() * sizeof(Sphere));
+			writeAt(header.triangles.offset, triangles.data(), triangles.size() * sizeof(Triangle));
+			writeAt(header.vertices.offset, vertices.data(), vertices.size() * sizeof(glm::vec3));
+			writeAt(header.normals.offset, normals.data(), normals.size() * sizeof(glm::vec3));
+			writeAt(header.materials.offset, materials.data(), materials.size() * sizeof(Material));
+			writeAt(header.nodes.offset, nodes.data(), nodes.size() * sizeof(BVHNode));
+			writeAt(header.primitiveIndices.offset, primitiveIndices.data(), primitiveIndices.size() * sizeof(std::uint32_t));
+			writeAt(header.dependencies.offset, dependencyRecords.data(), dependencyRecords.size());
+
+			// Pads the file out to the last aligned offset, which empty trailing arrays leave past the last byte written
+			if (header.fileSize > writtenEnd) {
+				writeAt(header.fileSize - 1, "", 1);
+			}
+
+			if (!file) {
+				return false;
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		if (error) {
+			std::filesystem::remove(temporaryPath, error);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool readSceneCache(const std::filesystem::path& path, std::uint64_t sourceHash, std::vector<Sphere>& spheres, std::vector<Triangle>& triangles,
+		std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<Material>& materials, BVH& bvh) {
+		MappedFile file;
+		if (!file.open(path) || file.getSize() < sizeof(CacheHeader)) {
+			return false;
+		}
+
+		const char* data = file.getData();
+		std::uint64_t fileSize = file.getSize();
+
+		CacheHeader header;
+		std::memcpy(&header, data, sizeof(header));
+
+		if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion || header.fileSize != fileSize) {
+			return false;
+		}
+
+		if (header.sphereSize != sizeof(Sphere) || header.triangleSize != sizeof(Triangle) || header.vertexSize != sizeof(glm::vec3) || header.materialSize != sizeof(Material) ||
+			header.nodeSize != sizeof(BVHNode) || header.sourceHash != sourceHash) {
+			return false;
+		}
+
+		if (!isRangeValid(header.spheres, sizeof(Sphere), fileSize) || !isRangeValid(header.triangles, sizeof(Triangle), fileSize) ||
+			!isRangeValid(header.vertices, sizeof(glm::vec3), fileSize) || !isRangeValid(header.normals, sizeof(glm::vec3), fileSize) ||
+			!isRangeValid(header.materials, sizeof(Material), fileSize) ||
+			!isRangeValid(header.nodes, sizeof(BVHNode), fileSize) || !isRangeValid(header.primitiveIndices, sizeof(std::uint32_t), fileSize) ||
+			!isRangeValid(header.dependencies, 1, fileSize)) {
+			return false;
+		}
+
+		if (header.primitiveIndices.count != header.spheres.count + header.triangles.count) {
+			return false;
+		}
+
+		// Rehashes every file the cache was built from, a changed material library invalidates it just like a changed mesh
+		const char* record = data + header.dependencies.offset;
+		const char* recordsEnd = record + header.dependencies.count;
+		while (record < recordsEnd) {
+			std::uint64_t dependencyHash;
+			std::uint64_t nameLength;
+			if (static_cast<size_t>(recordsEnd - record) < sizeof(dependencyHash) + sizeof(nameLength)) {
+				return false;
+			}
+
+			std::memcpy(&dependencyHash, record, sizeof(dependencyHash));
+			std::memcpy(&nameLength, record + sizeof(dependencyHash), sizeof(nameLength));
+			record += sizeof(dependencyHash) + sizeof(nameLength);
+
+			if (nameLength > static_cast<std::uint64_t>(recordsEnd - record)) {
+				return false;
+			}
+
+			std::u8string name(reinterpret_cast<const char8_t*>(record), nameLength);
+			record += nameLength;
+
+			std::uint64_t currentHash;
+			if (!hashFile(std::filesystem::path(name), currentHash)) {
+				currentHash = absentFileHash;
+			}
+
+			if (currentHash != dependencyHash) {
+				return false;
+			}
+		}
+
+		// Out of range indices would read past the vertex, normal and material arrays while tracing
+		const Sphere* cachedSpheres = reinterpret_cast<const Sphere*>(data + header.spheres.offset);
+		for (std::uint64_t i = 0; i < header.spheres.count; i++) {
+			if (cachedSpheres[i].materialIndex >= header.materials.count) {
+				return false;
+			}
+		}
+
+		const Triangle* cachedTriangles = reinterpret_cast<const Triangle*>(data + header.triangles.offset);
+		for (std::uint64_t i = 0; i < header.triangles.count; i++) {
+			const Triangle& triangle = cachedTriangles[i];
+			if (triangle.vertexIndices[0] >= header.vertices.count || triangle.vertexIndices[1] >= header.vertices.count ||
+				triangle.vertexIndices[2] >= header.vertices.count || triangle.materialIndex >= header.materials.count) {
+				return false;
+			}
+
+			// Either every corner has a normal or none has
+			bool isFlat = triangle.normalIndices[0] == noNormal && triangle.normalIndices[1] == noNormal && triangle.normalIndices[2] == noNormal;
+			bool hasNormals = triangle.normalIndices[0] < header.normals.count && triangle.normalIndices[1] < header.normals.count && triangle.normalIndices[2] < header.normals.count;
+			if (!isFlat && !hasNormals) {
+				return false;
+			}
+		}
+
+		// Built aside, so a tree that fails validation leaves the scene's BVH as it was
+		BVH cachedBVH;
+		const BVHNode* nodes = reinterpret_cast<const BVHNode*>(data + header.nodes.offset);
+		const std::uint32_t* primitiveIndices = reinterpret_cast<const std::uint32_t*>(data + header.primitiveIndices.offset);
+		if (!cachedBVH.assign(nodes, header.nodes.count, primitiveIndices, header.primitiveIndices.count)) {
+			return false;
+		}
+
+		bvh = std::move(cachedBVH);
+		copyArray(data, header.spheres, spheres);
+		copyArray(data, header.triangles, triangles);
+		copyArray(data, header.vertices, vertices);
+		copyArray(data, header.normals, normals);
+		copyArray(data, header.materials, materials);
+		return true;
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "scene.h"
+
+namespace RayTracer {
+	constexpr std::uint64_t hashSeed = 14695981039346656037ull;
+
+	// FNV-1a over 8 byte words, much faster than the byte wise version on large files and only used to detect changes
+	std::uint64_t hashBytes(const void* data, size_t size, std::uint64_t hash = hashSeed);
+	bool hashFile(const std::filesystem::path& path, std::uint64_t& hash);
+
+	// The user's cache directory, e.g. $XDG_CACHE_HOME/RayTracer or %LOCALAPPDATA%/RayTracer, empty if the platform has none
+	std::filesystem::path getDefaultSceneCacheDirectory();
+
+	// One cache per source file, named after the file and a hash of its absolute path so equally named files do not collide
+	std::filesystem::path getSceneCachePath(const std::filesystem::path& directory, const std::filesystem::path& source);
+
+	// Versioned binary snapshot of the scene's spheres, triangles, vertices, normals, material table and a prebuilt BVH
+	// sourceHash identifies what the scene was built from, and every dependency file is hashed so editing any of them invalidates the cache
+	// A dependency that does not exist is stored as absent, so creating it later invalidates the cache as well
+	bool writeSceneCache(const std::filesystem::path& path, std::uint64_t sourceHash, const std::vector<std::filesystem::path>& dependencies,
+		const std::vector<Sphere>& spheres, const std::vector<Triangle>& triangles, const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals,
+		const std::vector<Material>& materials, const BVH& bvh);
+
+	// Memory maps the cache and copies each array out in one block
+	// Returns false when the cache is missing, stale or invalid, the scene's arrays are only replaced on success
+	bool readSceneCache(const std::filesystem::path& path, std::uint64_t sourceHash, std::vector<Sphere>& spheres, std::vector<Triangle>& triangles,
+		std::vector<glm::vec3>& vertices, std::vector<glm::vec3>& normals, std::vector<Material>& materials, BVH& bvh);
+}
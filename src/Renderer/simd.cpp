@@ -0,0 +1,56 @@
+#pragma once
+
+#include "simd.h"
+
+#if defined(RAYTRACER_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace RayTracer {
+	namespace {
+		SIMDLevel detectSupportedLevel() {
+#if defined(RAYTRACER_X86) && defined(_MSC_VER) && !defined(__clang__)
+			int registers[4];
+			__cpuid(registers, 1);
+			bool hasSSE42 = (registers[2] & (1 << 20)) != 0;
+			bool hasOSXSave = (registers[2] & (1 << 27)) != 0;
+			bool hasAVX = (registers[2] & (1 << 28)) != 0;
+
+			// The operating system has to save the upper halves of the ymm registers on a context switch
+			bool hasYMMState = hasOSXSave && hasAVX && (_xgetbv(0) & 0x6) == 0x6;
+
+			__cpuidex(registers, 7, 0);
+			bool hasAVX2 = (registers[1] & (1 << 5)) != 0;
+
+			if (hasAVX2 && hasYMMState) {
+				return SIMD_AVX2;
+			}
+			return hasSSE42 ? SIMD_SSE42 : SIMD_SCALAR;
+#elif defined(RAYTRACER_X86)
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) {
+				return SIMD_AVX2;
+			}
+			return __builtin_cpu_supports("sse4.2") ? SIMD_SSE42 : SIMD_SCALAR;
+#else
+			return SIMD_SCALAR;
+#endif
+		}
+	}
+
+	SIMDLevel detectSIMDLevel() {
+		static const SIMDLevel level = detectSupportedLevel();
+		return level;
+	}
+
+	const char* getSIMDLevelName(SIMDLevel level) {
+		switch (level) {
+		case SIMD_AVX2:
+			return "AVX2";
+		case SIMD_SSE42:
+			return "SSE4.2";
+		default:
+			return "Scalar";
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RAYTRACER_X86
+#include <immintrin.h>
+#endif
+
+// MSVC exposes every intrinsic regardless of /arch, GCC and Clang need the instruction set enabled per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define RAYTRACER_TARGET_SSE42
+#define RAYTRACER_TARGET_AVX2
+#else
+#define RAYTRACER_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define RAYTRACER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace RayTracer {
+	enum SIMDLevel {
+		SIMD_SCALAR,
+		SIMD_SSE42,
+		SIMD_AVX2
+	};
+
+	// Highest instruction set both the CPU and the operating system support, checked once at startup
+	SIMDLevel detectSIMDLevel();
+	const char* getSIMDLevelName(SIMDLevel level);
+}
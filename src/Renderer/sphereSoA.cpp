@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "sphereSoA.h"
+#include "scene.h"
+
+namespace RayTracer {
+	namespace {
+		constexpr float hitEpsilon = 0.001f;
+
+		// Assumes the ray direction is normalised, so the quadratic's a term is 1
+		// Earlier entries win ties, like the per primitive BVH walk
+		std::uint32_t intersectSpheresScalar(const SphereSoA& spheres, std::uint32_t begin, std::uint32_t end, const Ray& ray, float& closestIntersection) {
+			std::uint32_t closestSphere = noPrimitive;
+
+			for (std::uint32_t i = begin; i < end; i++) {
+				float offsetX = ray.origin.x - spheres.m_centreX[i];
+				float offsetY = ray.origin.y - spheres.m_centreY[i];
+				float offsetZ = ray.origin.z - spheres.m_centreZ[i];
+
+				float bTerm = offsetX * ray.direction.x + offsetY * ray.direction.y + offsetZ * ray.direction.z;
+				float cTerm = offsetX * offsetX + offsetY * offsetY + offsetZ * offsetZ - spheres.m_radius[i] * spheres.m_radius[i];
+
+				float determinant = bTerm * bTerm - cTerm;
+				if (determinant < 0.0f) {
+					continue;
+				}
+
+				float determinantSqrt = std::sqrt(determinant);
+				float term0 = -bTerm - determinantSqrt;
+				float term1 = -bTerm + determinantSqrt;
+				float intersection = term0 > hitEpsilon ? term0 : term1;
+
+				if (intersection > hitEpsilon && intersection < closestIntersection) {
+					closestIntersection = intersection;
+					closestSphere = spheres.m_sphereIndex[i];
+				}
+			}
+
+			return closestSphere;
+		}
+
+#if defined(RAYTRACER_X86)
+		// One ray against eight spheres per iteration, the nearest lane is picked with a horizontal min
+		RAYTRACER_TARGET_AVX2 std::uint32_t intersectSpheresAVX2(const SphereSoA& spheres, std::uint32_t begin, std::uint32_t end, const Ray& ray, float& closestIntersection) {
+			const __m256 originX = _mm256_set1_ps(ray.origin.x);
+			const __m256 originY = _mm256_set1_ps(ray.origin.y);
+			const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+			const __m256 directionX = _mm256_set1_ps(ray.direction.x);
+			const __m256 directionY = _mm256_set1_ps(ray.direction.y);
+			const __m256 directionZ = _mm256_set1_ps(ray.direction.z);
+			const __m256 epsilon = _mm256_set1_ps(hitEpsilon);
+			const __m256 miss = _mm256_set1_ps(std::numeric_limits<float>::max());
+			const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+			std::uint32_t closestSphere = noPrimitive;
+
+			for (std::uint32_t block = begin; block < end; block += SphereSoA::simdWidth) {
+				__m256 offsetX = _mm256_sub_ps(originX, _mm256_loadu_ps(spheres.m_centreX.data() + block));
+				__m256 offsetY = _mm256_sub_ps(originY, _mm256_loadu_ps(spheres.m_centreY.data() + block));
+				__m256 offsetZ = _mm256_sub_ps(originZ, _mm256_loadu_ps(spheres.m_centreZ.data() + block));
+				__m256 radius = _mm256_loadu_ps(spheres.m_radius.data() + block);
+
+				__m256 bTerm = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(offsetX, directionX), _mm256_mul_ps(offsetY, directionY)), _mm256_mul_ps(offsetZ, directionZ));
+				__m256 cTerm = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(offsetX, offsetX), _mm256_mul_ps(offsetY, offsetY)), _mm256_mul_ps(offsetZ, offsetZ)), _mm256_mul_ps(radius, radius));
+
+				__m256 determinant = _mm256_sub_ps(_mm256_mul_ps(bTerm, bTerm), cTerm);
+				__m256 isHit = _mm256_cmp_ps(determinant, _mm256_setzero_ps(), _CMP_GE_OQ);
+
+				__m256 determinantSqrt = _mm256_sqrt_ps(_mm256_max_ps(determinant, _mm256_setzero_ps()));
+				__m256 negativeB = _mm256_sub_ps(_mm256_setzero_ps(), bTerm);
+				__m256 term0 = _mm256_sub_ps(negativeB, determinantSqrt);
+				__m256 term1 = _mm256_add_ps(negativeB, determinantSqrt);
+				__m256 intersection = _mm256_blendv_ps(term1, term0, _mm256_cmp_ps(term0, epsilon, _CMP_GT_OQ));
+
+				// Lanes past the end of the leaf read the next leaf's spheres or the padding, so they are masked off
+				__m256i laneCount = _mm256_set1_epi32(static_cast<int>(std::min<std::uint32_t>(end - block, SphereSoA::simdWidth)));
+				isHit = _mm256_and_ps(isHit, _mm256_castsi256_ps(_mm256_cmpgt_epi32(laneCount, laneIndices)));
+				isHit = _mm256_and_ps(isHit, _mm256_and_ps(_mm256_cmp_ps(intersection, epsilon, _CMP_GT_OQ), _mm256_cmp_ps(intersection, _mm256_set1_ps(closestIntersection), _CMP_LT_OQ)));
+
+				int hitMask = _mm256_movemask_ps(isHit);
+				if (hitMask == 0) {
+					continue;
+				}
+
+				__m256 distances = _mm256_blendv_ps(miss, intersection, isHit);
+				__m256 nearest = _mm256_min_ps(distances, _mm256_permute2f128_ps(distances, distances, 1));
+				nearest = _mm256_min_ps(nearest, _mm256_permute_ps(nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+				nearest = _mm256_min_ps(nearest, _mm256_permute_ps(nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+
+				// Lowest lane holding the minimum, so ties resolve in leaf order
+				int nearestMask = _mm256_movemask_ps(_mm256_cmp_ps(distances, nearest, _CMP_EQ_OQ)) & hitMask;
+				int lane = 0;
+				while ((nearestMask & (1 << lane)) == 0) {
+					lane++;
+				}
+
+				closestIntersection = _mm256_cvtss_f32(nearest);
+				closestSphere = spheres.m_sphereIndex[block + lane];
+			}
+
+			return closestSphere;
+		}
+#endif
+	}
+
+	SphereSoA::SphereSoA() {
+	}
+
+	void SphereSoA::build(const std::vector<Sphere>& spheres, const std::vector<std::uint32_t>& primitiveIndices) {
+		m_centreX.clear();
+		m_centreY.clear();
+		m_centreZ.clear();
+		m_radius.clear();
+		m_sphereIndex.clear();
+		m_sphereOffsets.resize(primitiveIndices.size() + 1);
+
+		const std::uint32_t sphereCount = static_cast<std::uint32_t>(spheres.size());
+
+		for (size_t i = 0; i < primitiveIndices.size(); i++) {
+			m_sphereOffsets[i] = static_cast<std::uint32_t>(m_sphereIndex.size());
+
+			std::uint32_t primitive = primitiveIndices[i];
+			if (primitive >= sphereCount) {
+				continue;
+			}
+
+			const Sphere& sphere = spheres[primitive];
+			m_centreX.push_back(sphere.centre.x);
+			m_centreY.push_back(sphere.centre.y);
+			m_centreZ.push_back(sphere.centre.z);
+			m_radius.push_back(sphere.radius);
+			m_sphereIndex.push_back(primitive);
+		}
+
+		m_sphereOffsets[primitiveIndices.size()] = static_cast<std::uint32_t>(m_sphereIndex.size());
+
+		size_t paddedSize = m_sphereIndex.size() + simdWidth;
+		m_centreX.resize(paddedSize, 0.0f);
+		m_centreY.resize(paddedSize, 0.0f);
+		m_centreZ.resize(paddedSize, 0.0f);
+		m_radius.resize(paddedSize, 0.0f);
+		m_sphereIndex.resize(paddedSize, noPrimitive);
+	}
+
+	void SphereSoA::getLeafRange(std::uint32_t first, std::uint32_t count, std::uint32_t& begin, std::uint32_t& end) const {
+		begin = m_sphereOffsets[first];
+		end = m_sphereOffsets[first + count];
+	}
+
+	SphereBlockFunction getSphereBlockFunction(SIMDLevel level) {
+#if defined(RAYTRACER_X86)
+		if (std::min(level, detectSIMDLevel()) == SIMD_AVX2) {
+			return intersectSpheresAVX2;
+		}
+#endif
+		return intersectSpheresScalar;
+	}
+}
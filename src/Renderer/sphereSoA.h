@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "simd.h"
+
+namespace RayTracer {
+	struct Sphere;
+	struct Ray;
+
+	// Sphere geometry only, one array per component so a BVH leaf's spheres load straight into SIMD registers
+	// Compiled from Scene::m_spheres, which stays the editable format and keeps the materials
+	class SphereSoA {
+	public:
+		static constexpr int simdWidth = 8;
+
+		SphereSoA();
+
+		// Stores the spheres in the order they appear in the BVH leaves, so every leaf's spheres are contiguous
+		// The arrays are padded with simdWidth unused entries, so a full block can be loaded from any leaf
+		void build(const std::vector<Sphere>& spheres, const std::vector<std::uint32_t>& primitiveIndices);
+
+		// Range of SoA entries holding the spheres of the leaf that covers primitive index positions [first, first + count)
+		void getLeafRange(std::uint32_t first, std::uint32_t count, std::uint32_t& begin, std::uint32_t& end) const;
+
+	public:
+		std::vector<float> m_centreX;
+		std::vector<float> m_centreY;
+		std::vector<float> m_centreZ;
+		std::vector<float> m_radius;
+
+		// Index into Scene::m_spheres for every entry, which is also the sphere's primitive id
+		std::vector<std::uint32_t> m_sphereIndex;
+
+	private:
+		// Number of spheres before each primitive index position, with one extra entry for the end
+		std::vector<std::uint32_t> m_sphereOffsets;
+	};
+
+	// Tests one ray against the spheres in [begin, end), shrinking closestIntersection on a hit
+	// Returns the index into Scene::m_spheres of the nearest sphere hit, or noPrimitive
+	using SphereBlockFunction = std::uint32_t (*)(const SphereSoA& spheres, std::uint32_t begin, std::uint32_t end, const Ray& ray, float& closestIntersection);
+
+	SphereBlockFunction getSphereBlockFunction(SIMDLevel level);
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+
+#include "tileScheduler.h"
+
+namespace RayTracer {
+	namespace {
+		std::uint64_t packRange(std::uint32_t front, std::uint32_t back) {
+			return (static_cast<std::uint64_t>(back) << 32) | front;
+		}
+	}
+
+	TileScheduler::TileScheduler()
+		: m_threadCount(0), m_generation(0), m_busyWorkers(0), m_isStopping(false),
+		  m_width(0), m_height(0), m_tileSize(1), m_tilesX(0), m_context(nullptr), m_invoke(nullptr) {
+	}
+
+	TileScheduler::~TileScheduler() {
+		stopWorkers();
+	}
+
+	void TileScheduler::init(unsigned threadCount) {
+		stopWorkers();
+
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		m_threadCount = threadCount;
+		m_queues = std::make_unique<TileQueue[]>(threadCount);
+		for (unsigned i = 0; i < threadCount; i++) {
+			m_queues[i].range.store(0);
+		}
+
+		m_isStopping = false;
+		m_generation = 0;
+
+		// Worker 0 is the thread that calls dispatchTiles
+		for (unsigned i = 1; i < threadCount; i++) {
+			m_workers.emplace_back(&TileScheduler::workerLoop, this, i);
+		}
+	}
+
+	unsigned TileScheduler::getThreadCount() const {
+		return m_threadCount;
+	}
+
+	void TileScheduler::dispatch(int width, int height, int tileSize, void* context, void (*invoke)(void*, const Tile&)) {
+		if (width <= 0 || height <= 0) {
+			return;
+		}
+
+		if (m_threadCount == 0) {
+			init(0);
+		}
+
+		m_width = width;
+		m_height = height;
+		m_tileSize = std::max(1, tileSize);
+		m_tilesX = (width + m_tileSize - 1) / m_tileSize;
+		m_context = context;
+		m_invoke = invoke;
+
+		int tilesY = (height + m_tileSize - 1) / m_tileSize;
+		std::uint32_t tileCount = static_cast<std::uint32_t>(m_tilesX * tilesY);
+
+		// Hand each worker a contiguous block of tiles so neighbouring tiles stay on the same core
+		for (unsigned i = 0; i < m_threadCount; i++) {
+			std::uint32_t front = static_cast<std::uint32_t>(static_cast<std::uint64_t>(tileCount) * i / m_threadCount);
+			std::uint32_t back = static_cast<std::uint32_t>(static_cast<std::uint64_t>(tileCount) * (i + 1) / m_threadCount);
+			m_queues[i].range.store(packRange(front, back), std::memory_order_relaxed);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_busyWorkers.store(m_threadCount - 1);
+			m_generation++;
+		}
+		m_wakeCondition.notify_all();
+
+		runTiles(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, [this]() { return m_busyWorkers.load() == 0; });
+	}
+
+	void TileScheduler::workerLoop(unsigned workerIndex) {
+		std::uint64_t seenGeneration = 0;
+
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wakeCondition.wait(lock, [&]() { return m_isStopping || m_generation != seenGeneration; });
+
+				if (m_isStopping) {
+					return;
+				}
+				seenGeneration = m_generation;
+			}
+
+			runTiles(workerIndex);
+
+			if (m_busyWorkers.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_doneCondition.notify_one();
+			}
+		}
+	}
+
+	void TileScheduler::runTiles(unsigned workerIndex) {
+		std::uint32_t tileIndex;
+		while (popTile(workerIndex, tileIndex) || stealTile(workerIndex, tileIndex)) {
+			m_invoke(m_context, getTile(tileIndex));
+		}
+	}
+
+	bool TileScheduler::popTile(unsigned workerIndex, std::uint32_t& tileIndex) {
+		std::atomic<std::uint64_t>& range = m_queues[workerIndex].range;
+		std::uint64_t current = range.load(std::memory_order_relaxed);
+
+		while (true) {
+			std::uint32_t front = static_cast<std::uint32_t>(current);
+			std::uint32_t back = static_cast<std::uint32_t>(current >> 32);
+
+			if (front >= back) {
+				return false;
+			}
+
+			if (range.compare_exchange_weak(current, packRange(front + 1, back), std::memory_order_acquire, std::memory_order_relaxed)) {
+				tileIndex = front;
+				return true;
+			}
+		}
+	}
+
+	bool TileScheduler::stealTile(unsigned workerIndex, std::uint32_t& tileIndex) {
+		for (unsigned offset = 1; offset < m_threadCount; offset++) {
+			std::atomic<std::uint64_t>& range = m_queues[(workerIndex + offset) % m_threadCount].range;
+			std::uint64_t current = range.load(std::memory_order_relaxed);
+
+			while (true) {
+				std::uint32_t front = static_cast<std::uint32_t>(current);
+				std::uint32_t back = static_cast<std::uint32_t>(current >> 32);
+
+				if (front >= back) {
+					break;
+				}
+
+				if (range.compare_exchange_weak(current, packRange(front, back - 1), std::memory_order_acquire, std::memory_order_relaxed)) {
+					tileIndex = back - 1;
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	Tile TileScheduler::getTile(std::uint32_t tileIndex) const {
+		int tileX = static_cast<int>(tileIndex) % m_tilesX;
+		int tileY = static_cast<int>(tileIndex) / m_tilesX;
+
+		Tile tile;
+		tile.xStart = tileX * m_tileSize;
+		tile.yStart = tileY * m_tileSize;
+		tile.xEnd = std::min(tile.xStart + m_tileSize, m_width);
+		tile.yEnd = std::min(tile.yStart + m_tileSize, m_height);
+		return tile;
+	}
+
+	void TileScheduler::stopWorkers() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_isStopping = true;
+		}
+		m_wakeCondition.notify_all();
+
+		for (std::thread& worker : m_workers) {
+			worker.join();
+		}
+
+		m_workers.clear();
+		m_threadCount = 0;
+	}
+}
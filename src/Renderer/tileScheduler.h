@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace RayTracer {
+	struct Tile {
+		int xStart, yStart;
+		int xEnd, yEnd;
+	};
+
+	// Persistent pool of worker threads that splits an image into tiles
+	// Each worker owns a contiguous run of tiles and steals from the back of the others once its own run is empty
+	class TileScheduler {
+	public:
+		TileScheduler();
+		~TileScheduler();
+
+		// Passing 0 uses every hardware thread, the calling thread counts as one of the workers
+		void init(unsigned threadCount);
+		unsigned getThreadCount() const;
+
+		// Calls tileFunction(const Tile&) once per tile across all workers and returns when every tile is done
+		template<typename TileFunction>
+		void dispatchTiles(int width, int height, int tileSize, TileFunction&& tileFunction);
+
+	private:
+		void dispatch(int width, int height, int tileSize, void* context, void (*invoke)(void*, const Tile&));
+		void workerLoop(unsigned workerIndex);
+		void runTiles(unsigned workerIndex);
+		bool popTile(unsigned workerIndex, std::uint32_t& tileIndex);
+		bool stealTile(unsigned workerIndex, std::uint32_t& tileIndex);
+		Tile getTile(std::uint32_t tileIndex) const;
+		void stopWorkers();
+
+	private:
+		// Low 32 bits are the next tile to run, high 32 bits are one past the last tile, so both ends are claimed with one CAS
+		struct alignas(64) TileQueue {
+			std::atomic<std::uint64_t> range;
+		};
+
+		std::vector<std::thread> m_workers;
+		std::unique_ptr<TileQueue[]> m_queues;
+		unsigned m_threadCount;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wakeCondition;
+		std::condition_variable m_doneCondition;
+		std::uint64_t m_generation;
+		std::atomic<unsigned> m_busyWorkers;
+		bool m_isStopping;
+
+		int m_width, m_height, m_tileSize, m_tilesX;
+		void* m_context;
+		void (*m_invoke)(void*, const Tile&);
+	};
+
+	template<typename TileFunction>
+	void TileScheduler::dispatchTiles(int width, int height, int tileSize, TileFunction&& tileFunction) {
+		// Type erased through a plain function pointer so a dispatch never allocates
+		dispatch(width, height, tileSize, &tileFunction, [](void* context, const Tile& tile) {
+			(*static_cast<std::remove_reference_t<TileFunction>*>(context))(tile);
+		});
+	}
+}
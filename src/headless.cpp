@@ -0,0 +1,295 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <cstdint>
+#include <iomanip>
+
+#include "Renderer/scene.h"
+#include "Renderer/pathTracer.h"
+#include "Renderer/imageWriter.h"
+#include "Renderer/profiler.h"
+
+namespace {
+	struct HeadlessSettings {
+		int width = 1920;
+		int height = 1080;
+		int samples = 64;
+		int bounces = 12;
+		int threads = 0;
+		bool usePacketTracing = true;
+		RayTracer::SIMDLevel simdLevel = RayTracer::detectSIMDLevel();
+		RayTracer::SamplingMode samplingMode = RayTracer::SAMPLING_NEXT_EVENT;
+		RayTracer::SamplerType samplerType = RayTracer::SAMPLER_SOBOL;
+		float adaptiveThreshold = 0.0f;
+		bool useDenoiser = false;
+		std::string output = "render.ppm";
+		std::string obj;
+		std::string trace;
+
+		// Left to the scene's default unless --cache-dir is given
+		bool isCacheDirectorySet = false;
+		std::string cacheDirectory;
+	};
+
+	void printUsage() {
+		std::cerr << "Usage: headless [--width N] [--height N] [--samples N] [--bounces N] [--threads N] [--obj file.obj] [--packets on|off] [--simd scalar|sse4.2|avx2] [--sampling uniform|importance|next-event] [--sampler random|sobol|blue-noise] [--adaptive threshold] [--denoise on|off] [--output file.ppm] [--trace file.json] [--cache-dir directory]" << std::endl;
+	}
+
+	// FNV-1a over the raw floats, two renders with the same settings print the same value whatever --threads is
+	std::uint64_t hashFrameBuffer(const std::vector<glm::vec4>& frameBuffer) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(frameBuffer.data());
+		std::uint64_t result = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < frameBuffer.size() * sizeof(glm::vec4); i++) {
+			result = (result ^ bytes[i]) * 0x100000001b3ull;
+		}
+		return result;
+	}
+
+	bool parseArguments(int argc, char** argv, HeadlessSettings& settings) {
+		for (int i = 1; i < argc; i++) {
+			const char* argument = argv[i];
+
+			if (std::strcmp(argument, "--help") == 0) {
+				return false;
+			}
+
+			if (i + 1 >= argc) {
+				std::cerr << "Missing value for " << argument << std::endl;
+				return false;
+			}
+
+			const char* value = argv[++i];
+
+			try {
+				if (std::strcmp(argument, "--width") == 0) {
+					settings.width = std::stoi(value);
+				}
+				else if (std::strcmp(argument, "--height") == 0) {
+					settings.height = std::stoi(value);
+				}
+				else if (std::strcmp(argument, "--samples") == 0) {
+					settings.samples = std::stoi(value);
+				}
+				else if (std::strcmp(argument, "--bounces") == 0) {
+					settings.bounces = std::stoi(value);
+				}
+				else if (std::strcmp(argument, "--threads") == 0) {
+					settings.threads = std::stoi(value);
+				}
+				else if (std::strcmp(argument, "--obj") == 0) {
+					settings.obj = value;
+				}
+				else if (std::strcmp(argument, "--packets") == 0) {
+					if (std::strcmp(value, "on") != 0 && std::strcmp(value, "off") != 0) {
+						throw std::invalid_argument(value);
+					}
+					settings.usePacketTracing = std::strcmp(value, "on") == 0;
+				}
+				else if (std::strcmp(argument, "--simd") == 0) {
+					if (std::strcmp(value, "scalar") == 0) {
+						settings.simdLevel = RayTracer::SIMD_SCALAR;
+					}
+					else if (std::strcmp(value, "sse4.2") == 0) {
+						settings.simdLevel = RayTracer::SIMD_SSE42;
+					}
+					else if (std::strcmp(value, "avx2") == 0) {
+						settings.simdLevel = RayTracer::SIMD_AVX2;
+					}
+					else {
+						throw std::invalid_argument(value);
+					}
+
+					if (settings.simdLevel > RayTracer::detectSIMDLevel()) {
+						std::cerr << "This CPU does not support " << value << std::endl;
+						return false;
+					}
+				}
+				else if (std::strcmp(argument, "--sampling") == 0) {
+					if (std::strcmp(value, "uniform") == 0) {
+						settings.samplingMode = RayTracer::SAMPLING_UNIFORM;
+					}
+					else if (std::strcmp(value, "importance") == 0) {
+						settings.samplingMode = RayTracer::SAMPLING_IMPORTANCE;
+					}
+					else if (std::strcmp(value, "next-event") == 0) {
+						settings.samplingMode = RayTracer::SAMPLING_NEXT_EVENT;
+					}
+					else {
+						throw std::invalid_argument(value);
+					}
+				}
+				else if (std::strcmp(argument, "--sampler") == 0) {
+					if (std::strcmp(value, "random") == 0) {
+						settings.samplerType = RayTracer::SAMPLER_RANDOM;
+					}
+					else if (std::strcmp(value, "sobol") == 0) {
+						settings.samplerType = RayTracer::SAMPLER_SOBOL;
+					}
+					else if (std::strcmp(value, "blue-noise") == 0) {
+						settings.samplerType = RayTracer::SAMPLER_BLUE_NOISE;
+					}
+					else {
+						throw std::invalid_argument(value);
+					}
+				}
+				else if (std::strcmp(argument, "--adaptive") == 0) {
+					settings.adaptiveThreshold = std::stof(value);
+				}
+				else if (std::strcmp(argument, "--denoise") == 0) {
+					if (std::strcmp(value, "on") != 0 && std::strcmp(value, "off") != 0) {
+						throw std::invalid_argument(value);
+					}
+					settings.useDenoiser = std::strcmp(value, "on") == 0;
+				}
+				else if (std::strcmp(argument, "--output") == 0) {
+					settings.output = value;
+				}
+				else if (std::strcmp(argument, "--trace") == 0) {
+					settings.trace = value;
+				}
+				else if (std::strcmp(argument, "--cache-dir") == 0) {
+					settings.cacheDirectory = value;
+					settings.isCacheDirectorySet = true;
+				}
+				else {
+					std::cerr << "Unknown argument " << argument << std::endl;
+					return false;
+				}
+			}
+
+			catch (const std::exception&) {
+				std::cerr << "Invalid value for " << argument << ": " << value << std::endl;
+				return false;
+			}
+		}
+
+		if (settings.width < 1 || settings.height < 1 || settings.samples < 1 || settings.bounces < 1 || settings.threads < 0 || settings.adaptiveThreshold < 0.0f) {
+			std::cerr << "Width, height, samples and bounces must be at least 1, the adaptive threshold can not be negative" << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+}
+
+// Renders the default scene on the CPU without creating a window, for machines with no display
+int main(int argc, char** argv) {
+	HeadlessSettings settings;
+	if (!parseArguments(argc, argv, settings)) {
+		printUsage();
+		return 1;
+	}
+
+	// Records from before the scene loads, so the trace covers the BVH build as well as every frame
+	if (!settings.trace.empty()) {
+		RayTracer::Profiler::get().start();
+	}
+
+	RayTracer::Scene scene;
+	if (settings.isCacheDirectorySet) {
+		scene.m_cacheDirectory = settings.cacheDirectory;
+	}
+
+	if (!scene.loadDefault()) {
+		return 1;
+	}
+
+	// Replaces the default scene's triangles, the load time is printed so large files can be timed
+	if (!settings.obj.empty()) {
+		scene.m_triangles.clear();
+		scene.m_vertices.clear();
+		scene.m_normals.clear();
+
+		auto loadStart = std::chrono::steady_clock::now();
+		if (!scene.loadOBJ(settings.obj, settings.threads)) {
+			return 1;
+		}
+		std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - loadStart;
+
+		std::cout << "Loaded " << scene.m_triangles.size() << " triangles from " << settings.obj << " in " << loadTime.count() << " s" << std::endl;
+
+		// Same arrays the compute shader uploads as storage buffers
+		size_t sceneBytes = scene.m_triangles.size() * sizeof(RayTracer::Triangle) + (scene.m_vertices.size() + scene.m_normals.size()) * sizeof(glm::vec3)
+			+ scene.m_materials.size() * sizeof(RayTracer::Material);
+		std::cout << "Triangle, vertex, normal and material data: " << sceneBytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+	}
+
+	// The OBJ loads build the tree already, so the time is the one the scene measured around the last full build
+	scene.updateAccelerationStructure();
+	if (scene.isBVHFromCache()) {
+		std::cout << "BVH loaded from the scene cache" << std::endl;
+	}
+
+	else {
+		std::cout << "BVH build time: " << scene.getBVHBuildTime() << " s" << std::endl;
+	}
+
+	RayTracer::PathTracer pathTracer;
+	pathTracer.init();
+	if (settings.threads > 0) {
+		pathTracer.m_threadCount = settings.threads;
+	}
+	pathTracer.m_usePacketTracing = settings.usePacketTracing;
+	pathTracer.m_simdLevel = settings.simdLevel;
+	pathTracer.m_samplerType = settings.samplerType;
+
+	std::vector<glm::vec4> frameBuffer(static_cast<size_t>(settings.width) * settings.height);
+
+	auto timeStart = std::chrono::steady_clock::now();
+
+	// With adaptive sampling every frame traces a different number of samples, so they are counted from the active pixels
+	double primaryRays = 0.0;
+	float activePixelFraction = 1.0f;
+
+	for (int sample = 1; sample <= settings.samples; sample++) {
+		int samplesPerPixel = settings.adaptiveThreshold > 0.0f ? RayTracer::PathTracer::getAdaptiveSampleCount(activePixelFraction) : 1;
+		pathTracer.render(scene, frameBuffer, settings.width, settings.height, settings.bounces, settings.samplingMode, true, settings.adaptiveThreshold);
+
+		activePixelFraction = pathTracer.getActivePixelFraction();
+		primaryRays += static_cast<double>(frameBuffer.size()) * activePixelFraction * samplesPerPixel;
+	}
+
+	std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - timeStart;
+
+	if (settings.adaptiveThreshold > 0.0f) {
+		std::cout << "Adaptive sampling: " << primaryRays / frameBuffer.size() << " samples per pixel on average, "
+			<< activePixelFraction * 100.0f << "% of pixels active in the last frame" << std::endl;
+	}
+
+	// Printed so the scalar and packet paths can be compared by running with different --packets and --simd values
+	std::cout << "Render time: " << elapsedTime.count() << " s, " << primaryRays / elapsedTime.count() / 1e6 << " M primary rays/s"
+		<< " (" << (settings.usePacketTracing ? RayTracer::getSIMDLevelName(settings.simdLevel) : "no") << " packets)" << std::endl;
+
+	if (settings.useDenoiser) {
+		auto denoiseStart = std::chrono::steady_clock::now();
+		pathTracer.denoise(frameBuffer, settings.width, settings.height);
+		std::chrono::duration<double, std::milli> denoiseTime = std::chrono::steady_clock::now() - denoiseStart;
+		std::cout << "Denoise time: " << denoiseTime.count() << " ms" << std::endl;
+	}
+
+	if (!settings.trace.empty()) {
+		RayTracer::Profiler& profiler = RayTracer::Profiler::get();
+		if (!profiler.writeChromeTrace(settings.trace.c_str())) {
+			std::cerr << "Failed to write " << settings.trace << std::endl;
+			return 1;
+		}
+
+		std::cout << "Wrote trace to " << settings.trace << ", " << profiler.getDroppedZoneCount() << " tile zones dropped to stay within the overhead budget, "
+			<< profiler.getOverwrittenZoneCount() << " overwritten" << std::endl;
+	}
+
+	if (!RayTracer::writePPM(settings.output.c_str(), frameBuffer, settings.width, settings.height)) {
+		std::cerr << "Failed to write " << settings.output << std::endl;
+		return 1;
+	}
+
+	std::cout << "Frame buffer hash: " << std::hex << std::setw(16) << std::setfill('0') << hashFrameBuffer(frameBuffer) << std::dec << std::endl;
+
+	std::cout << "Wrote " << settings.width << "x" << settings.height << " image with " << settings.samples << " samples to " << settings.output << std::endl;
+	return 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "Renderer/scene.h"
+#include "Renderer/pathTracer.h"
+
+// Renders CPU frames after a few warm up frames and fails if any of them touched the heap
+// Every allocation in the process goes through the replaced global operator new below
+namespace {
+	std::atomic<size_t> allocationCount = 0;
+
+	void* allocate(std::size_t size, std::size_t alignment) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+		size = std::max<std::size_t>(size, 1);
+
+		// MSVC has no aligned_alloc, and memory from _aligned_malloc has to go back through _aligned_free
+#if defined(_MSC_VER)
+		void* pointer = _aligned_malloc(size, std::max(alignment, alignof(std::max_align_t)));
+#else
+		// aligned_alloc needs the size to be a multiple of the alignment
+		void* pointer = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : std::malloc(size);
+#endif
+		if (pointer == nullptr) {
+			throw std::bad_alloc();
+		}
+		return pointer;
+	}
+
+	void deallocate(void* pointer) {
+#if defined(_MSC_VER)
+		_aligned_free(pointer);
+#else
+		std::free(pointer);
+#endif
+	}
+
+	struct FrameSettings {
+		const char* name;
+		bool isAccumulating;
+		float adaptiveThreshold;
+		bool usePacketTracing;
+		bool useDenoiser;
+		bool isCameraMoving;
+	};
+
+	constexpr int width = 96;
+	constexpr int height = 54;
+	constexpr int warmUpFrameCount = 4;
+	constexpr int measuredFrameCount = 16;
+}
+
+void* operator new(std::size_t size) {
+	return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+	deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+	deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+	deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+	deallocate(pointer);
+}
+
+int main() {
+	RayTracer::Scene scene;
+	if (!scene.loadDefault()) {
+		return 1;
+	}
+	scene.updateAccelerationStructure();
+
+	RayTracer::PathTracer pathTracer;
+	pathTracer.init();
+
+	std::vector<glm::vec4> frameBuffer(static_cast<size_t>(width) * height);
+
+	const FrameSettings frameSettings[] = {
+		{ "accumulating", true, 0.0f, true, false, false },
+		{ "single frame", false, 0.0f, true, false, false },
+		{ "scalar rays", true, 0.0f, false, false, false },
+		{ "adaptive", true, 0.02f, true, false, false },
+		{ "denoised", true, 0.0f, true, true, false },
+		{ "moving camera", true, 0.0f, true, false, true }
+	};
+
+	bool isAllocationFree = true;
+
+	for (const FrameSettings& settings : frameSettings) {
+		pathTracer.m_usePacketTracing = settings.usePacketTracing;
+
+		size_t allocationsBefore = 0;
+		for (int frame = 0; frame < warmUpFrameCount + measuredFrameCount; frame++) {
+			if (frame == warmUpFrameCount) {
+				allocationsBefore = allocationCount.load();
+			}
+
+			// Every frame reprojects the samples of the last one
+			if (settings.isCameraMoving) {
+				scene.m_camera.yaw += 0.5f;
+			}
+
+			pathTracer.render(scene, frameBuffer, width, height, 4, RayTracer::SAMPLING_NEXT_EVENT, settings.isAccumulating, settings.adaptiveThreshold);
+			if (settings.useDenoiser) {
+				pathTracer.denoise(frameBuffer, width, height);
+			}
+		}
+
+		size_t allocations = allocationCount.load() - allocationsBefore;
+		std::cout << settings.name << ": " << allocations << " allocations in " << measuredFrameCount << " frames" << std::endl;
+		isAllocationFree &= allocations == 0;
+	}
+
+	if (!isAllocationFree) {
+		std::cerr << "Steady state frames allocated" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "Renderer/rayTracer.h"
+#include "Renderer/renderer.h"
+
+// Renders the default scene, spheres and the OBJ cube, on the compute shader and on the CPU path tracer and compares the two
+// Both draw the same sample numbers, so beyond floating point differences the images only disagree by noise
+namespace {
+	constexpr int width = 160;
+	constexpr int height = 90;
+	constexpr int frameCount = 128;
+	constexpr int bounceLimit = 12;
+
+	// Two independent 128 sample renders of this scene differ by about 0.009, a missing or misplaced primitive by far more
+	constexpr double maximumError = 0.03;
+
+	// Relative difference of the mean of each channel, which catches a bias that noise would hide per pixel
+	constexpr double maximumMeanDifference = 0.02;
+
+	// ctest reports the test as skipped instead of failed on machines with no OpenGL 4.5 driver or display
+	constexpr int skipReturnCode = 77;
+}
+
+int main() {
+	if (!glfwInit()) {
+		std::cerr << "Could not initialise GLFW, skipping" << std::endl;
+		return skipReturnCode;
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(width, height, "Parity Test", NULL, NULL);
+	if (window == nullptr) {
+		std::cerr << "Could not create an OpenGL 4.5 context, skipping" << std::endl;
+		glfwTerminate();
+		return skipReturnCode;
+	}
+
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGL(glfwGetProcAddress)) {
+		std::cerr << "Failed to initialize GLAD, skipping" << std::endl;
+		glfwTerminate();
+		return skipReturnCode;
+	}
+
+	// Software drivers such as llvmpipe pass too, so the log says which one ran the shader
+	std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << std::endl;
+
+	RayTracer::Renderer renderer;
+	renderer.init(window);
+	renderer.setWidthAndHeight(width, height);
+
+	RayTracer::RayTracer rayTracer;
+	rayTracer.init();
+
+	// Without the cube only the sphere code would be compared
+	if (rayTracer.m_scene.m_triangles.empty()) {
+		std::cerr << "The default scene has no triangles" << std::endl;
+		return 1;
+	}
+	rayTracer.m_accumilate = true;
+	rayTracer.m_useComputeShader = true;
+
+	// Every tile goes out every frame, so each pixel gets exactly frameCount samples
+	rayTracer.m_dispatchBudget = 1e9f;
+
+	for (int frame = 0; frame < frameCount; frame++) {
+		rayTracer.run(bounceLimit, &renderer);
+	}
+
+	std::vector<glm::vec4> gpuFrameBuffer(static_cast<size_t>(width) * height);
+	glFinish();
+	glGetTextureImage(renderer.getTexture(), 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>(gpuFrameBuffer.size() * sizeof(glm::vec4)), gpuFrameBuffer.data());
+
+	// run brought the scene's acceleration structure up to date
+	RayTracer::PathTracer pathTracer;
+	pathTracer.init();
+	pathTracer.m_samplerType = rayTracer.m_pathTracer.m_samplerType;
+
+	std::vector<glm::vec4> cpuFrameBuffer(static_cast<size_t>(width) * height);
+	for (int frame = 0; frame < frameCount; frame++) {
+		pathTracer.render(rayTracer.m_scene, cpuFrameBuffer, width, height, bounceLimit, rayTracer.m_samplingMode, true, 0.0f);
+	}
+
+	// The compute shader's texture rows run bottom up, the CPU frame buffer's top down
+	// Both are clamped to the displayed range, so a few very bright pixels cannot dominate the error
+	double squaredError = 0.0;
+	double gpuSum[3] = {};
+	double cpuSum[3] = {};
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			const glm::vec4& gpu = gpuFrameBuffer[static_cast<size_t>(height - 1 - y) * width + x];
+			const glm::vec4& cpu = cpuFrameBuffer[static_cast<size_t>(y) * width + x];
+
+			for (int channel = 0; channel < 3; channel++) {
+				double gpuValue = std::clamp(static_cast<double>(gpu[channel]), 0.0, 1.0);
+				double cpuValue = std::clamp(static_cast<double>(cpu[channel]), 0.0, 1.0);
+
+				squaredError += (gpuValue - cpuValue) * (gpuValue - cpuValue);
+				gpuSum[channel] += gpuValue;
+				cpuSum[channel] += cpuValue;
+			}
+		}
+	}
+
+	double error = std::sqrt(squaredError / (3.0 * width * height));
+	double maximumChannelDifference = 0.0;
+	for (int channel = 0; channel < 3; channel++) {
+		maximumChannelDifference = std::max(maximumChannelDifference, std::abs(gpuSum[channel] - cpuSum[channel]) / std::max(cpuSum[channel], 1e-6));
+	}
+
+	std::cout << "RMS error: " << error << " (at most " << maximumError << "), mean difference: " << maximumChannelDifference * 100.0
+		<< "% (at most " << maximumMeanDifference * 100.0 << "%)" << std::endl;
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+
+	if (error > maximumError || maximumChannelDifference > maximumMeanDifference) {
+		std::cerr << "The compute shader and the CPU path tracer disagree" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
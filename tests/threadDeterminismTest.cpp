@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Renderer/scene.h"
+#include "Renderer/pathTracer.h"
+
+// Renders the same frames with one worker thread and with several, and fails unless every frame buffer is bit identical
+// Covers every mode that spreads work over tiles, so an order dependent sum or a per thread random stream shows up as a mismatch
+namespace {
+	struct FrameSettings {
+		const char* name;
+		bool isAccumulating;
+		float adaptiveThreshold;
+		bool usePacketTracing;
+		bool useDenoiser;
+		bool isCameraMoving;
+		RayTracer::SamplerType samplerType;
+	};
+
+	// Neither side is a multiple of the tile size, so the edge tiles are partial
+	constexpr int width = 100;
+	constexpr int height = 60;
+	constexpr int frameCount = 8;
+
+	std::vector<glm::vec4> renderFrames(const RayTracer::Scene& defaultScene, const FrameSettings& settings, int threadCount) {
+		// Every render gets its own copy, since a moving camera is written back to the scene
+		RayTracer::Scene scene = defaultScene;
+
+		RayTracer::PathTracer pathTracer;
+		pathTracer.init();
+		pathTracer.m_threadCount = threadCount;
+		pathTracer.m_usePacketTracing = settings.usePacketTracing;
+		pathTracer.m_samplerType = settings.samplerType;
+
+		std::vector<glm::vec4> frameBuffer(static_cast<size_t>(width) * height);
+		for (int frame = 0; frame < frameCount; frame++) {
+			if (settings.isCameraMoving) {
+				scene.m_camera.yaw += 0.5f;
+			}
+
+			pathTracer.render(scene, frameBuffer, width, height, 4, RayTracer::SAMPLING_NEXT_EVENT, settings.isAccumulating, settings.adaptiveThreshold);
+			if (settings.useDenoiser) {
+				pathTracer.denoise(frameBuffer, width, height);
+			}
+		}
+
+		return frameBuffer;
+	}
+}
+
+int main() {
+	RayTracer::Scene scene;
+	if (!scene.loadDefault()) {
+		return 1;
+	}
+	scene.updateAccelerationStructure();
+
+	// At least two workers even on a single core machine, and an odd count so the tiles do not split evenly
+	const int threadCounts[] = { 1, 3, static_cast<int>(std::max(2u, std::thread::hardware_concurrency())) };
+
+	const FrameSettings frameSettings[] = {
+		{ "accumulating", true, 0.0f, true, false, false, RayTracer::SAMPLER_SOBOL },
+		{ "single frame", false, 0.0f, true, false, false, RayTracer::SAMPLER_SOBOL },
+		{ "scalar rays", true, 0.0f, false, false, false, RayTracer::SAMPLER_SOBOL },
+		{ "random sampler", true, 0.0f, true, false, false, RayTracer::SAMPLER_RANDOM },
+		{ "blue noise sampler", true, 0.0f, true, false, false, RayTracer::SAMPLER_BLUE_NOISE },
+		{ "adaptive", true, 0.02f, true, false, false, RayTracer::SAMPLER_SOBOL },
+		{ "denoised", true, 0.0f, true, true, false, RayTracer::SAMPLER_SOBOL },
+		{ "moving camera", true, 0.0f, true, false, true, RayTracer::SAMPLER_SOBOL }
+	};
+
+	bool isDeterministic = true;
+
+	for (const FrameSettings& settings : frameSettings) {
+		std::vector<glm::vec4> reference = renderFrames(scene, settings, threadCounts[0]);
+
+		for (int threadCount : threadCounts) {
+			if (threadCount == threadCounts[0]) {
+				continue;
+			}
+
+			std::vector<glm::vec4> frameBuffer = renderFrames(scene, settings, threadCount);
+			bool isIdentical = std::memcmp(frameBuffer.data(), reference.data(), frameBuffer.size() * sizeof(glm::vec4)) == 0;
+
+			std::cout << settings.name << ", " << threadCount << " threads: " << (isIdentical ? "identical" : "different") << " to 1 thread" << std::endl;
+			isDeterministic &= isIdentical;
+		}
+	}
+
+	if (!isDeterministic) {
+		std::cerr << "Renders depend on the thread count" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}